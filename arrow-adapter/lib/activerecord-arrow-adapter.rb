@@ -16,4 +16,5 @@
 
 require_relative 'activerecord-arrow-adapter/version'
 require_relative 'activerecord-arrow-adapter/arrow_result'
+require_relative 'activerecord-arrow-adapter/arrow_result_cache'
 require_relative 'activerecord-arrow-adapter/arrow_mysql2_adapter'
@@ -20,6 +20,7 @@
 require 'active_record'
 require 'active_record/connection_adapters/mysql2_adapter'
 require_relative 'arrow_result'
+require_relative 'arrow_result_cache'
 
 module ActiveRecord
   module ConnectionHandling
@@ -47,28 +48,317 @@ end
 
 module ActiveRecordArrowAdapter
   class ArrowMysql2Adapter < ActiveRecord::ConnectionAdapters::Mysql2Adapter
+    # The event of ActiveSupport::Notifications for the conversion of
+    # a result by exec_query, whose payload has :sql, :name, :connection
+    # and :stats, the fetch_stats of the record batch.
+    # The statistics are collected only while the event is subscribed.
+    ARROW_EVENT = "arrow.active_record"
+
+    # The queries whose results can be cached by arrow_cache
+    READ_QUERY = /\A\s*(?:\(\s*)*(?:SELECT|WITH)\b/i
+    private_constant :READ_QUERY
+
+    # The read queries whose results depend on the session or the time,
+    # or which lock or write, which are never cached. Matches in the
+    # string literals are excluded too.
+    UNCACHEABLE_QUERY = /
+      \bFOR\s+(?:UPDATE|SHARE)\b |
+      \bLOCK\s+IN\s+SHARE\s+MODE\b |
+      \bINTO\b |
+      @ |
+      \b(?:LAST_INSERT_ID|ROW_COUNT|FOUND_ROWS|CONNECTION_ID|
+           GET_LOCK|RELEASE_LOCK|RELEASE_ALL_LOCKS|IS_FREE_LOCK|IS_USED_LOCK|
+           NOW|SYSDATE|CURDATE|CURTIME|CURRENT_DATE|CURRENT_TIME|CURRENT_TIMESTAMP|
+           LOCALTIME|LOCALTIMESTAMP|UTC_DATE|UTC_TIME|UTC_TIMESTAMP|UNIX_TIMESTAMP|
+           RAND|RANDOM_BYTES|UUID|UUID_SHORT|SLEEP|BENCHMARK|
+           USER|CURRENT_USER|SESSION_USER|SYSTEM_USER|CURRENT_ROLE|DATABASE|SCHEMA)\b
+    /ix
+    private_constant :UNCACHEABLE_QUERY
+
     def exec_query(sql, name = "SQL", binds = [], prepare: false)
       return super unless use_arrow?
 
-      if without_prepared_statement?(binds)
-        execute_and_free(sql, name) do |result|
-          ArrowResult.new(result.to_arrow) if result
+      cache_key = arrow_cache_key(sql, binds)
+      if cache_key
+        record_batch = arrow_cache.read(cache_key)
+        return ArrowResult.new(record_batch) if record_batch
+      end
+
+      record_batch =
+        if without_prepared_statement?(binds)
+          execute_and_free(sql, name) do |result|
+            convert_to_arrow(result, sql, name) if result
+          end
+        else
+          exec_stmt_and_free(sql, name, binds, cache_stmt: prepare) do |_, result|
+            convert_to_arrow(result, sql, name) if result
+          end
         end
-      else
-        exec_stmt_and_free(sql, name, binds, cache_stmt: prepare) do |_, result|
-          ArrowResult.new(result.to_arrow) if result
+      return nil unless record_batch
+
+      write_arrow_cache(cache_key, record_batch) if cache_key
+      ArrowResult.new(record_batch)
+    end
+
+    # The result is cached if arrow_cache is true, or nil in
+    # with_arrow_cache; see #arrow_cache for the configuration.
+    def select_all(arel, name = nil, binds = [], preparable: nil, use_arrow: true,
+                   arrow_cache: nil)
+      with_arrow(use_arrow) do
+        with_arrow_cache(arrow_cache.nil? ? @use_arrow_cache : arrow_cache) do
+          super(arel, name, binds, preparable: preparable)
         end
       end
     end
 
-    def select_all(arel, name = nil, binds = [], preparable: nil, use_arrow: true)
-      with_arrow(use_arrow) do
-        super(arel, name, binds, preparable: preparable)
+    # Cache the results of the read queries in the block, if the result
+    # cache is enabled by arrow_cache of the database configuration.
+    # Only the queries whose results can be stale for arrow_cache_ttl
+    # seconds should be cached; the entries are invalidated only by
+    # insert_arrow and clear_arrow_cache.
+    def with_arrow_cache(enabled = true)
+      old_value, @use_arrow_cache = @use_arrow_cache, enabled
+      yield
+    ensure
+      @use_arrow_cache = old_value
+    end
+
+    # Delete the entries of the result cache of all the processes
+    def clear_arrow_cache
+      arrow_cache.clear if @config[:arrow_cache]
+    end
+
+    # Run the relation as range queries on the integer column shard_by
+    # concurrently, and return the batches of the shards as the chunks of
+    # an Arrow::Table in the order of the ranges, followed by the rows
+    # whose shard_by is NULL if the column is nullable.
+    #
+    # The shards run on this connection and on the other connections of
+    # the pool that are available; each of them converts the result with
+    # the GVL released. In a transaction, they all run on this connection
+    # so that they see its uncommitted changes.
+    def select_arrow_sharded(relation, shard_by:, shards:)
+      unless shards.is_a?(Integer) && shards > 0
+        raise ArgumentError, "shards must be a positive integer: #{shards.inspect}"
+      end
+      if relation.limit_value || relation.offset_value
+        raise ArgumentError, "relation with limit or offset can't be sharded"
+      end
+      # The groups and the distinct rows span the shards
+      if relation.group_values.any? || !relation.having_clause.empty? || relation.distinct_value
+        raise ArgumentError, "relation with group, having or distinct can't be sharded"
+      end
+
+      ranges = shard_ranges(relation, shard_by, shards)
+      if ranges.empty?
+        record_batch = execute_arrow(relation.to_sql, "Arrow Shard")
+        return Arrow::Table.new(record_batch.schema, [record_batch])
+      end
+
+      sqls = ranges.map { |range| relation.where(shard_by => range).to_sql }
+      # NULL is in none of the ranges
+      sqls << relation.where(shard_by => nil).to_sql if nullable_column?(relation, shard_by)
+      record_batches = Array.new(sqls.size)
+      queue = Queue.new
+      sqls.each_with_index { |sql, i| queue << [sql, i] }
+      queue.close
+
+      n_threads = transaction_open? ? 0 : [sqls.size - 1, available_connections].min
+      threads = Array.new(n_threads) do
+        Thread.new do
+          Thread.current.report_on_exception = false
+          begin
+            pool.with_connection do |connection|
+              while (sql, i = queue.pop)
+                record_batches[i] = connection.execute_arrow(sql, "Arrow Shard")
+              end
+            end
+          rescue ActiveRecord::ConnectionTimeoutError
+            # The shards are left to the other threads and this connection
+          end
+        end
+      end
+      error = nil
+      begin
+        while (sql, i = queue.pop)
+          record_batches[i] = execute_arrow(sql, "Arrow Shard")
+        end
+      rescue Exception => e
+        error = e
+        queue.clear
+      end
+      # Wait for all the shards before raising the error of any of them
+      threads.each do |thread|
+        begin
+          thread.join
+        rescue Exception => e
+          error ||= e
+        end
+      end
+      raise error if error
+      Arrow::Table.new(record_batches.first.schema, record_batches)
+    end
+
+    # Insert the rows of an Arrow::Table or an Arrow::RecordBatch into
+    # the table by LOAD DATA LOCAL INFILE, or by multi-row INSERT
+    # statements if it is disabled, and return the number of the
+    # inserted rows. See Mysql2Arrow::ClientExtension#insert_arrow for
+    # the options.
+    def insert_arrow(table_name, data, **options)
+      materialize_transactions if respond_to?(:materialize_transactions, true)
+
+      n_rows = log("INSERT INTO #{quote_table_name(table_name)} FROM Arrow", "Arrow Insert") do
+        @connection.insert_arrow(table_name.to_s, data, **options)
+      end
+      clear_query_cache
+      clear_arrow_cache
+      n_rows
+    end
+
+    protected
+
+    def execute_arrow(sql, name)
+      execute_and_free(sql, name) do |result|
+        result.to_arrow(arrow_options)
       end
     end
 
     private
 
+    def convert_to_arrow(result, sql, name)
+      unless ActiveSupport::Notifications.notifier.listening?(ARROW_EVENT)
+        return result.to_arrow(arrow_options)
+      end
+
+      payload = { sql: sql, name: name, connection: self }
+      ActiveSupport::Notifications.instrument(ARROW_EVENT, payload) do
+        record_batch = result.to_arrow(arrow_options.merge(stats: true))
+        payload[:stats] = record_batch.fetch_stats
+        record_batch
+      end
+    end
+
+    # The key of the query in the result cache, or nil if the query is
+    # not to be cached: the cache is disabled or not requested, the query
+    # can write, lock or depend on the session, or a transaction can see
+    # its own changes.
+    #
+    # The key includes the server, the user, the database, the fingerprint
+    # of the schema of the database and the arrow_cache_namespace, which can be
+    # changed to invalidate the entries, e.g. to the version of the
+    # migrations.
+    def arrow_cache_key(sql, binds)
+      return nil unless @config[:arrow_cache] && @use_arrow_cache
+      return nil if transaction_open?
+      return nil unless READ_QUERY =~ sql
+      return nil if UNCACHEABLE_QUERY =~ sql
+
+      values = binds.map do |bind|
+        bind.respond_to?(:value_for_database) ? bind.value_for_database : bind
+      end
+      arrow_cache.key(sql,
+                      values,
+                      @config.values_at(:host, :port, :socket, :username, :database,
+                                        :arrow_cache_namespace),
+                      arrow_schema_fingerprint,
+                      arrow_options)
+    end
+
+    # The checksum of the columns of the tables in the database, which
+    # changes by ALTER TABLE. It is queried at most once in
+    # arrow_cache_schema_ttl seconds, 5 by default, so that a hit doesn't
+    # need to wait for it.
+    def arrow_schema_fingerprint
+      now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      ttl = @config[:arrow_cache_schema_ttl] || 5
+      if @arrow_schema_fingerprint.nil? || @arrow_schema_fingerprint_at + ttl <= now
+        # Not by select_rows, which would look up the cache again
+        @arrow_schema_fingerprint = @connection.query(<<~SQL, as: :array).first
+          SELECT
+            COUNT(*),
+            SUM(CRC32(CONCAT_WS(',', table_name, column_name, ordinal_position,
+                                column_type, is_nullable, collation_name)))
+          FROM information_schema.columns
+          WHERE table_schema = DATABASE()
+        SQL
+        @arrow_schema_fingerprint_at = now
+      end
+      @arrow_schema_fingerprint
+    end
+
+    # The cache is best effort: a failure to write an entry, e.g. by a
+    # full /dev/shm, doesn't fail the query
+    def write_arrow_cache(key, record_batch)
+      arrow_cache.write(key, record_batch)
+    rescue SystemCallError, Arrow::Error => error
+      @logger.warn("Failed to write the Arrow result cache: #{error.message}") if @logger
+    end
+
+    # The result cache from the database configuration:
+    #
+    # * arrow_cache - true to cache the results of the read queries
+    #   requested by select_all(arrow_cache: true) or with_arrow_cache
+    # * arrow_cache_path - the directory shared by the processes, which
+    #   must be private to the user, /dev/shm/activerecord-arrow-adapter-UID
+    #   by default
+    # * arrow_cache_secret - the secret of the keys of the deployment,
+    #   generated into the directory by default
+    # * arrow_cache_ttl - the seconds an entry is valid for, 60 by default
+    # * arrow_cache_max_bytes - the maximum bytes of the entries,
+    #   256MiB by default
+    # * arrow_cache_namespace - a value to be changed to invalidate the
+    #   entries, e.g. the schema version
+    # * arrow_cache_schema_ttl - the seconds the fingerprint of the schema
+    #   in the keys is reused for, 5 by default
+    def arrow_cache
+      @arrow_cache ||= ArrowResultCache.new(path: @config[:arrow_cache_path],
+                                            ttl: @config[:arrow_cache_ttl],
+                                            max_bytes: @config[:arrow_cache_max_bytes],
+                                            secret: @config[:arrow_cache_secret])
+    end
+
+    def nullable_column?(relation, column)
+      column = relation.klass.columns_hash[column.to_s]
+      column.nil? || column.null
+    end
+
+    # The connections of the pool which can be checked out without waiting
+    def available_connections
+      stat = pool.stat
+      [stat[:size] - stat[:busy] - stat[:dead] - stat[:waiting], 0].max
+    end
+
+    # Split the range of the values of the column into at most n ranges;
+    # the last one includes the maximum value
+    def shard_ranges(relation, column, n)
+      quoted_column = "#{quote_table_name(relation.table_name)}.#{quote_column_name(column)}"
+      min, max = select_rows(relation.unscope(:order, :select)
+                                     .select(Arel.sql("MIN(#{quoted_column}), MAX(#{quoted_column})"))
+                                     .to_sql,
+                             "Arrow Shard Range").first
+      return [] if min.nil?
+      unless min.is_a?(Integer) && max.is_a?(Integer)
+        raise ArgumentError, "shard_by must be an integer column: #{column}"
+      end
+
+      width = (max - min + n) / n
+      (min..max).step(width).map do |lower|
+        upper = lower + width
+        upper > max ? (lower..max) : (lower...upper)
+      end
+    end
+
+    # Options of to_arrow from the database configuration:
+    #
+    # * arrow_memory_pool - default, system, jemalloc, mimalloc or arena
+    # * arrow_memory_limit - the maximum bytes a query can allocate
+    def arrow_options
+      @arrow_options ||= {
+        memory_pool: @config[:arrow_memory_pool],
+        memory_limit: @config[:arrow_memory_limit],
+      }.compact
+    end
+
     def use_arrow?
       @use_arrow
     end
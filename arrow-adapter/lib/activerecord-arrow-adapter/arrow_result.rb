@@ -22,6 +22,9 @@ require 'arrow'
 
 module ActiveRecordArrowAdapter
   class ArrowResult < ActiveRecord::Result
+    # The number of rows materialized at once by #each
+    EACH_SLICE_ROWS = 1024
+
     def initialize(record_batch)
       @record_batch = record_batch
       @columns = nil
@@ -47,11 +50,16 @@ module ActiveRecordArrowAdapter
     end
 
     def each
-      if block_given?
-        hash_rows.each(&proc)
+      return to_enum(__method__) { length } unless block_given?
+
+      if @hash_rows
+        @hash_rows.each { |row| yield row }
       else
-        hash_rows.to_enum { length }
+        0.step(length - 1, EACH_SLICE_ROWS) do |offset|
+          slice_hash_rows(offset, EACH_SLICE_ROWS).each { |row| yield row }
+        end
       end
+      self
     end
 
     def to_hash
@@ -70,24 +78,56 @@ module ActiveRecordArrowAdapter
     end
 
     def [](idx)
-      hash_rows[idx]
+      return hash_rows[idx] if @hash_rows
+
+      case idx
+      when Integer
+        idx += length if idx < 0
+        return nil unless 0 <= idx && idx < length
+        slice_hash_rows(idx, 1).first
+      when Range
+        offset = idx.begin || 0
+        offset += length if offset < 0
+        return nil unless 0 <= offset && offset <= length
+        last = idx.end.nil? ? length - 1 : idx.end
+        last += length if last < 0
+        last -= 1 if idx.exclude_end? && !idx.end.nil?
+        slice_hash_rows(offset, [last - offset + 1, 0].max)
+      else
+        hash_rows[idx]
+      end
+    end
+
+    def first(n = nil)
+      return self[0] if n.nil?
+      raise ArgumentError, 'negative array size' if n.negative?
+      slice_hash_rows(0, n)
     end
 
-    def first
-      return nil if @record_batch.empty?
-      Hash[columns.zip(rows.first)] # TODO
+    def last(n = nil)
+      return self[-1] if n.nil?
+      raise ArgumentError, 'negative array size' if n.negative?
+      n = [n, length].min
+      slice_hash_rows(length - n, n)
     end
 
-    def last
-      return nil if @record_batch.empty?
-      Hash[columns.zip(rows.last)] # TODO
+    # The Arrow array of the column, without copying the values
+    def column(name)
+      index = columns.index(name.to_s)
+      return nil if index.nil?
+      @record_batch.get_column_data(index)
     end
 
     def cast_values(type_overrides = {})
       if type_overrides.empty? || 
            (column_types == column_types.merge(type_overrides))
-        result = rows
-        columns.one? ? result.map!(:first) : result
+        if columns.one?
+          # The values of rows, which are converted by mysql2-arrow in the
+          # same way as the other columns, e.g. DATE into Date
+          rows.map(&:first)
+        else
+          rows
+        end
       else
         super
       end
@@ -97,7 +137,9 @@ module ActiveRecordArrowAdapter
 
       def hash_rows
         @hash_rows ||=
-          begin
+          if @record_batch.respond_to?(:to_rows)
+            @record_batch.to_rows(as: :hash)
+          else
             columns = self.columns.map { |c| c.dup.freeze }
             rows.map do |row|
               {}.tap do |hash|
@@ -113,6 +155,21 @@ module ActiveRecordArrowAdapter
           end
       end
 
+      # Hashes of the rows in the range, converted from the slice of the
+      # record batch not to materialize the other rows
+      def slice_hash_rows(offset, n_rows)
+        n_rows = [n_rows, length - offset].min
+        return [] if n_rows <= 0
+
+        slice = @record_batch.slice(offset, n_rows)
+        return slice.to_rows(as: :hash) if slice.respond_to?(:to_rows)
+
+        columns = self.columns.map { |c| c.dup.freeze }
+        slice.raw_records.map do |row|
+          Hash[columns.zip(row)]
+        end
+      end
+
       def generate_columns
         @record_batch.schema.fields.map do |field|
           field.name
@@ -120,7 +177,13 @@ module ActiveRecordArrowAdapter
       end
 
       def generate_rows
-        @record_batch.raw_records
+        # mysql2-arrow converts the rows in C++ with the converters
+        # chosen for each column
+        if @record_batch.respond_to?(:to_rows)
+          @record_batch.to_rows
+        else
+          @record_batch.raw_records
+        end
       end
   end
 end
@@ -0,0 +1,203 @@
+# frozen_string_literal: true
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+require 'fileutils'
+require 'openssl'
+require 'securerandom'
+require 'tmpdir'
+require 'arrow'
+
+module ActiveRecordArrowAdapter
+  # ArrowResultCache shares the record batches of query results between
+  # processes, e.g. the forked workers of Puma or Unicorn, as Arrow IPC
+  # files in a directory, which is in /dev/shm by default where it exists.
+  #
+  # A hit maps the file into memory and reads the record batch without
+  # copying the values. An entry is written into a temporary file and
+  # renamed, so that the other processes never see a partial entry.
+  # Entries expire after ttl seconds, and the oldest entries are evicted
+  # when the total size exceeds max_bytes.
+  #
+  # The directory must be private to the user of the process, since an
+  # entry written by another user would be read as the result of a query.
+  # The keys are keyed by a secret, so that the entries of a query can't
+  # be found from the query either.
+  class ArrowResultCache
+    DEFAULT_TTL = 60
+    DEFAULT_MAX_BYTES = 256 * 1024 * 1024
+
+    EXTENSION = '.arrow'
+    SECRET_FILE = 'secret'
+
+    def self.default_path
+      base = File.directory?('/dev/shm') ? '/dev/shm' : Dir.tmpdir
+      File.join(base, "activerecord-arrow-adapter-#{Process.euid}")
+    end
+
+    attr_reader :path, :ttl, :max_bytes
+
+    # The secret is shared by the processes of the deployment; it is
+    # generated into the directory if it isn't given.
+    def initialize(path: nil, ttl: nil, max_bytes: nil, secret: nil)
+      @path = path || self.class.default_path
+      @ttl = ttl || DEFAULT_TTL
+      @max_bytes = max_bytes || DEFAULT_MAX_BYTES
+      FileUtils.mkdir_p(@path, mode: 0o700)
+      check_directory
+      @secret = secret || read_secret
+    end
+
+    # The key of the components, which must be dumped by Marshal
+    def key(*components)
+      OpenSSL::HMAC.hexdigest('SHA256', @secret, Marshal.dump(components))
+    end
+
+    # The cached record batch of the key, or nil
+    def read(key)
+      file = entry_path(key)
+      begin
+        mtime = File.mtime(file)
+      rescue Errno::ENOENT
+        return nil
+      end
+      if expired?(mtime, Time.now)
+        delete(file)
+        return nil
+      end
+
+      # The record batch refers to the mapped memory, which stays
+      # valid even after the file is closed and evicted
+      input = Arrow::MemoryMappedInputStream.new(file)
+      begin
+        reader = Arrow::RecordBatchFileReader.new(input)
+        reader.read_record_batch(0)
+      ensure
+        input.close
+      end
+    rescue Arrow::Error
+      # Evicted by another process after File.mtime
+      nil
+    end
+
+    def write(key, record_batch)
+      file = entry_path(key)
+      temporary_file = "#{file}.#{Process.pid}.#{SecureRandom.hex(4)}.tmp"
+      output = Arrow::FileOutputStream.new(temporary_file, false)
+      begin
+        writer = Arrow::RecordBatchFileWriter.new(output, record_batch.schema)
+        begin
+          writer.write_record_batch(record_batch)
+        ensure
+          writer.close
+        end
+      ensure
+        output.close
+      end
+      File.rename(temporary_file, file)
+      temporary_file = nil
+      evict
+    ensure
+      delete(temporary_file) if temporary_file
+    end
+
+    # Delete the expired entries, and the oldest entries over max_bytes
+    def evict
+      now = Time.now
+      entries = Dir.glob(File.join(@path, "*#{EXTENSION}")).map { |file|
+        begin
+          [file, File.stat(file)]
+        rescue Errno::ENOENT
+          nil
+        end
+      }.compact
+      entries.reject! do |file, stat|
+        expired?(stat.mtime, now) && delete(file)
+      end
+
+      total = entries.sum { |_, stat| stat.size }
+      entries.sort_by { |_, stat| stat.mtime }.each do |file, stat|
+        break if total <= @max_bytes
+        delete(file)
+        total -= stat.size
+      end
+    end
+
+    def clear
+      Dir.glob(File.join(@path, "*#{EXTENSION}")).each do |file|
+        delete(file)
+      end
+    end
+
+    private
+
+    # Refuse a directory that another user can write into
+    def check_directory
+      stat = File.lstat(@path)
+      unless stat.directory?
+        raise SecurityError, "Arrow result cache path isn't a directory: #{@path}"
+      end
+      unless stat.uid == Process.euid
+        raise SecurityError, "Arrow result cache directory isn't owned by the user: #{@path}"
+      end
+      unless (stat.mode & 0o022).zero?
+        raise SecurityError,
+              "Arrow result cache directory is writable by the others: #{@path}"
+      end
+    end
+
+    # Read the secret of the directory, or generate it by the first process
+    def read_secret
+      file = File.join(@path, SECRET_FILE)
+      begin
+        return File.binread(file)
+      rescue Errno::ENOENT
+      end
+
+      # Linked after it is written, so that the other processes never
+      # read a partial secret
+      temporary_file = "#{file}.#{Process.pid}.#{SecureRandom.hex(4)}.tmp"
+      File.open(temporary_file, File::WRONLY | File::CREAT | File::EXCL, 0o600) do |output|
+        output.write(SecureRandom.random_bytes(32))
+      end
+      begin
+        File.link(temporary_file, file)
+      rescue Errno::EEXIST
+        # Generated by another process meanwhile
+      ensure
+        delete(temporary_file)
+      end
+      File.binread(file)
+    end
+
+    def entry_path(key)
+      File.join(@path, "#{key}#{EXTENSION}")
+    end
+
+    def expired?(mtime, now)
+      mtime + @ttl <= now
+    end
+
+    def delete(file)
+      File.unlink(file)
+      true
+    rescue Errno::ENOENT
+      true
+    end
+  end
+end
@@ -46,4 +46,196 @@ class ArrowMysql2AdapterTest < Test::Unit::TestCase
                      @connection.select_all(@query_statement, use_arrow: false))
     end
   end
+
+  sub_test_case('.exec_query') do
+    test('arrow.active_record event') do
+      events = []
+      subscriber = ActiveSupport::Notifications.subscribe('arrow.active_record') do |*args|
+        events << ActiveSupport::Notifications::Event.new(*args)
+      end
+      begin
+        result = @connection.exec_query(@query_statement)
+      ensure
+        ActiveSupport::Notifications.unsubscribe(subscriber)
+      end
+      assert_equal([[@query_statement, result.length]],
+                   events.collect {|event| [event.payload[:sql], event.payload[:stats][:rows]]})
+    end
+  end
+
+  sub_test_case('arrow_cache') do
+    def setup
+      super
+      @cache_dir = Dir.mktmpdir
+      ActiveRecord::Base.establish_connection(
+        host: 'localhost',
+        username: 'root',
+        database: 'test',
+        adapter: 'arrow_mysql2',
+        arrow_cache: true,
+        arrow_cache_path: @cache_dir
+      )
+      @connection = ActiveRecord::Base.connection
+    end
+
+    def teardown
+      ActiveRecord::Base.remove_connection
+      FileUtils.rm_rf(@cache_dir)
+    end
+
+    def cache_entries
+      Dir.glob(File.join(@cache_dir, '*.arrow'))
+    end
+
+    test('hit') do
+      expected = @connection.select_all(@query_statement, arrow_cache: true).rows
+      dont_allow(@connection).execute_and_free
+      assert_equal([expected, 1],
+                   [@connection.select_all(@query_statement, arrow_cache: true).rows,
+                    cache_entries.size])
+    end
+
+    test('not requested') do
+      @connection.select_all(@query_statement)
+      assert_equal([], cache_entries)
+    end
+
+    test('with_arrow_cache') do
+      @connection.with_arrow_cache do
+        @connection.select_all(@query_statement)
+        @connection.select_all('SELECT 1', arrow_cache: false)
+      end
+      assert_equal(1, cache_entries.size)
+    end
+
+    test('uncacheable queries') do
+      [
+        "#{@query_statement} FOR UPDATE",
+        "#{@query_statement} LOCK IN SHARE MODE",
+        'SELECT NOW()',
+        'SELECT RAND()',
+        'SELECT LAST_INSERT_ID()',
+        'SELECT @@session.sql_mode',
+      ].each do |sql|
+        @connection.select_all(sql, arrow_cache: true)
+      end
+      assert_equal([], cache_entries)
+    end
+
+    test('in transaction') do
+      @connection.transaction do
+        @connection.select_all(@query_statement, arrow_cache: true)
+      end
+      assert_equal([], cache_entries)
+    end
+
+    test('write failure') do
+      stub(@connection.send(:arrow_cache)).write { raise Errno::ENOSPC }
+      assert_equal(10,
+                   @connection.select_all(@query_statement, arrow_cache: true).rows.size)
+    end
+
+    test('insert_arrow') do
+      @connection.execute('CREATE TEMPORARY TABLE arrow_cache_insert_test (id INT)')
+      @connection.select_all(@query_statement, arrow_cache: true)
+      table = Arrow::Table.new('id' => Arrow::Int32Array.new([1]))
+      @connection.insert_arrow('arrow_cache_insert_test', table, local_infile: false)
+      assert_equal([], cache_entries)
+    end
+
+    test('schema change') do
+      ActiveRecord::Base.establish_connection(
+        host: 'localhost',
+        username: 'root',
+        database: 'test',
+        adapter: 'arrow_mysql2',
+        arrow_cache: true,
+        arrow_cache_path: @cache_dir,
+        arrow_cache_schema_ttl: 0
+      )
+      @connection = ActiveRecord::Base.connection
+      @connection.execute('CREATE TABLE arrow_cache_test (id INT)')
+      begin
+        @connection.execute('INSERT INTO arrow_cache_test VALUES (1)')
+        sql = 'SELECT * FROM arrow_cache_test'
+        assert_equal(['id'],
+                     @connection.select_all(sql, arrow_cache: true).columns)
+        @connection.execute('ALTER TABLE arrow_cache_test ADD COLUMN name VARCHAR(255)')
+        assert_equal(['id', 'name'],
+                     @connection.select_all(sql, arrow_cache: true).columns)
+      ensure
+        @connection.execute('DROP TABLE arrow_cache_test')
+      end
+    end
+  end
+
+  sub_test_case('.select_arrow_sharded') do
+    def setup
+      super
+      @model = Class.new(ActiveRecord::Base) do
+        self.table_name = 'mysql2_test'
+      end
+    end
+
+    test('default') do
+      relation = @model.select(:id, :int_test).where('id <= ?', 1000)
+      table = @connection.select_arrow_sharded(relation, shard_by: :id, shards: 4)
+      assert_kind_of(Arrow::Table,
+                     table)
+      expected = relation.order(:id).pluck(:id, :int_test)
+      assert_equal(expected.transpose,
+                   [table[0].data.to_a, table[1].data.to_a])
+    end
+
+    test('with limit') do
+      assert_raise(ArgumentError) do
+        @connection.select_arrow_sharded(@model.limit(10), shard_by: :id, shards: 4)
+      end
+    end
+
+    test('with group, having or distinct') do
+      relations = [
+        @model.select(:int_test).group(:int_test),
+        @model.select(:int_test).having('COUNT(*) > 1'),
+        @model.select(:int_test).distinct,
+      ]
+      relations.each do |relation|
+        assert_raise(ArgumentError) do
+          @connection.select_arrow_sharded(relation, shard_by: :id, shards: 4)
+        end
+      end
+    end
+
+    test('nullable column in transaction') do
+      relation = @model.select(:id, :int_test).where('id <= ?', 1000)
+      @connection.transaction do
+        @model.where(id: 1).update_all(int_test: nil)
+        table = @connection.select_arrow_sharded(relation, shard_by: :int_test, shards: 4)
+        assert_equal(relation.pluck(:id).sort,
+                     table[0].data.to_a.sort)
+        raise ActiveRecord::Rollback
+      end
+    end
+  end
+
+  sub_test_case('.insert_arrow') do
+    def setup
+      super
+      @connection.execute(<<~SQL)
+        CREATE TEMPORARY TABLE insert_arrow_test (
+          id INT NOT NULL PRIMARY KEY
+          , name VARCHAR(255)
+        )
+      SQL
+    end
+
+    test('default') do
+      table = Arrow::Table.new('id' => Arrow::Int32Array.new([1, 2]),
+                               'name' => Arrow::StringArray.new(['a', nil]))
+      assert_equal(2,
+                   @connection.insert_arrow('insert_arrow_test', table, local_infile: false))
+      assert_equal([[1, 'a'], [2, nil]],
+                   @connection.select_rows('SELECT id, name FROM insert_arrow_test ORDER BY id'))
+    end
+  end
 end
@@ -0,0 +1,93 @@
+# frozen_string_literal: true
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+class ArrowResultCacheTest < Test::Unit::TestCase
+  def setup
+    @dir = Dir.mktmpdir
+    @cache = ActiveRecordArrowAdapter::ArrowResultCache.new(path: @dir)
+    @record_batch = Arrow::RecordBatch.new(id: [1, 2, 3],
+                                           name: ['a', 'b', nil])
+  end
+
+  def teardown
+    FileUtils.rm_rf(@dir)
+  end
+
+  test('#read') do
+    key = @cache.key('SELECT 1', [])
+    assert_nil(@cache.read(key))
+    @cache.write(key, @record_batch)
+    assert_equal(@record_batch, @cache.read(key))
+  end
+
+  test('#key') do
+    assert_not_equal(@cache.key('SELECT ?', [1]),
+                     @cache.key('SELECT ?', [2]))
+  end
+
+  test('#key with another secret') do
+    cache = ActiveRecordArrowAdapter::ArrowResultCache.new(path: @dir, secret: 'other')
+    assert_not_equal(@cache.key('SELECT 1', []),
+                     cache.key('SELECT 1', []))
+  end
+
+  test('secret shared by the directory') do
+    cache = ActiveRecordArrowAdapter::ArrowResultCache.new(path: @dir)
+    assert_equal(@cache.key('SELECT 1', []),
+                 cache.key('SELECT 1', []))
+  end
+
+  test('directory writable by the others') do
+    File.chmod(0o777, @dir)
+    assert_raise(SecurityError) do
+      ActiveRecordArrowAdapter::ArrowResultCache.new(path: @dir)
+    end
+  end
+
+  test('new directory') do
+    path = File.join(@dir, 'cache')
+    ActiveRecordArrowAdapter::ArrowResultCache.new(path: path)
+    assert_equal(0o700,
+                 File.stat(path).mode & 0o777)
+  end
+
+  test('ttl') do
+    cache = ActiveRecordArrowAdapter::ArrowResultCache.new(path: @dir, ttl: 10)
+    key = cache.key('SELECT 1', [])
+    cache.write(key, @record_batch)
+    expired = Time.now - 10
+    File.utime(expired, expired, File.join(@dir, "#{key}.arrow"))
+    assert_equal([nil, ['secret']],
+                 [cache.read(key), Dir.children(@dir)])
+  end
+
+  test('max_bytes') do
+    keys = 3.times.map { |i| @cache.key("SELECT #{i}", []) }
+    @cache.write(keys[0], @record_batch)
+    size = File.size(File.join(@dir, "#{keys[0]}.arrow"))
+    cache = ActiveRecordArrowAdapter::ArrowResultCache.new(path: @dir,
+                                                           max_bytes: size * 2)
+    past = Time.now - 2
+    File.utime(past, past, File.join(@dir, "#{keys[0]}.arrow"))
+    cache.write(keys[1], @record_batch)
+    cache.write(keys[2], @record_batch)
+    assert_equal([false, true, true],
+                 keys.map { |key| File.exist?(File.join(@dir, "#{key}.arrow")) })
+  end
+end
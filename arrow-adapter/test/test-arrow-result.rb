@@ -83,4 +83,46 @@ class ArrowResultTest < Test::Unit::TestCase
     assert_equal(ar_result.cast_values,
                  values)
   end
+
+  test('#[]') do
+    assert_equal([ar_result[0], ar_result[-1], ar_result[2..4]],
+                 [result[0], result[-1], result[2..4]])
+  end
+
+  test('#first') do
+    assert_equal([ar_result.first, ar_result.to_a.first(3)],
+                 [result.first, result.first(3)])
+  end
+
+  test('#last') do
+    assert_equal([ar_result.last, ar_result.to_a.last(3)],
+                 [result.last, result.last(3)])
+  end
+
+  test('#first and #last with a negative number') do
+    assert_raise(ArgumentError) { result.first(-1) }
+    assert_raise(ArgumentError) { result.last(-1) }
+  end
+
+  test('#each') do
+    assert_equal(ar_result.to_a,
+                 result.each.to_a)
+  end
+
+  test('#column') do
+    assert_equal(ar_result.rows.map(&:first),
+                 result.column('int_test').to_a)
+  end
+
+  test('#cast_values with a column') do
+    @query_columns = %i[varchar_test]
+    assert_equal(ar_result.cast_values,
+                 result.cast_values)
+  end
+
+  test('#cast_values with a DATETIME column') do
+    @query_columns = %i[date_time_test]
+    assert_equal(ar_result.cast_values,
+                 result.cast_values)
+  end
 end
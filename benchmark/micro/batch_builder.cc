@@ -0,0 +1,222 @@
+// Microbenchmark of the row conversion of mysql2-arrow without MySQL.
+//
+// It feeds canned MYSQL_ROW values of the text protocol into BatchBuilder,
+// which is what ResultWrapper does for each row fetched, so that the cost
+// of parsing and building the arrays can be measured without the network,
+// the server and Ruby.
+//
+// Build and run it by `rake benchmark:micro` in the benchmark directory.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "column_writer.hpp"
+
+namespace {
+  struct Column {
+    const char* name;
+    enum_field_types type;
+    unsigned int decimals;
+    std::shared_ptr<arrow::DataType> arrow_type;
+    // Make the i-th value in the text protocol
+    std::string (*make_value)(int64_t i);
+    // Whether the column is sparse: two thirds of the values are NULL
+    bool nullable;
+  };
+
+  std::string make_int(int64_t i) {
+    return std::to_string(i * 7919 - 1000000);
+  }
+
+  std::string make_double(int64_t i) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", i * 0.125 + 1.0 / (i + 3));
+    return buffer;
+  }
+
+  std::string make_decimal(int64_t i) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%lld.%04lld",
+                  static_cast<long long>(i * 31 - 500000),
+                  static_cast<long long>(i % 10000));
+    return buffer;
+  }
+
+  std::string make_datetime(int64_t i) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "2021-%02d-%02d %02d:%02d:%02d",
+                  static_cast<int>(i / 86400 % 12 + 1),
+                  static_cast<int>(i / 3600 % 28 + 1),
+                  static_cast<int>(i / 60 % 24),
+                  static_cast<int>(i % 60),
+                  static_cast<int>(i * 7 % 60));
+    return buffer;
+  }
+
+  std::string make_text(int64_t i) {
+    return std::string(static_cast<size_t>(64 + i % 192), static_cast<char>('a' + i % 26));
+  }
+
+  std::vector<Column> columns_of(const std::string& kind) {
+    auto timestamp = arrow::timestamp(arrow::TimeUnit::MICRO, "UTC");
+    if (kind == "int") {
+      return {{"int", MYSQL_TYPE_LONGLONG, 0, arrow::int64(), make_int}};
+    } else if (kind == "nullable") {
+      return {{"nullable", MYSQL_TYPE_LONGLONG, 0, arrow::int64(), make_int, true}};
+    } else if (kind == "double") {
+      return {{"double", MYSQL_TYPE_DOUBLE, 31, arrow::float64(), make_double}};
+    } else if (kind == "decimal") {
+      return {{"decimal", MYSQL_TYPE_NEWDECIMAL, 4, arrow::decimal128(20, 4), make_decimal}};
+    } else if (kind == "datetime") {
+      return {{"datetime", MYSQL_TYPE_DATETIME, 0, timestamp, make_datetime}};
+    } else if (kind == "text") {
+      return {{"text", MYSQL_TYPE_BLOB, 0, arrow::utf8(), make_text}};
+    } else {
+      return {
+        {"int", MYSQL_TYPE_LONGLONG, 0, arrow::int64(), make_int},
+        {"double", MYSQL_TYPE_DOUBLE, 31, arrow::float64(), make_double},
+        {"decimal", MYSQL_TYPE_NEWDECIMAL, 4, arrow::decimal128(20, 4), make_decimal},
+        {"datetime", MYSQL_TYPE_DATETIME, 0, timestamp, make_datetime},
+        {"text", MYSQL_TYPE_BLOB, 0, arrow::utf8(), make_text},
+      };
+    }
+  }
+
+  // The rows of the text protocol: the values of a row are contiguous
+  // as mysql_fetch_row returns them
+  struct CannedRows {
+    std::vector<std::string> values;
+    std::vector<bool> nulls;
+    std::vector<char*> row_values;
+    std::vector<unsigned long> lengths;
+    int64_t n_bytes = 0;
+  };
+
+  void make_rows(const std::vector<Column>& columns,
+                 int64_t n_columns,
+                 int64_t n_rows,
+                 CannedRows* rows) {
+    const size_t n_values = static_cast<size_t>(n_columns * n_rows);
+    rows->values.reserve(n_values);
+    rows->row_values.reserve(n_values);
+    rows->lengths.reserve(n_values);
+    for (int64_t i = 0; i < n_rows; ++i) {
+      for (int64_t j = 0; j < n_columns; ++j) {
+        const auto& column = columns[j % columns.size()];
+        const bool null = column.nullable && (i + j) % 3 != 0;
+        rows->values.push_back(null ? std::string() : column.make_value(i + j));
+        rows->nulls.push_back(null);
+        rows->n_bytes += rows->values.back().size();
+      }
+    }
+    for (size_t i = 0; i < rows->values.size(); ++i) {
+      auto& value = rows->values[i];
+      rows->row_values.push_back(rows->nulls[i] ? nullptr : &value[0]);
+      rows->lengths.push_back(value.size());
+    }
+  }
+
+  arrow::Status make_builder(const std::vector<Column>& columns,
+                             std::vector<MYSQL_FIELD>* fields,
+                             std::unique_ptr<mysql2_arrow::BatchBuilder>* out) {
+    const size_t n_columns = fields->size();
+    arrow::FieldVector schema_fields;
+    std::vector<std::unique_ptr<mysql2_arrow::ColumnWriter>> writers(n_columns);
+    mysql2_arrow::ColumnWriterOptions options;
+    for (size_t j = 0; j < n_columns; ++j) {
+      const auto& column = columns[j % columns.size()];
+      auto& field = (*fields)[j];
+      std::memset(&field, 0, sizeof(field));
+      field.type = column.type;
+      field.decimals = column.decimals;
+      field.charsetnr = 45; // utf8mb4_general_ci
+      if (!column.nullable) {
+        field.flags |= NOT_NULL_FLAG;
+      }
+      schema_fields.push_back(arrow::field(column.name + std::to_string(j),
+                                           column.arrow_type));
+      ARROW_RETURN_NOT_OK(mysql2_arrow::make_column_writer(field,
+                                                           column.arrow_type,
+                                                           arrow::default_memory_pool(),
+                                                           options,
+                                                           &writers[j]));
+    }
+    out->reset(new mysql2_arrow::BatchBuilder(arrow::schema(schema_fields),
+                                              std::move(writers)));
+    return arrow::Status::OK();
+  }
+
+  arrow::Status run(const std::string& kind,
+                    int64_t n_columns,
+                    int64_t n_rows,
+                    int64_t batch_rows,
+                    int n_iterations) {
+    const auto columns = columns_of(kind);
+    CannedRows rows;
+    make_rows(columns, n_columns, n_rows, &rows);
+    std::vector<MYSQL_FIELD> fields(n_columns);
+    std::unique_ptr<mysql2_arrow::BatchBuilder> builder;
+    ARROW_RETURN_NOT_OK(make_builder(columns, &fields, &builder));
+
+    double best = 0;
+    for (int iteration = 0; iteration < n_iterations; ++iteration) {
+      const auto start = std::chrono::steady_clock::now();
+      for (int64_t i = 0; i < n_rows; ++i) {
+        if (builder->num_rows() == 0) {
+          ARROW_RETURN_NOT_OK(builder->reserve(std::min(batch_rows, n_rows - i)));
+        }
+        const size_t offset = static_cast<size_t>(i * n_columns);
+        ARROW_RETURN_NOT_OK(builder->append_row(rows.row_values.data() + offset,
+                                                rows.lengths.data() + offset));
+        if (builder->num_rows() == batch_rows) {
+          std::shared_ptr<arrow::RecordBatch> batch;
+          ARROW_RETURN_NOT_OK(builder->flush(&batch));
+        }
+      }
+      if (builder->num_rows() > 0) {
+        std::shared_ptr<arrow::RecordBatch> batch;
+        ARROW_RETURN_NOT_OK(builder->flush(&batch));
+      }
+      const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+      if (iteration == 0 || elapsed.count() < best) {
+        best = elapsed.count();
+      }
+    }
+
+    std::printf("%-8s %4lld columns %9lld rows: %12.0f rows/s %8.1f MiB/s\n",
+                kind.c_str(),
+                static_cast<long long>(n_columns),
+                static_cast<long long>(n_rows),
+                n_rows / best,
+                rows.n_bytes / best / (1024 * 1024));
+    return arrow::Status::OK();
+  }
+}
+
+int main(int argc, char** argv) {
+  // batch_builder [KIND [COLUMNS [ROWS [BATCH_ROWS [ITERATIONS]]]]]
+  //
+  // KIND is int, double, decimal, datetime, text, nullable or mixed
+  const std::string kind = argc > 1 ? argv[1] : "mixed";
+  const int64_t n_columns = argc > 2 ? std::atoll(argv[2]) : 10;
+  const int64_t n_rows = argc > 3 ? std::atoll(argv[3]) : 100000;
+  const int64_t batch_rows = argc > 4 ? std::atoll(argv[4]) : 65536;
+  const int n_iterations = argc > 5 ? std::atoi(argv[5]) : 5;
+  if (n_columns <= 0 || n_rows <= 0 || batch_rows <= 0 || n_iterations <= 0) {
+    std::fprintf(stderr, "COLUMNS, ROWS, BATCH_ROWS and ITERATIONS must be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  auto status = run(kind, n_columns, n_rows, batch_rows, n_iterations);
+  if (!status.ok()) {
+    std::fprintf(stderr, "%s\n", status.ToString().c_str());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
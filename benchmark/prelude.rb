@@ -3,27 +3,38 @@ require "mysql2_arrow"
 
 $VERBOSE = nil
 
-ActiveRecord::Base.establish_connection(
+CONNECTION_CONFIG = {
   host: 'localhost',
   username: 'root',
   database: 'test',
-  adapter: 'arrow_mysql2'
+}
+
+ActiveRecord::Base.establish_connection(
+  CONNECTION_CONFIG.merge(adapter: 'arrow_mysql2')
 )
 
+# The same table through the original mysql2 adapter as the baseline
+class OriginalRecord < ActiveRecord::Base
+  self.abstract_class = true
+  establish_connection(CONNECTION_CONFIG.merge(adapter: 'mysql2'))
+end
+
+PLUCK_COLUMNS = %i[int_test double_test varchar_test text_test].freeze
+
 class Mysql2Test < ActiveRecord::Base
   self.table_name = 'mysql2_test'
 
-  def self.test_pluck(n=10_000)
-    res = limit(n).pluck_by_arrow(
-      :int_test, :double_test, :varchar_test, :text_test
-    )
+  def self.test_pluck_by_arrow(n=10_000)
+    res = limit(n).pluck(*PLUCK_COLUMNS)
     res.length == n
   end
+end
 
-  def self.test_pluck_by_arrow(n=10_000)
-    res = limit(n).pluck(
-      :int_test, :double_test, :varchar_test, :text_test
-    )
+class OriginalMysql2Test < OriginalRecord
+  self.table_name = 'mysql2_test'
+
+  def self.test_pluck(n=10_000)
+    res = limit(n).pluck(*PLUCK_COLUMNS)
     res.length == n
   end
 end
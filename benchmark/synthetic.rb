@@ -0,0 +1,321 @@
+# Benchmark of fetching synthetic tables
+#
+# It creates the tables of the given kinds and shapes in the local MySQL,
+# and measures each way of consuming the whole table in a forked process:
+#
+#   to_arrow:     Mysql2::Result#to_arrow
+#   packet_reader: Mysql2::Result#to_arrow(packet_reader: true) of
+#                 a streaming result
+#   each:         Mysql2::Result#each of plain mysql2
+#   arrow_result: ActiveRecordArrowAdapter::ArrowResult#each through the
+#                 arrow_mysql2 adapter
+#
+# and reports rows/sec, bytes/sec of the result sent by the server,
+# the peak RSS of the process and the estimated time of holding the GVL.
+#
+# The GVL-held time is estimated by a thread waking up every millisecond:
+# the time it is late for is the time when another thread held the GVL.
+#
+# Configuration by the environment variables:
+#
+#   KINDS:   int,double,decimal,datetime,text,nullable
+#   COLUMNS: 10,50,200
+#   ROWS:    1000,100000
+#   MODES:   to_arrow,packet_reader,each,arrow_result
+#   MAX_BYTES: 1073741824, the rows of a table are reduced so that its
+#            values are at most about this many bytes, or 0 not to
+#   OUTPUT:  the path of the JSON lines of the results, if given
+#
+# The tables are kept to be reused by the next run; drop them by
+# `ruby synthetic.rb drop`.
+
+require "json"
+
+require "activerecord-arrow-adapter"
+require "mysql2_arrow"
+
+$VERBOSE = nil
+
+module SyntheticBenchmark
+  CONNECTION_CONFIG = {
+    host: 'localhost',
+    username: 'root',
+    database: 'test',
+  }
+
+  TABLE_PREFIX = 'mysql2_arrow_bench'
+
+  # The column definition and the SQL expression of its value for
+  # the row of the given id expression
+  KINDS = {
+    'int' => ['BIGINT NOT NULL',
+              ->(id, i) { "#{id} * #{i + 7919} % 2147483647" }],
+    'double' => ['DOUBLE NOT NULL',
+                 ->(id, i) { "#{id} / #{i + 3}.0 + #{id} * #{i + 7919} % 1000003 / 1000003.0" }],
+    'decimal' => ['DECIMAL(20, 4) NOT NULL',
+                  ->(id, i) { "#{id} * #{i + 31} / 7.0" }],
+    'datetime' => ['DATETIME NOT NULL',
+                   ->(id, i) { "'2021-01-01' + INTERVAL #{id} * #{i + 61} SECOND" }],
+    'text' => ['TEXT NOT NULL',
+               ->(id, i) { "REPEAT(CHAR(97 + (#{id} + #{i}) % 26), 64 + (#{id} + #{i}) % 1024)" }],
+    'nullable' => ['BIGINT NULL',
+                   ->(id, i) { "IF((#{id} + #{i}) % 3 = 0, NULL, #{id} * #{i + 1})" }],
+  }
+
+  # The approximate bytes of a value of the kind in the text protocol
+  VALUE_BYTES = {
+    'int' => 10,
+    'double' => 18,
+    'decimal' => 12,
+    'datetime' => 20,
+    'text' => 580,
+    'nullable' => 8,
+  }
+
+  DEFAULT_KINDS = KINDS.keys
+  DEFAULT_COLUMNS = [10, 50, 200]
+  DEFAULT_ROWS = [1_000, 100_000]
+  # e.g. 200 TEXT columns by 100_000 rows would be about 11 GiB
+  DEFAULT_MAX_BYTES = 1024**3
+  MODES = %w[to_arrow packet_reader each arrow_result]
+
+  # The number of rows inserted by a statement when filling a table
+  FILL_ROWS = 10_000
+
+  module_function
+
+  def list(name, default)
+    value = ENV[name]
+    return default if value.nil? || value.empty?
+    items = value.split(',').map(&:strip)
+    default.first.is_a?(Integer) ? items.map { |item| Integer(item) } : items
+  end
+
+  def client
+    Mysql2::Client.new(CONNECTION_CONFIG)
+  end
+
+  # The rows of the table of the kind and the columns within max_bytes
+  def capped_rows(kind, n_columns, n_rows, max_bytes)
+    return n_rows if max_bytes <= 0
+    max_rows = max_bytes / (VALUE_BYTES.fetch(kind) * n_columns)
+    [n_rows, [max_rows, 1].max].min
+  end
+
+  def table_name(kind, n_columns, n_rows)
+    "#{TABLE_PREFIX}_#{kind}_#{n_columns}_#{n_rows}"
+  end
+
+  def prepare_table(client, kind, n_columns, n_rows)
+    name = table_name(kind, n_columns, n_rows)
+    type, value = KINDS.fetch(kind)
+    count = client.query(<<~SQL).first
+      SELECT COUNT(*) AS n FROM information_schema.tables
+      WHERE table_schema = DATABASE() AND table_name = '#{name}'
+    SQL
+    if count['n'] > 0
+      n = client.query("SELECT COUNT(*) AS n FROM #{name}").first['n']
+      return name if n == n_rows
+      client.query("DROP TABLE #{name}")
+    end
+
+    columns = n_columns.times.map { |i| "c#{i} #{type}" }
+    client.query(<<~SQL)
+      CREATE TABLE #{name} (
+        id BIGINT NOT NULL PRIMARY KEY,
+        #{columns.join(",\n  ")}
+      )
+    SQL
+
+    # Generate the ids by a cross join of digits not to depend on
+    # the recursive CTE of MySQL 8.0
+    client.query(<<~SQL)
+      CREATE TEMPORARY TABLE #{name}_digits (d INT NOT NULL PRIMARY KEY)
+    SQL
+    client.query("INSERT INTO #{name}_digits VALUES #{(0..9).map { |d| "(#{d})" }.join(',')}")
+    n_digits = Math.log10(FILL_ROWS).ceil
+    digits = n_digits.times.map { |i| "#{name}_digits AS d#{i}" }
+    offset_expr = n_digits.times.map { |i| "d#{i}.d * #{10**i}" }.join(' + ')
+    values = n_columns.times.map { |i| value.('id', i) }
+    0.step(n_rows - 1, FILL_ROWS) do |start|
+      n = [FILL_ROWS, n_rows - start].min
+      client.query(<<~SQL)
+        INSERT INTO #{name}
+        SELECT id, #{values.join(', ')}
+        FROM (SELECT #{start} + #{offset_expr} AS id
+              FROM #{digits.join(' CROSS JOIN ')}) AS ids
+        WHERE id < #{start + n}
+      SQL
+    end
+    client.query("DROP TEMPORARY TABLE #{name}_digits")
+    name
+  end
+
+  def drop_tables(client)
+    client.query(<<~SQL).each do |row|
+      SELECT table_name AS name FROM information_schema.tables
+      WHERE table_schema = DATABASE() AND table_name LIKE '#{TABLE_PREFIX}\\_%'
+    SQL
+      client.query("DROP TABLE #{row['name']}")
+    end
+  end
+
+  # The peak RSS of this process in bytes, if available
+  def peak_rss
+    status = File.read('/proc/self/status')
+    kb = status[/^VmHWM:\s*(\d+)/, 1]
+    kb && Integer(kb) * 1024
+  rescue SystemCallError
+    nil
+  end
+
+  def bytes_sent(client)
+    client.query("SHOW SESSION STATUS LIKE 'Bytes_sent'").first['Value'].to_i
+  end
+
+  # Estimate the time of holding the GVL by other threads during the block
+  def measure_gvl_held
+    interval = 0.001
+    held = 0.0
+    running = true
+    ticker = Thread.new do
+      while running
+        before = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        sleep(interval)
+        late = Process.clock_gettime(Process::CLOCK_MONOTONIC) - before - interval
+        held += late if late > interval
+      end
+    end
+    result = yield
+    running = false
+    ticker.join
+    [result, held]
+  end
+
+  def consume(mode, client, sql)
+    case mode
+    when 'to_arrow'
+      client.query(sql, as: :array).to_arrow.n_rows
+    when 'packet_reader'
+      client.query(sql, as: :array, stream: true, cache_rows: false)
+            .to_arrow(packet_reader: true).n_rows
+    when 'each'
+      n = 0
+      client.query(sql, as: :array, cache_rows: false).each { n += 1 }
+      n
+    when 'arrow_result'
+      n = 0
+      ActiveRecord::Base.connection.select_all(sql).each { n += 1 }
+      n
+    else
+      raise ArgumentError, "Unknown mode: #{mode}"
+    end
+  end
+
+  def measure(mode, kind, n_columns, n_rows)
+    ActiveRecord::Base.establish_connection(
+      CONNECTION_CONFIG.merge(adapter: 'arrow_mysql2')
+    )
+    client = self.client
+    connection = ActiveRecord::Base.connection
+    sql = "SELECT * FROM #{table_name(kind, n_columns, n_rows)}"
+    # The connection whose session status counts the bytes of the result
+    status_client =
+      mode == 'arrow_result' ? connection.raw_connection : client
+
+    GC.start
+    sent_before = bytes_sent(status_client)
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    n, gvl_held = measure_gvl_held { consume(mode, client, sql) }
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    sent = bytes_sent(status_client) - sent_before
+    raise "Fetched #{n} rows of #{n_rows} rows" unless n == n_rows
+
+    {
+      mode: mode,
+      kind: kind,
+      columns: n_columns,
+      rows: n_rows,
+      elapsed: elapsed,
+      rows_per_sec: n_rows / elapsed,
+      bytes_per_sec: sent / elapsed,
+      peak_rss: peak_rss,
+      gvl_held: gvl_held,
+    }
+  end
+
+  # Measure in a child process for the peak RSS of the case only
+  def measure_in_child(*args)
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      result =
+        begin
+          measure(*args)
+        rescue => error
+          { error: "#{error.class}: #{error.message}" }
+        end
+      writer.write(JSON.generate(result))
+      writer.close
+      exit!(0)
+    end
+    writer.close
+    output = reader.read
+    reader.close
+    Process.wait(pid)
+    JSON.parse(output, symbolize_names: true)
+  end
+
+  def format_result(mode, kind, n_columns, n_rows, result)
+    label = format('%-13s %-8s %4d columns %9d rows', mode, kind, n_columns, n_rows)
+    if result[:error]
+      return "#{label}: #{result[:error]}"
+    end
+    rss = result[:peak_rss] ? format('%8.1f MiB', result[:peak_rss] / 1024.0**2) : '       n/a'
+    format('%s: %10.0f rows/s %8.1f MiB/s peak RSS %s GVL held %7.3f s / %7.3f s',
+           label,
+           result[:rows_per_sec],
+           result[:bytes_per_sec] / 1024.0**2,
+           rss,
+           result[:gvl_held],
+           result[:elapsed])
+  end
+
+  def run
+    kinds = list('KINDS', DEFAULT_KINDS)
+    columns = list('COLUMNS', DEFAULT_COLUMNS)
+    rows = list('ROWS', DEFAULT_ROWS)
+    modes = list('MODES', MODES)
+    max_bytes = Integer(ENV['MAX_BYTES'] || DEFAULT_MAX_BYTES)
+    output = ENV['OUTPUT'] && File.open(ENV['OUTPUT'], 'a')
+
+    setup_client = client
+    cases = kinds.product(columns, rows).map do |kind, n_columns, n_rows|
+      [kind, n_columns, capped_rows(kind, n_columns, n_rows, max_bytes)]
+    end
+    cases.uniq.each do |kind, n_columns, n_rows|
+      prepare_table(setup_client, kind, n_columns, n_rows)
+      modes.each do |mode|
+        result = measure_in_child(mode, kind, n_columns, n_rows)
+        puts format_result(mode, kind, n_columns, n_rows, result)
+        if output
+          output.puts(JSON.generate(result.merge(mode: mode,
+                                                 kind: kind,
+                                                 columns: n_columns,
+                                                 rows: n_rows)))
+        end
+      end
+    end
+  ensure
+    output&.close
+  end
+end
+
+if $0 == __FILE__
+  case ARGV.first
+  when 'drop'
+    SyntheticBenchmark.drop_tables(SyntheticBenchmark.client)
+  else
+    SyntheticBenchmark.run
+  end
+end
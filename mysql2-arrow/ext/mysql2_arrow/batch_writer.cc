@@ -0,0 +1,250 @@
+#include "batch_writer.hpp"
+
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/util/compression.h>
+
+#if defined(MYSQL2_ARROW_HAVE_PARQUET) && ARROW_VERSION_MAJOR >= 10
+#define MYSQL2_ARROW_WRITE_PARQUET
+#include <parquet/arrow/writer.h>
+#endif
+
+namespace mysql2_arrow {
+#if ARROW_VERSION_MAJOR >= 4
+  namespace {
+    ID id_write;
+
+    class RubyOutputStream : public arrow::io::OutputStream {
+     public:
+      explicit RubyOutputStream(VALUE io)
+          : io_(io),
+            position_(0),
+            closed_(false) {}
+
+      // The IO is closed by the caller
+      arrow::Status Close() override {
+        closed_ = true;
+        return arrow::Status::OK();
+      }
+
+      bool closed() const override { return closed_; }
+
+      arrow::Result<int64_t> Tell() const override { return position_; }
+
+      arrow::Status Write(const void* data, int64_t nbytes) override {
+        if (error_) {
+          return arrow::Status::IOError("IO has already failed to write");
+        }
+        try {
+          rb::protect([&]{
+            VALUE chunk = rb_str_new(static_cast<const char*>(data), nbytes);
+            return rb_funcall(io_, id_write, 1, chunk);
+          });
+        } catch (rb::State& state) {
+          error_.reset(new rb::State(state));
+          return arrow::Status::IOError("Failed to write to IO");
+        }
+        position_ += nbytes;
+        return arrow::Status::OK();
+      }
+
+      void rethrow_error() {
+        if (error_) {
+          throw *error_;
+        }
+      }
+
+     private:
+      VALUE io_;
+      int64_t position_;
+      bool closed_;
+      std::unique_ptr<rb::State> error_;
+    };
+
+    class IpcBatchWriter : public BatchWriter {
+     public:
+      IpcBatchWriter(std::shared_ptr<arrow::io::OutputStream> sink,
+                     std::shared_ptr<arrow::ipc::RecordBatchWriter> writer)
+          : sink_(std::move(sink)),
+            writer_(std::move(writer)) {}
+
+      arrow::Status write(const arrow::RecordBatch& batch) override {
+        return writer_->WriteRecordBatch(batch);
+      }
+
+      arrow::Status close() override {
+        ARROW_RETURN_NOT_OK(writer_->Close());
+        return sink_->Close();
+      }
+
+     private:
+      std::shared_ptr<arrow::io::OutputStream> sink_;
+      std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+    };
+
+#ifdef MYSQL2_ARROW_WRITE_PARQUET
+    class ParquetBatchWriter : public BatchWriter {
+     public:
+      ParquetBatchWriter(std::shared_ptr<arrow::io::OutputStream> sink,
+                         std::unique_ptr<parquet::arrow::FileWriter> writer)
+          : sink_(std::move(sink)),
+            writer_(std::move(writer)) {}
+
+      arrow::Status write(const arrow::RecordBatch& batch) override {
+        return writer_->WriteRecordBatch(batch);
+      }
+
+      arrow::Status close() override {
+        ARROW_RETURN_NOT_OK(writer_->Close());
+        return sink_->Close();
+      }
+
+     private:
+      std::shared_ptr<arrow::io::OutputStream> sink_;
+      std::unique_ptr<parquet::arrow::FileWriter> writer_;
+    };
+#endif
+
+    arrow::Status compression_type(const std::string& format,
+                                   const std::string& name,
+                                   arrow::Compression::type* out) {
+      const bool ipc = format != "parquet";
+      if (name.empty()) {
+        *out = arrow::Compression::UNCOMPRESSED;
+      } else if (name == "zstd") {
+        *out = arrow::Compression::ZSTD;
+      } else if (name == "lz4") {
+        // The IPC format supports only the frame format of LZ4
+        *out = ipc ? arrow::Compression::LZ4_FRAME : arrow::Compression::LZ4;
+      } else if (!ipc && name == "snappy") {
+        *out = arrow::Compression::SNAPPY;
+      } else if (!ipc && name == "gzip") {
+        *out = arrow::Compression::GZIP;
+      } else if (!ipc && name == "brotli") {
+        *out = arrow::Compression::BROTLI;
+      } else {
+        return arrow::Status::Invalid("Unsupported compression for ", format, ": ", name);
+      }
+      return arrow::Status::OK();
+    }
+  }
+
+  arrow::Status make_batch_writer(const std::string& format,
+                                  const std::string& compression,
+                                  std::shared_ptr<arrow::io::OutputStream> sink,
+                                  const std::shared_ptr<arrow::Schema>& schema,
+                                  arrow::MemoryPool* pool,
+                                  std::unique_ptr<BatchWriter>* out) {
+    ARROW_RETURN_NOT_OK(check_batch_writer_options(format, compression));
+    arrow::Compression::type compression_type;
+    ARROW_RETURN_NOT_OK(mysql2_arrow::compression_type(format, compression,
+                                                       &compression_type));
+
+    if (format == "ipc_stream" || format == "feather") {
+      auto options = arrow::ipc::IpcWriteOptions::Defaults();
+      options.memory_pool = pool;
+      // The dictionaries only grow across the batches
+      options.emit_dictionary_deltas = true;
+      if (compression_type != arrow::Compression::UNCOMPRESSED) {
+        ARROW_ASSIGN_OR_RAISE(options.codec, arrow::util::Codec::Create(compression_type));
+      }
+      std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+      if (format == "ipc_stream") {
+        ARROW_ASSIGN_OR_RAISE(writer, arrow::ipc::MakeStreamWriter(sink, schema, options));
+      } else {
+        ARROW_ASSIGN_OR_RAISE(writer, arrow::ipc::MakeFileWriter(sink, schema, options));
+      }
+      out->reset(new IpcBatchWriter(std::move(sink), std::move(writer)));
+      return arrow::Status::OK();
+    }
+
+    if (format == "parquet") {
+#ifdef MYSQL2_ARROW_WRITE_PARQUET
+      auto properties = parquet::WriterProperties::Builder()
+        .memory_pool(pool)
+        ->compression(compression_type)
+        ->build();
+      // Keep the Arrow types such as the timezones of timestamps
+      auto arrow_properties = parquet::ArrowWriterProperties::Builder()
+        .store_schema()
+        ->build();
+      std::unique_ptr<parquet::arrow::FileWriter> writer;
+      ARROW_ASSIGN_OR_RAISE(writer,
+                            parquet::arrow::FileWriter::Open(*schema, pool, sink,
+                                                             properties, arrow_properties));
+      out->reset(new ParquetBatchWriter(std::move(sink), std::move(writer)));
+      return arrow::Status::OK();
+#else
+      return arrow::Status::NotImplemented(
+        "Parquet needs Arrow 10.0 or later with the parquet library");
+#endif
+    }
+
+    return arrow::Status::Invalid("Unknown format: ", format,
+                                  ": must be ipc_stream, feather or parquet");
+  }
+
+  arrow::Status check_batch_writer_options(const std::string& format,
+                                           const std::string& compression) {
+    if (format != "ipc_stream" && format != "feather" && format != "parquet") {
+      return arrow::Status::Invalid("Unknown format: ", format,
+                                    ": must be ipc_stream, feather or parquet");
+    }
+#ifndef MYSQL2_ARROW_WRITE_PARQUET
+    if (format == "parquet") {
+      return arrow::Status::NotImplemented(
+        "Parquet needs Arrow 10.0 or later with the parquet library");
+    }
+#endif
+    arrow::Compression::type compression_type;
+    return mysql2_arrow::compression_type(format, compression, &compression_type);
+  }
+
+  arrow::Status open_file_output_stream(const std::string& path,
+                                        std::shared_ptr<arrow::io::OutputStream>* out) {
+    ARROW_ASSIGN_OR_RAISE(*out, arrow::io::FileOutputStream::Open(path));
+    return arrow::Status::OK();
+  }
+
+  arrow::Status open_ruby_output_stream(VALUE io,
+                                        std::shared_ptr<arrow::io::OutputStream>* out) {
+    if (!id_write) {
+      id_write = rb_intern("write");
+    }
+    out->reset(new RubyOutputStream(io));
+    return arrow::Status::OK();
+  }
+
+  void rethrow_ruby_error(const std::shared_ptr<arrow::io::OutputStream>& stream) {
+    auto ruby_stream = dynamic_cast<RubyOutputStream*>(stream.get());
+    if (ruby_stream) {
+      ruby_stream->rethrow_error();
+    }
+  }
+#else
+  arrow::Status make_batch_writer(const std::string&,
+                                  const std::string&,
+                                  std::shared_ptr<arrow::io::OutputStream>,
+                                  const std::shared_ptr<arrow::Schema>&,
+                                  arrow::MemoryPool*,
+                                  std::unique_ptr<BatchWriter>*) {
+    return arrow::Status::NotImplemented("write_arrow needs Arrow 4.0 or later");
+  }
+
+  arrow::Status check_batch_writer_options(const std::string&, const std::string&) {
+    return arrow::Status::NotImplemented("write_arrow needs Arrow 4.0 or later");
+  }
+
+  arrow::Status open_file_output_stream(const std::string&,
+                                        std::shared_ptr<arrow::io::OutputStream>*) {
+    return arrow::Status::NotImplemented("write_arrow needs Arrow 4.0 or later");
+  }
+
+  arrow::Status open_ruby_output_stream(VALUE,
+                                        std::shared_ptr<arrow::io::OutputStream>*) {
+    return arrow::Status::NotImplemented("write_arrow needs Arrow 4.0 or later");
+  }
+
+  void rethrow_ruby_error(const std::shared_ptr<arrow::io::OutputStream>&) {}
+#endif
+}
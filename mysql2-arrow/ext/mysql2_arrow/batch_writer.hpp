@@ -0,0 +1,55 @@
+#pragma once
+
+#include <arrow/api.h>
+#include <arrow/io/interfaces.h>
+
+#include <memory>
+#include <string>
+
+#include <ruby.hpp>
+
+namespace mysql2_arrow {
+  // BatchWriter writes record batches of the same schema into a file of
+  // the format of write_arrow: "ipc_stream", "feather" (the IPC file
+  // format, a.k.a. Feather V2) or "parquet".
+  //
+  // The writers need Arrow 4.0 or later, and Parquet needs Arrow 10.0 or
+  // later with the parquet library found by extconf.rb.
+  class BatchWriter {
+   public:
+    virtual ~BatchWriter() = default;
+
+    virtual arrow::Status write(const arrow::RecordBatch& batch) = 0;
+
+    // Write the footer if any, and close the sink
+    virtual arrow::Status close() = 0;
+  };
+
+  // compression is "" for no compression, or the name of the codec:
+  // "zstd" and "lz4" for all the formats, and "snappy", "gzip" and
+  // "brotli" for Parquet
+  arrow::Status make_batch_writer(const std::string& format,
+                                  const std::string& compression,
+                                  std::shared_ptr<arrow::io::OutputStream> sink,
+                                  const std::shared_ptr<arrow::Schema>& schema,
+                                  arrow::MemoryPool* pool,
+                                  std::unique_ptr<BatchWriter>* out);
+
+  // Check the format and the compression of make_batch_writer, so that
+  // they can be checked before the sink is opened: Invalid for an unknown
+  // one, NotImplemented for the one not built in
+  arrow::Status check_batch_writer_options(const std::string& format,
+                                           const std::string& compression);
+
+  arrow::Status open_file_output_stream(const std::string& path,
+                                        std::shared_ptr<arrow::io::OutputStream>* out);
+
+  // Make the output stream writing into the Ruby IO by IO#write.
+  // It must be written with the GVL; an exception raised by IO#write is
+  // returned as IOError and kept to be rethrown by rethrow_ruby_error.
+  arrow::Status open_ruby_output_stream(VALUE io,
+                                        std::shared_ptr<arrow::io::OutputStream>* out);
+
+  // Rethrow the exception kept by the output stream of Ruby IO, if any
+  void rethrow_ruby_error(const std::shared_ptr<arrow::io::OutputStream>& stream);
+}
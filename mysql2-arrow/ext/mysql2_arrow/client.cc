@@ -0,0 +1,341 @@
+#include <arrow/api.h>
+
+#include <arrow-glib/record-batch.hpp>
+#include <arrow-glib/table.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mysql2_arrow.hpp"
+#include "row_serializer.hpp"
+
+#include <rbgobject.h>
+
+namespace mysql2_arrow {
+  namespace {
+    VALUE cArrowTable, cArrowRecordBatch;
+    VALUE sym_database_timezone, sym_utc, sym_max_statement_bytes;
+
+    void check_status(const arrow::Status& status) {
+      if (status.ok()) {
+        return;
+      }
+      // Invalid is used for the values which MySQL can't store,
+      // and NotImplemented for the types which can't be serialized
+      if (status.IsInvalid() || status.IsNotImplemented()) {
+        rb_raise(rb_eArgError, "%s", status.message().c_str());
+      }
+      rb_raise(rb_eRuntimeError, "%s", status.message().c_str());
+    }
+
+    void check_client_wrapper(mysql_client_wrapper* wrapper) {
+      if (!wrapper->initialized || !wrapper->client) {
+        rb_raise(eMysql2Error, "MySQL client is not initialized");
+      }
+      if (wrapper->closed) {
+        rb_raise(eMysql2Error, "MySQL client is not connected");
+      }
+    }
+
+    // The record batches of an Arrow::Table, or an Arrow::RecordBatch,
+    // which share the buffers of the data, and the schema of the data
+    // if schema is given
+    std::vector<std::shared_ptr<arrow::RecordBatch>>
+    data_to_batches(VALUE rb_data, std::shared_ptr<arrow::Schema>* schema = nullptr) {
+      std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+      if (RTEST(rb_obj_is_kind_of(rb_data, cArrowTable))) {
+        auto table = garrow_table_get_raw(reinterpret_cast<GArrowTable*>(RVAL2GOBJ(rb_data)));
+        if (schema) {
+          *schema = table->schema();
+        }
+        arrow::TableBatchReader reader(*table);
+        while (true) {
+          std::shared_ptr<arrow::RecordBatch> batch;
+          check_status(reader.ReadNext(&batch));
+          if (!batch) {
+            break;
+          }
+          batches.push_back(std::move(batch));
+        }
+      } else if (RTEST(rb_obj_is_kind_of(rb_data, cArrowRecordBatch))) {
+        batches.push_back(garrow_record_batch_get_raw(
+            reinterpret_cast<GArrowRecordBatch*>(RVAL2GOBJ(rb_data))));
+        if (schema) {
+          *schema = batches.back()->schema();
+        }
+      } else {
+        rb_raise(rb_eTypeError,
+                 "Arrow::Table or Arrow::RecordBatch is expected: %" PRIsVALUE,
+                 rb_inspect(rb_data));
+      }
+      return batches;
+    }
+
+    void append_quoted_identifier(std::string* out, const std::string& name) {
+      out->push_back('`');
+      for (const char c : name) {
+        if (c == '`') {
+          out->push_back('`');
+        }
+        out->push_back(c);
+      }
+      out->push_back('`');
+    }
+
+    ValueFormatterOptions make_formatter_options(mysql_client_wrapper* wrapper, VALUE opts) {
+      ValueFormatterOptions options;
+      options.local_time = rb_hash_aref(opts, sym_database_timezone) != sym_utc;
+      options.no_backslash_escapes =
+        (wrapper->client->server_status & SERVER_STATUS_NO_BACKSLASH_ESCAPES) != 0;
+      return options;
+    }
+
+    // LocalInfile streams the rows as the file of LOAD DATA LOCAL INFILE.
+    //
+    // The callbacks are called by libmysqlclient in mysql_read_query_result,
+    // which mysql2 calls without the GVL, so they must not touch Ruby.
+    class LocalInfile {
+     public:
+      LocalInfile(std::vector<std::shared_ptr<arrow::RecordBatch>> batches,
+                  const ValueFormatterOptions& options)
+          : serializer_(std::move(batches), ValueSyntax::tsv, options),
+            position_(0),
+            eof_(false) {}
+
+      arrow::Status open() { return serializer_.open(); }
+
+      static void install(MYSQL* client, LocalInfile* infile) {
+        mysql_set_local_infile_handler(client,
+                                       LocalInfile::init,
+                                       LocalInfile::read,
+                                       LocalInfile::end,
+                                       LocalInfile::error,
+                                       infile);
+      }
+
+     private:
+      static int init(void** ptr, const char*, void* userdata) {
+        *ptr = userdata;
+        return 0;
+      }
+
+      // Fill buf with the serialized rows; a row longer than buf is sent
+      // across calls. 0 is the end of the file and -1 is an error.
+      static int read(void* ptr, char* buf, unsigned int buf_len) {
+        auto infile = static_cast<LocalInfile*>(ptr);
+        try {
+          return infile->fill(buf, buf_len);
+        } catch (std::exception& exception) {
+          infile->status_ = arrow::Status::UnknownError(exception.what());
+          return -1;
+        }
+      }
+
+      // The LocalInfile is owned by arrow_local_infile
+      static void end(void*) {}
+
+      static int error(void* ptr, char* error_msg, unsigned int error_msg_len) {
+        auto infile = static_cast<LocalInfile*>(ptr);
+        const auto& message = infile->status_.message();
+        const size_t length = std::min<size_t>(message.size(), error_msg_len - 1);
+        std::memcpy(error_msg, message.data(), length);
+        error_msg[length] = '\0';
+        return CR_UNKNOWN_ERROR;
+      }
+
+      int fill(char* buf, unsigned int buf_len) {
+        if (buffer_.size() - position_ < buf_len && !eof_) {
+          buffer_.erase(0, position_);
+          position_ = 0;
+          while (buffer_.size() < buf_len && !eof_) {
+            status_ = serializer_.append_row(&buffer_, &eof_);
+            if (!status_.ok()) {
+              return -1;
+            }
+          }
+        }
+        const size_t length = std::min<size_t>(buffer_.size() - position_, buf_len);
+        std::memcpy(buf, buffer_.data() + position_, length);
+        position_ += length;
+        return static_cast<int>(length);
+      }
+
+      RowSerializer serializer_;
+      std::string buffer_;
+      size_t position_;
+      bool eof_;
+      arrow::Status status_;
+    };
+
+    struct LocalInfileArgs {
+      mysql_client_wrapper* wrapper;
+      LocalInfile* infile;
+      VALUE clause;
+    };
+
+    VALUE yield_local_infile(VALUE arg) {
+      auto args = reinterpret_cast<LocalInfileArgs*>(arg);
+      LocalInfile::install(args->wrapper->client, args->infile);
+      return rb_yield(args->clause);
+    }
+
+    VALUE restore_local_infile(VALUE arg) {
+      auto args = reinterpret_cast<LocalInfileArgs*>(arg);
+      if (args->wrapper->client) {
+        mysql_set_local_infile_default(args->wrapper->client);
+      }
+      delete args->infile;
+      return Qnil;
+    }
+
+    VALUE mysql2_client_arrow_local_infile_impl(int argc, VALUE* argv, VALUE self) {
+      VALUE rb_data;
+      VALUE opts;
+      rb_scan_args(argc, argv, "1:", &rb_data, &opts);
+      if (NIL_P(opts)) {
+        opts = rb_hash_new();
+      }
+      rb_need_block();
+
+      GET_CLIENT_WRAPPER(self);
+      check_client_wrapper(wrapper);
+
+      auto options = make_formatter_options(wrapper, opts);
+      std::shared_ptr<arrow::Schema> schema;
+      std::unique_ptr<LocalInfile> infile(new LocalInfile(data_to_batches(rb_data, &schema),
+                                                          options));
+      check_status(infile->open());
+
+      // The fields and the lines of ValueSyntax::tsv. The tab and the line
+      // feed are literal so that the clause doesn't depend on
+      // NO_BACKSLASH_ESCAPES, which changes how the escape character is
+      // written.
+      std::string clause("CHARACTER SET utf8mb4 FIELDS TERMINATED BY '\t' ESCAPED BY ");
+      clause += options.no_backslash_escapes ? "'\\'" : "'\\\\'";
+      clause += " LINES TERMINATED BY '\n'";
+      // The columns by the names of the fields; the hex digits of
+      // the binary values are read into the variables for UNHEX()
+      std::string assignments;
+      clause += " (";
+      for (int i = 0; i < schema->num_fields(); ++i) {
+        const auto& field = schema->field(i);
+        if (i > 0) {
+          clause += ", ";
+        }
+        if (!is_hex_type(*field->type())) {
+          append_quoted_identifier(&clause, field->name());
+          continue;
+        }
+        const std::string variable = "@arrow_hex_" + std::to_string(i);
+        clause += variable;
+        assignments += assignments.empty() ? " SET " : ", ";
+        append_quoted_identifier(&assignments, field->name());
+        assignments += " = UNHEX(" + variable + ")";
+      }
+      clause += ")";
+      clause += assignments;
+
+      LocalInfileArgs args;
+      args.wrapper = wrapper;
+      args.infile = infile.release();
+      args.clause = rb_utf8_str_new(clause.data(), clause.size());
+      // Protected to destroy the locals when the block raises
+      return rb::protect([&]{
+        return rb_ensure(yield_local_infile, reinterpret_cast<VALUE>(&args),
+                         restore_local_infile, reinterpret_cast<VALUE>(&args));
+      });
+    }
+
+    VALUE mysql2_client_arrow_local_infile(int argc, VALUE* argv, VALUE self) {
+      try {
+        return mysql2_client_arrow_local_infile_impl(argc, argv, self);
+      } catch (rb::State& state) {
+        state.jump();
+      }
+    }
+
+    VALUE mysql2_client_each_arrow_insert_statement_impl(int argc, VALUE* argv, VALUE self) {
+      VALUE prefix;
+      VALUE rb_data;
+      VALUE opts;
+      rb_scan_args(argc, argv, "2:", &prefix, &rb_data, &opts);
+      if (NIL_P(opts)) {
+        opts = rb_hash_new();
+      }
+      StringValue(prefix);
+      rb_need_block();
+
+      GET_CLIENT_WRAPPER(self);
+      check_client_wrapper(wrapper);
+
+      size_t max_statement_bytes = 1024 * 1024;
+      VALUE rb_max_statement_bytes = rb_hash_aref(opts, sym_max_statement_bytes);
+      if (!NIL_P(rb_max_statement_bytes)) {
+        const int64_t value = NUM2LL(rb_max_statement_bytes);
+        if (value <= 0) {
+          rb_raise(rb_eArgError, ":max_statement_bytes must be positive");
+        }
+        max_statement_bytes = static_cast<size_t>(value);
+      }
+
+      RowSerializer serializer(data_to_batches(rb_data),
+                               ValueSyntax::sql,
+                               make_formatter_options(wrapper, opts));
+      check_status(serializer.open());
+
+      rb_encoding* conn_enc = rb_to_encoding(wrapper->encoding);
+      std::string statement(RSTRING_PTR(prefix), RSTRING_LEN(prefix));
+      const size_t prefix_length = statement.size();
+      std::string row;
+      while (true) {
+        bool eof = false;
+        row.clear();
+        check_status(serializer.append_row(&row, &eof));
+        // A row is sent alone even if it is longer than max_statement_bytes
+        // and is left to the server to reject
+        const bool full = statement.size() > prefix_length &&
+          statement.size() + 1 + row.size() > max_statement_bytes;
+        if ((eof || full) && statement.size() > prefix_length) {
+          VALUE sql = rb_enc_str_new(statement.data(), statement.size(), conn_enc);
+          rb::protect([&]{ return rb_yield(sql); });
+          statement.resize(prefix_length);
+        }
+        if (eof) {
+          break;
+        }
+        if (statement.size() > prefix_length) {
+          statement.push_back(',');
+        }
+        statement += row;
+      }
+      return LL2NUM(serializer.num_rows());
+    }
+
+    VALUE mysql2_client_each_arrow_insert_statement(int argc, VALUE* argv, VALUE self) {
+      try {
+        return mysql2_client_each_arrow_insert_statement_impl(argc, argv, self);
+      } catch (rb::State& state) {
+        state.jump();
+      }
+    }
+  }
+
+  void init_mysql2_client_extension() {
+    VALUE mClientExtension = rb_define_module_under(mMysql2Arrow, "ClientExtension");
+
+    rb_define_method(mClientExtension, "arrow_local_infile",
+                     reinterpret_cast<rb::RawMethod>(mysql2_client_arrow_local_infile), -1);
+    rb_define_method(mClientExtension, "each_arrow_insert_statement",
+                     reinterpret_cast<rb::RawMethod>(mysql2_client_each_arrow_insert_statement), -1);
+
+    cArrowTable       = rb_path2class("Arrow::Table");
+    cArrowRecordBatch = rb_path2class("Arrow::RecordBatch");
+
+    sym_database_timezone   = ID2SYM(rb_intern("database_timezone"));
+    sym_utc                 = ID2SYM(rb_intern("utc"));
+    sym_max_statement_bytes = ID2SYM(rb_intern("max_statement_bytes"));
+  }
+}
@@ -0,0 +1,287 @@
+#include "column_writer.hpp"
+
+namespace mysql2_arrow {
+  namespace {
+    template <typename Writer>
+    arrow::Status make_writer(const MYSQL_FIELD& field,
+                              std::unique_ptr<arrow::ArrayBuilder> builder,
+                              std::unique_ptr<ColumnWriter>* out) {
+      out->reset(new Writer(field, std::move(builder)));
+      return arrow::Status::OK();
+    }
+
+    // Make the writer of a fixed-width type with NonNullableBuilder for
+    // a NOT NULL column, which doesn't maintain the validity bitmap,
+    // or with the Arrow builder otherwise
+    template <template <typename> class Writer, typename ArrowType, typename... Args>
+    arrow::Status make_fixed_width_writer(const MYSQL_FIELD& field,
+                                          const std::shared_ptr<arrow::DataType>& type,
+                                          arrow::MemoryPool* pool,
+                                          std::unique_ptr<ColumnWriter>* out,
+                                          const Args&... args) {
+      if (field.flags & NOT_NULL_FLAG) {
+        using BuilderType = NonNullableBuilder<ArrowType>;
+        std::unique_ptr<BuilderType> builder(new BuilderType(type, pool));
+        out->reset(new Writer<BuilderType>(field, std::move(builder), args...));
+      } else {
+        using BuilderType = typename arrow::TypeTraits<ArrowType>::BuilderType;
+        std::unique_ptr<arrow::ArrayBuilder> builder;
+        ARROW_RETURN_NOT_OK(arrow::MakeBuilder(pool, type, &builder));
+        out->reset(new Writer<BuilderType>(field, std::move(builder), args...));
+      }
+      return arrow::Status::OK();
+    }
+
+    // DECIMAL values can be narrowed into int64 or float64 by decimal_as
+    bool is_decimal_field(const MYSQL_FIELD& field) {
+      return field.type == MYSQL_TYPE_DECIMAL || field.type == MYSQL_TYPE_NEWDECIMAL;
+    }
+  }
+
+  arrow::Status make_column_writer(const MYSQL_FIELD& field,
+                                   const std::shared_ptr<arrow::DataType>& type,
+                                   arrow::MemoryPool* pool,
+                                   const ColumnWriterOptions& options,
+                                   std::unique_ptr<ColumnWriter>* out) {
+    // Dictionary-encoded columns hold their own builders
+    switch (type->id()) {
+      case arrow::Type::DICTIONARY:
+        switch (static_cast<const arrow::DictionaryType&>(*type).index_type()->id()) {
+          case arrow::Type::INT16:
+            out->reset(new DictionaryColumnWriter<arrow::Int16Type>(field, type, pool));
+            return arrow::Status::OK();
+          case arrow::Type::INT32:
+            out->reset(new DictionaryColumnWriter<arrow::Int32Type>(field, type, pool));
+            return arrow::Status::OK();
+          default:
+            break;
+        }
+        break;
+
+      case arrow::Type::LIST:
+        out->reset(new SetColumnWriter(field, type, pool));
+        return arrow::Status::OK();
+
+      default:
+        break;
+    }
+
+    // Fixed-width columns choose their builders by the NOT NULL flag
+    switch (type->id()) {
+      case arrow::Type::INT8:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::Int8Type>(
+          field, type, pool, out);
+
+      case arrow::Type::INT16:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::Int16Type>(
+          field, type, pool, out);
+
+      case arrow::Type::INT32:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::Int32Type>(
+          field, type, pool, out);
+
+      case arrow::Type::INT64:
+        if (is_decimal_field(field)) {
+          return make_fixed_width_writer<ScaledDecimalColumnWriter, arrow::Int64Type>(
+            field, type, pool, out);
+        }
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::Int64Type>(
+          field, type, pool, out);
+
+      case arrow::Type::UINT8:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::UInt8Type>(
+          field, type, pool, out);
+
+      case arrow::Type::UINT16:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::UInt16Type>(
+          field, type, pool, out);
+
+      case arrow::Type::UINT32:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::UInt32Type>(
+          field, type, pool, out);
+
+      case arrow::Type::UINT64:
+        return make_fixed_width_writer<IntegerColumnWriter, arrow::UInt64Type>(
+          field, type, pool, out);
+
+      case arrow::Type::FLOAT:
+        return make_fixed_width_writer<FloatingColumnWriter, arrow::FloatType>(
+          field, type, pool, out);
+
+      case arrow::Type::DOUBLE:
+        if (is_decimal_field(field)) {
+          return make_fixed_width_writer<FloatDecimalColumnWriter, arrow::DoubleType>(
+            field, type, pool, out);
+        }
+        return make_fixed_width_writer<FloatingColumnWriter, arrow::DoubleType>(
+          field, type, pool, out);
+
+      case arrow::Type::TIMESTAMP:
+        if (field.type == MYSQL_TYPE_TIME) {
+          return make_fixed_width_writer<TimeColumnWriter, arrow::TimestampType>(
+            field, type, pool, out, options);
+        }
+        return make_fixed_width_writer<DateTimeColumnWriter, arrow::TimestampType>(
+          field, type, pool, out, options);
+
+      case arrow::Type::DATE32:
+        return make_fixed_width_writer<DateColumnWriter, arrow::Date32Type>(
+          field, type, pool, out);
+
+      default:
+        break;
+    }
+
+    std::unique_ptr<arrow::ArrayBuilder> builder;
+    ARROW_RETURN_NOT_OK(arrow::MakeBuilder(pool, type, &builder));
+
+    switch (type->id()) {
+      case arrow::Type::NA:
+        return make_writer<NullColumnWriter>(field, std::move(builder), out);
+
+      case arrow::Type::BOOL:
+        return make_writer<BooleanColumnWriter>(field, std::move(builder), out);
+
+      case arrow::Type::DECIMAL:
+        return make_writer<DecimalColumnWriter<arrow::Decimal128Builder, 2>>(
+          field, std::move(builder), out);
+
+#if ARROW_VERSION_MAJOR >= 3
+      case arrow::Type::DECIMAL256:
+        return make_writer<DecimalColumnWriter<arrow::Decimal256Builder, 4>>(
+          field, std::move(builder), out);
+#endif
+
+      case arrow::Type::STRING:
+        return make_writer<BinaryColumnWriter<arrow::StringBuilder>>(field, std::move(builder), out);
+
+      case arrow::Type::BINARY:
+        return make_writer<BinaryColumnWriter<arrow::BinaryBuilder>>(field, std::move(builder), out);
+
+      case arrow::Type::LARGE_STRING:
+        return make_writer<BinaryColumnWriter<arrow::LargeStringBuilder>>(
+          field, std::move(builder), out);
+
+      case arrow::Type::LARGE_BINARY:
+        return make_writer<BinaryColumnWriter<arrow::LargeBinaryBuilder>>(
+          field, std::move(builder), out);
+
+      default:
+        return arrow::Status::NotImplemented("Unsupported Arrow type ", type->ToString(),
+                                             " for field '",
+                                             std::string(field.name, field.name_length), "'");
+    }
+  }
+
+  arrow::Status BatchBuilder::flush(std::shared_ptr<arrow::RecordBatch>* out) {
+    const int64_t start = stats_ ? monotonic_ns() : 0;
+    std::vector<std::shared_ptr<arrow::Array>> columns(writers_.size());
+    for (size_t i = 0; i < writers_.size(); ++i) {
+      if (null_runs_[i] > 0) {
+        ARROW_RETURN_NOT_OK(append_null_run(i));
+      }
+      ARROW_RETURN_NOT_OK(writers_[i]->finish(&columns[i]));
+    }
+    if (stats_) {
+      stats_->flush_ns += monotonic_ns() - start;
+      ++stats_->n_batches;
+      for (size_t i = 0; i < columns.size(); ++i) {
+        stats_->null_counts[i] += columns[i]->null_count();
+      }
+    }
+    *out = arrow::RecordBatch::Make(schema_, num_rows_, std::move(columns));
+    num_rows_ = 0;
+    data_length_ = 0;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status BatchBuilder::append_row_with_stats(const MYSQL_ROW row,
+                                                    const unsigned long* lengths) {
+    const size_t n = writers_.size();
+    int64_t n_bytes = 0;
+    if (!stats_->sample_row()) {
+      for (size_t i = 0; i < n; ++i) {
+        n_bytes += lengths[i];
+        ARROW_RETURN_NOT_OK(append_value(i, row[i], lengths[i]));
+      }
+    } else {
+      const int64_t row_start = monotonic_ns();
+      int64_t start = row_start;
+      for (size_t i = 0; i < n; ++i) {
+        n_bytes += lengths[i];
+        ARROW_RETURN_NOT_OK(append_value(i, row[i], lengths[i]));
+        const int64_t end = monotonic_ns();
+        stats_->sampled_column_parse_ns[i] += end - start;
+        start = end;
+      }
+      stats_->sampled_parse_ns += start - row_start;
+      ++stats_->n_sampled_rows;
+    }
+    stats_->n_bytes += n_bytes;
+    ++stats_->n_rows;
+    ++num_rows_;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status BatchBuilder::append_columns(const char* const* values,
+                                             const unsigned long* lengths,
+                                             int64_t n_rows) {
+    const size_t n = writers_.size();
+    // A column of a chunk takes long enough to be timed exactly
+    const int64_t chunk_start = stats_ ? monotonic_ns() : 0;
+    int64_t start = chunk_start;
+    int64_t n_bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+      const size_t offset = i * static_cast<size_t>(n_rows);
+      // The data of the column of the chunk is reserved at once,
+      // so that the builder doesn't grow value by value
+      int64_t column_bytes = 0;
+      for (int64_t j = 0; j < n_rows; ++j) {
+        column_bytes += lengths[offset + j];
+      }
+      ARROW_RETURN_NOT_OK(writers_[i]->reserve_data(column_bytes));
+      n_bytes += column_bytes;
+      for (int64_t j = 0; j < n_rows; ++j) {
+        ARROW_RETURN_NOT_OK(append_value(i, values[offset + j], lengths[offset + j]));
+      }
+      if (stats_) {
+        const int64_t end = monotonic_ns();
+        stats_->sampled_column_parse_ns[i] += end - start;
+        start = end;
+      }
+    }
+    if (stats_) {
+      stats_->sampled_parse_ns += start - chunk_start;
+      stats_->n_sampled_rows += n_rows;
+      stats_->n_rows += n_rows;
+      stats_->n_bytes += n_bytes;
+    }
+    num_rows_ += n_rows;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status BatchBuilder::append_row_with_stats(const MYSQL_BIND* binds) {
+    const size_t n = writers_.size();
+    const bool sampling = stats_->sample_row();
+    const int64_t row_start = sampling ? monotonic_ns() : 0;
+    int64_t start = row_start;
+    for (size_t i = 0; i < n; ++i) {
+      if (!*binds[i].is_null) {
+        stats_->n_bytes += *binds[i].length;
+      }
+      ARROW_RETURN_NOT_OK(append_value(i, binds[i]));
+      if (sampling) {
+        const int64_t end = monotonic_ns();
+        stats_->sampled_column_parse_ns[i] += end - start;
+        start = end;
+      }
+    }
+    if (sampling) {
+      stats_->sampled_parse_ns += start - row_start;
+      ++stats_->n_sampled_rows;
+    }
+    ++stats_->n_rows;
+    ++num_rows_;
+    return arrow::Status::OK();
+  }
+}
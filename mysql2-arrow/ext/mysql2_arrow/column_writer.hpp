@@ -0,0 +1,944 @@
+#pragma once
+
+#include <arrow/api.h>
+#include <arrow/buffer_builder.h>
+#include <arrow/util/decimal.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fetch_stats.hpp"
+#include "mysql.hpp"
+#include "parser.hpp"
+#include "timezone.hpp"
+
+namespace mysql2_arrow {
+  // Microseconds since the UNIX epoch of the given date time
+  inline int64_t civil_to_timestamp(unsigned int year, unsigned int month, unsigned int day,
+                                    unsigned int hour, unsigned int min, unsigned int sec) {
+    const int64_t days = parser::days_from_civil(static_cast<int>(year), month, day);
+    return 1000000LL * (86400LL * days + 3600LL * hour + 60LL * min + sec);
+  }
+
+  // Days since the UNIX epoch of the given date
+  inline int32_t civil_to_days(unsigned int year, unsigned int month, unsigned int day) {
+    return parser::days_from_civil(static_cast<int>(year), month, day);
+  }
+
+  // The last "YYYY-MM-DD" prefix seen in a column and its days since the
+  // UNIX epoch. Rows of a result are often ordered or clustered by date, so
+  // most of the values can skip parsing and converting the date part.
+  class DatePrefixCache {
+   public:
+    DatePrefixCache() : valid_(false), days_(0) {}
+
+    bool lookup(const char* value, int32_t* days) const {
+      if (!valid_ || std::memcmp(prefix_, value, parser::kDateLength) != 0) {
+        return false;
+      }
+      *days = days_;
+      return true;
+    }
+
+    void store(const char* value, int32_t days) {
+      std::memcpy(prefix_, value, parser::kDateLength);
+      days_ = days;
+      valid_ = true;
+    }
+
+   private:
+    bool valid_;
+    char prefix_[parser::kDateLength];
+    int32_t days_;
+  };
+
+  // Options of the column writers resolved from the query options
+  struct ColumnWriterOptions {
+    ColumnWriterOptions() : local_time(false) {}
+
+    // Whether DATETIME, TIMESTAMP and TIME values are in the local time
+    // zone, i.e. database_timezone: :local, and need to be converted into UTC
+    bool local_time;
+  };
+
+  // ColumnWriter appends the values of a MySQL field into an Arrow array builder.
+  //
+  // A writer is chosen once for each field from the Arrow schema, and it holds
+  // the builder of the concrete type, so that the row loop does not need to
+  // dispatch on the field type for each value.
+  class ColumnWriter {
+   public:
+    explicit ColumnWriter(const MYSQL_FIELD& field) : field_(field) {}
+    virtual ~ColumnWriter() = default;
+
+    // Append a value of the text protocol
+    virtual arrow::Status append(const char* value, unsigned long length) = 0;
+
+    // Append a value in the result buffer bound by the binary protocol
+    virtual arrow::Status append(const MYSQL_BIND& bind, unsigned long length) = 0;
+
+    virtual arrow::Status append_null() = 0;
+
+    // Append a run of nulls
+    virtual arrow::Status append_nulls(int64_t n) {
+      for (int64_t i = 0; i < n; ++i) {
+        ARROW_RETURN_NOT_OK(append_null());
+      }
+      return arrow::Status::OK();
+    }
+
+    // Reserve the capacity for the next n_rows values
+    virtual arrow::Status reserve(int64_t n_rows) = 0;
+
+    // Reserve the capacity for the next n_bytes bytes of the values,
+    // which only the variable-width columns have
+    virtual arrow::Status reserve_data(int64_t) { return arrow::Status::OK(); }
+
+    // Finish the array and reset the builder for the next batch
+    virtual arrow::Status finish(std::shared_ptr<arrow::Array>* out) = 0;
+
+    const MYSQL_FIELD& field() const { return field_; }
+
+   protected:
+    arrow::Status invalid_value(const char* kind, const char* value, unsigned long length) const {
+      return arrow::Status::Invalid("Invalid ", kind, " value in field '",
+                                    std::string(field_.name, field_.name_length),
+                                    "': ", std::string(value, length));
+    }
+
+    arrow::Status invalid_date(const char* value) const {
+      return arrow::Status::Invalid("Invalid date in field '",
+                                    std::string(field_.name, field_.name_length),
+                                    "': ", value);
+    }
+
+    arrow::Status invalid_date(const MYSQL_TIME& t) const {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%04u-%02u-%02u", t.year, t.month, t.day);
+      return invalid_date(buf);
+    }
+
+    const MYSQL_FIELD& field_;
+  };
+
+  // NonNullableBuilder builds the fixed-width array of a NOT NULL column
+  // without the validity bitmap, which the Arrow builders always maintain.
+  //
+  // It has the same interface as the Arrow builder used by the writers.
+  // MySQL can still return NULL for a NOT NULL column, e.g. for a zero
+  // date, so the bitmap is made on the first null of a batch.
+  template <typename ArrowType>
+  class NonNullableBuilder {
+   public:
+    using value_type = typename ArrowType::c_type;
+
+    NonNullableBuilder(std::shared_ptr<arrow::DataType> type, arrow::MemoryPool* pool)
+        : type_(std::move(type)),
+          values_(pool),
+          validity_(pool),
+          length_(0),
+          has_validity_(false) {}
+
+    arrow::Status Append(value_type value) {
+      if (has_validity_) {
+        ARROW_RETURN_NOT_OK(validity_.Append(true));
+      }
+      ++length_;
+      return values_.Append(value);
+    }
+
+    arrow::Status AppendNull() { return AppendNulls(1); }
+
+    arrow::Status AppendNulls(int64_t length) {
+      if (!has_validity_) {
+        ARROW_RETURN_NOT_OK(validity_.Append(length_, true));
+        has_validity_ = true;
+      }
+      ARROW_RETURN_NOT_OK(validity_.Append(length, false));
+      length_ += length;
+      return values_.Append(length, value_type{});
+    }
+
+    arrow::Status Reserve(int64_t n_rows) {
+      if (has_validity_) {
+        ARROW_RETURN_NOT_OK(validity_.Reserve(n_rows));
+      }
+      return values_.Reserve(n_rows);
+    }
+
+    arrow::Status Finish(std::shared_ptr<arrow::Array>* out) {
+      std::shared_ptr<arrow::Buffer> values;
+      std::shared_ptr<arrow::Buffer> validity;
+      int64_t null_count = 0;
+      ARROW_RETURN_NOT_OK(values_.Finish(&values));
+      if (has_validity_) {
+        null_count = validity_.false_count();
+        ARROW_RETURN_NOT_OK(validity_.Finish(&validity));
+      }
+      *out = arrow::MakeArray(arrow::ArrayData::Make(type_, length_,
+                                                     {validity, values}, null_count));
+      length_ = 0;
+      has_validity_ = false;
+      return arrow::Status::OK();
+    }
+
+   private:
+    std::shared_ptr<arrow::DataType> type_;
+    arrow::TypedBufferBuilder<value_type> values_;
+    arrow::TypedBufferBuilder<bool> validity_;
+    int64_t length_;
+    bool has_validity_;
+  };
+
+  template <typename BuilderType>
+  class TypedColumnWriter : public ColumnWriter {
+   public:
+    TypedColumnWriter(const MYSQL_FIELD& field, std::unique_ptr<arrow::ArrayBuilder> builder)
+        : ColumnWriter(field),
+          builder_(static_cast<BuilderType*>(builder.release())) {}
+
+    TypedColumnWriter(const MYSQL_FIELD& field, std::unique_ptr<BuilderType> builder)
+        : ColumnWriter(field),
+          builder_(std::move(builder)) {}
+
+    arrow::Status append_null() override { return builder_->AppendNull(); }
+
+    arrow::Status append_nulls(int64_t n) override { return builder_->AppendNulls(n); }
+
+    arrow::Status reserve(int64_t n_rows) override { return builder_->Reserve(n_rows); }
+
+    arrow::Status finish(std::shared_ptr<arrow::Array>* out) override {
+      return builder_->Finish(out);
+    }
+
+   protected:
+    std::unique_ptr<BuilderType> builder_;
+  };
+
+  class NullColumnWriter : public TypedColumnWriter<arrow::NullBuilder> {
+   public:
+    using TypedColumnWriter::TypedColumnWriter;
+
+    arrow::Status append(const char*, unsigned long) override {
+      return builder_->AppendNull();
+    }
+
+    arrow::Status append(const MYSQL_BIND&, unsigned long) override {
+      return builder_->AppendNull();
+    }
+  };
+
+  // TINYINT(1) and BIT(1) with cast_booleans
+  class BooleanColumnWriter : public TypedColumnWriter<arrow::BooleanBuilder> {
+   public:
+    BooleanColumnWriter(const MYSQL_FIELD& field, std::unique_ptr<arrow::ArrayBuilder> builder)
+        : TypedColumnWriter(field, std::move(builder)),
+          bit_(field.type == MYSQL_TYPE_BIT) {}
+
+    arrow::Status append(const char* value, unsigned long) override {
+      // BIT values are sent as raw bytes even in the text protocol
+      return builder_->Append(bit_ ? *value == 1 : *value != '0');
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long) override {
+      if (bit_) {
+        return builder_->Append(*static_cast<const unsigned char*>(bind.buffer) == 1);
+      }
+      return builder_->Append(*static_cast<const signed char*>(bind.buffer) != 0);
+    }
+
+   private:
+    bool bit_;
+  };
+
+  // TINYINT, SMALLINT, MEDIUMINT, INTEGER, BIGINT and YEAR
+  //
+  // The result buffer of the binary protocol has the C type of the same
+  // width as the Arrow type, e.g. int for MEDIUMINT and short for YEAR.
+  //
+  // The fixed-width writers take the builder type, which is the Arrow
+  // builder or NonNullableBuilder for NOT NULL columns.
+  template <typename BuilderType>
+  class IntegerColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using CType = typename BuilderType::value_type;
+    using TypedColumnWriter<BuilderType>::TypedColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      CType val;
+      if (!parser::parse_integer(value, length, &val)) {
+        return this->invalid_value("integer", value, length);
+      }
+      return this->builder_->Append(val);
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long) override {
+      return this->builder_->Append(*static_cast<const CType*>(bind.buffer));
+    }
+  };
+
+  // FLOAT and DOUBLE
+  template <typename BuilderType>
+  class FloatingColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using CType = typename BuilderType::value_type;
+    using TypedColumnWriter<BuilderType>::TypedColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      CType val;
+      if (!parser::parse_floating(value, length, &val)) {
+        return this->invalid_value("floating point", value, length);
+      }
+      return this->builder_->Append(val);
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long) override {
+      return this->builder_->Append(*static_cast<const CType*>(bind.buffer));
+    }
+  };
+
+  // DECIMAL and NUMERIC in Decimal128 or Decimal256 of the precision
+  //
+  // The values have the scale of the field, so that they are parsed digit
+  // by digit into the unscaled integer of N 64-bit words, and appended as
+  // the bytes of the value without arrow::Decimal128::FromString.
+  template <typename BuilderType, size_t N>
+  class DecimalColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using TypedColumnWriter<BuilderType>::TypedColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      uint64_t words[N];
+      if (!parser::parse_decimal(value, length, this->field_.decimals, words)) {
+        return this->invalid_value("decimal", value, length);
+      }
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+      std::reverse(words, words + N);
+#endif
+      return this->builder_->Append(reinterpret_cast<const uint8_t*>(words));
+    }
+
+    // The binary protocol sends decimals as strings too
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+  };
+
+  // DECIMAL with decimal_as: :int64_scaled, i.e. the unscaled integer
+  template <typename BuilderType>
+  class ScaledDecimalColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using TypedColumnWriter<BuilderType>::TypedColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      uint64_t words[1];
+      if (!parser::parse_decimal(value, length, this->field_.decimals, words)) {
+        return this->invalid_value("decimal", value, length);
+      }
+      return this->builder_->Append(static_cast<int64_t>(words[0]));
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+  };
+
+  // DECIMAL with decimal_as: :float64
+  template <typename BuilderType>
+  class FloatDecimalColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using TypedColumnWriter<BuilderType>::TypedColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      double val;
+      if (!parser::parse_floating(value, length, &val)) {
+        return this->invalid_value("decimal", value, length);
+      }
+      return this->builder_->Append(val);
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+  };
+
+  // The base of the writers of the timestamp arrays
+  //
+  // Values are appended as the wall clock of the database time zone,
+  // and converted into UTC at once for each batch if it is the local one.
+  template <typename BuilderType>
+  class TimestampColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    template <typename Builder>
+    TimestampColumnWriter(const MYSQL_FIELD& field,
+                          std::unique_ptr<Builder> builder,
+                          const ColumnWriterOptions& options)
+        : TypedColumnWriter<BuilderType>(field, std::move(builder)),
+          local_time_offsets_(options.local_time ? new LocalTimeOffsets() : nullptr) {}
+
+    arrow::Status finish(std::shared_ptr<arrow::Array>* out) override {
+      ARROW_RETURN_NOT_OK(this->builder_->Finish(out));
+      const auto& data = (*out)->data();
+      if (local_time_offsets_ && data->length > 0) {
+        local_time_offsets_->to_utc(data->GetMutableValues<int64_t>(1), data->length);
+      }
+      return arrow::Status::OK();
+    }
+
+   private:
+    std::unique_ptr<LocalTimeOffsets> local_time_offsets_;
+  };
+
+  // DATETIME and TIMESTAMP
+  template <typename BuilderType>
+  class DateTimeColumnWriter : public TimestampColumnWriter<BuilderType> {
+   public:
+    using TimestampColumnWriter<BuilderType>::TimestampColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      parser::DateTime t;
+      if (!parser::parse_datetime_time(value, length, &t)) {
+        return this->invalid_value("datetime", value, length);
+      }
+      int32_t days;
+      if (!date_cache_.lookup(value, &days)) {
+        if (!parser::parse_date(value, parser::kDateLength, &t)) {
+          return this->invalid_value("datetime", value, length);
+        }
+        if (t.year + t.month + t.day == 0) {
+          return this->builder_->AppendNull();
+        } else if (t.month < 1 || t.day < 1) {
+          return this->invalid_date(std::string(value, length).c_str());
+        }
+        days = civil_to_days(t.year, t.month, t.day);
+        date_cache_.store(value, days);
+      }
+      return this->builder_->Append(
+          1000000LL * (86400LL * days + 3600LL * t.hour + 60LL * t.minute + t.second) +
+          t.microsecond);
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long) override {
+      const auto& t = *static_cast<const MYSQL_TIME*>(bind.buffer);
+      if (t.year + t.month + t.day == 0) {
+        return this->builder_->AppendNull();
+      } else if (t.month < 1 || t.day < 1) {
+        return this->invalid_date(t);
+      }
+      auto value = civil_to_timestamp(t.year, t.month, t.day, t.hour, t.minute, t.second);
+      return this->builder_->Append(value + t.second_part);
+    }
+
+   private:
+    DatePrefixCache date_cache_;
+  };
+
+  // TIME
+  //
+  // Note that we convert the TIME value to Timestamp
+  // because mysql2 converts it to Time object
+  template <typename BuilderType>
+  class TimeColumnWriter : public TimestampColumnWriter<BuilderType> {
+   public:
+    template <typename Builder>
+    TimeColumnWriter(const MYSQL_FIELD& field,
+                     std::unique_ptr<Builder> builder,
+                     const ColumnWriterOptions& options)
+        : TimestampColumnWriter<BuilderType>(field, std::move(builder), options),
+          base_(civil_to_timestamp(2000, 1, 1, 0, 0, 0)) {}
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      int64_t usec;
+      if (!parser::parse_time(value, length, &usec)) {
+        return this->invalid_value("time", value, length);
+      }
+      return this->builder_->Append(base_ + usec);
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long) override {
+      const auto& t = *static_cast<const MYSQL_TIME*>(bind.buffer);
+      int64_t usec = 1000000LL * (3600LL * t.hour + 60LL * t.minute + t.second) + t.second_part;
+      if (t.neg) {
+        usec = -usec;
+      }
+      return this->builder_->Append(base_ + usec);
+    }
+
+   private:
+    int64_t base_;
+  };
+
+  // DATE
+  template <typename BuilderType>
+  class DateColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using TypedColumnWriter<BuilderType>::TypedColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      int32_t days;
+      if (length == parser::kDateLength && date_cache_.lookup(value, &days)) {
+        return this->builder_->Append(days);
+      }
+      parser::DateTime t;
+      if (!parser::parse_date(value, length, &t)) {
+        return this->invalid_value("date", value, length);
+      }
+      if (t.year + t.month + t.day == 0) {
+        return this->builder_->AppendNull();
+      } else if (t.month < 1 || t.day < 1) {
+        return this->invalid_date(std::string(value, length).c_str());
+      }
+      days = civil_to_days(t.year, t.month, t.day);
+      date_cache_.store(value, days);
+      return this->builder_->Append(days);
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long) override {
+      const auto& t = *static_cast<const MYSQL_TIME*>(bind.buffer);
+      if (t.year + t.month + t.day == 0) {
+        return this->builder_->AppendNull();
+      } else if (t.month < 1 || t.day < 1) {
+        return this->invalid_date(t);
+      }
+      return this->builder_->Append(civil_to_days(t.year, t.month, t.day));
+    }
+
+   private:
+    DatePrefixCache date_cache_;
+  };
+
+  // The data bytes reserved for a value of a variable-width column at most.
+  // max_length of TEXT and BLOB tells little about the typical length,
+  // so that it is not trusted beyond this.
+  constexpr int64_t kMaxReservedValueLength = 64;
+
+  // The data bytes reserved for a batch at most
+  constexpr int64_t kMaxReservedDataLength = 1 << 30;
+
+  // The data bytes of a batch of at most the given rows beyond which it is
+  // flushed early. It is checked after each row or chunk of rows, and it
+  // leaves the room of 1 GiB to the 2 GiB of 32-bit offsets for them.
+  constexpr int64_t kMaxBatchDataLength = 1 << 30;
+
+  // CHAR, VARCHAR, TEXT, BLOB, BIT and the values not to be casted
+  //
+  // The builder is of 64-bit offsets for LONGTEXT and LONGBLOB, whose
+  // values can be up to 4 GiB.
+  template <typename BuilderType>
+  class BinaryColumnWriter : public TypedColumnWriter<BuilderType> {
+   public:
+    using ArrayType =
+      typename arrow::TypeTraits<typename BuilderType::TypeClass>::ArrayType;
+    using offset_type = typename BuilderType::offset_type;
+
+    BinaryColumnWriter(const MYSQL_FIELD& field, std::unique_ptr<arrow::ArrayBuilder> builder)
+        : TypedColumnWriter<BuilderType>(field, std::move(builder)),
+          value_length_(std::min<int64_t>(field.max_length > 0 ? field.max_length : field.length,
+                                          kMaxReservedValueLength)) {}
+
+    // The data capacity is estimated from the field width for the first
+    // batch, and from the average length of the previous batch after that
+    arrow::Status reserve(int64_t n_rows) override {
+      ARROW_RETURN_NOT_OK(this->builder_->Reserve(n_rows));
+      return this->builder_->ReserveData(
+          std::min<int64_t>(n_rows * value_length_, kMaxReservedDataLength));
+    }
+
+    // The values beyond the offsets are left to append to report
+    arrow::Status reserve_data(int64_t n_bytes) override {
+      if (this->builder_->value_data_length() + n_bytes > BuilderType::memory_limit()) {
+        return arrow::Status::OK();
+      }
+      return this->builder_->ReserveData(n_bytes);
+    }
+
+    arrow::Status finish(std::shared_ptr<arrow::Array>* out) override {
+      ARROW_RETURN_NOT_OK(this->builder_->Finish(out));
+      const auto& array = static_cast<const ArrayType&>(**out);
+      if (array.length() > 0) {
+        const int64_t data_length = array.value_offset(array.length()) - array.value_offset(0);
+        value_length_ = (data_length + array.length() - 1) / array.length();
+      }
+      return arrow::Status::OK();
+    }
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      if (ARROW_PREDICT_FALSE(static_cast<uint64_t>(length) >
+                              static_cast<uint64_t>(std::numeric_limits<offset_type>::max()))) {
+        return too_large(length);
+      }
+      auto status = this->builder_->Append(value, static_cast<offset_type>(length));
+      if (ARROW_PREDICT_FALSE(!status.ok())) {
+        return status.IsCapacityError() ? too_large(length) : status;
+      }
+      return status;
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+
+   private:
+    // The values of a batch exceed the offsets, which happens only for
+    // a single batch of to_arrow
+    arrow::Status too_large(unsigned long length) const {
+      return arrow::Status::CapacityError(
+        "Too large data for a record batch in field '",
+        std::string(this->field_.name, this->field_.name_length),
+        "': ", this->builder_->value_data_length(), " + ", length,
+        " bytes; use to_arrow_table or each_record_batch to split it");
+    }
+
+    int64_t value_length_;
+  };
+
+  // Values in Latin-1 (ISO-8859-1) not to be casted, transcoded into UTF-8
+  template <typename BuilderType>
+  class Latin1ColumnWriter : public BinaryColumnWriter<BuilderType> {
+   public:
+    using BinaryColumnWriter<BuilderType>::BinaryColumnWriter;
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      const auto bytes = reinterpret_cast<const unsigned char*>(value);
+      unsigned long n_non_ascii = 0;
+      for (unsigned long i = 0; i < length; ++i) {
+        n_non_ascii += bytes[i] >> 7;
+      }
+      if (n_non_ascii == 0) {
+        return BinaryColumnWriter<BuilderType>::append(value, length);
+      }
+      // Each of U+0080-U+00FF is 2 bytes in UTF-8
+      buffer_.resize(length + n_non_ascii);
+      char* out = &buffer_[0];
+      for (unsigned long i = 0; i < length; ++i) {
+        const unsigned char c = bytes[i];
+        if (c < 0x80) {
+          *out++ = static_cast<char>(c);
+        } else {
+          *out++ = static_cast<char>(0xC0 | (c >> 6));
+          *out++ = static_cast<char>(0x80 | (c & 0x3F));
+        }
+      }
+      return BinaryColumnWriter<BuilderType>::append(buffer_.data(), buffer_.size());
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+
+   private:
+    std::string buffer_;
+  };
+
+  // DictionaryMemo assigns an index to each distinct value of a
+  // dictionary-encoded column.
+  //
+  // The memo is kept across batches, so that an index means the same value
+  // in all the batches and the dictionary of a batch is the one of the
+  // previous batch with new values appended. The dictionary is utf8, or
+  // binary for the columns of the binary charset.
+  class DictionaryMemo {
+   public:
+    DictionaryMemo(std::shared_ptr<arrow::DataType> value_type, arrow::MemoryPool* pool)
+        : value_type_(std::move(value_type)),
+          pool_(pool) {}
+
+    // Get the index of the value, adding the value if it is new
+    arrow::Status get_or_insert(const char* value, unsigned long length,
+                                int64_t max_index, int64_t* index) {
+      // Reuse the buffer of the key not to allocate for each lookup
+      key_.assign(value, length);
+      auto it = indices_.find(key_);
+      if (it != indices_.end()) {
+        *index = it->second;
+        return arrow::Status::OK();
+      }
+      if (static_cast<int64_t>(values_.size()) > max_index) {
+        return arrow::Status::CapacityError("Too many distinct values for dictionary index");
+      }
+      *index = static_cast<int64_t>(values_.size());
+      auto inserted = indices_.emplace(key_, *index);
+      values_.push_back(&inserted.first->first);
+      return arrow::Status::OK();
+    }
+
+    // Make the dictionary of the values seen so far
+    arrow::Status finish(std::shared_ptr<arrow::Array>* out) const {
+      std::unique_ptr<arrow::BinaryBuilder> builder;
+      if (value_type_->id() == arrow::Type::STRING) {
+        builder.reset(new arrow::StringBuilder(pool_));
+      } else {
+        builder.reset(new arrow::BinaryBuilder(pool_));
+      }
+      ARROW_RETURN_NOT_OK(builder->Reserve(static_cast<int64_t>(values_.size())));
+      for (const auto value : values_) {
+        ARROW_RETURN_NOT_OK(builder->Append(value->data(), static_cast<int32_t>(value->size())));
+      }
+      return builder->Finish(out);
+    }
+
+   private:
+    std::shared_ptr<arrow::DataType> value_type_;
+    arrow::MemoryPool* pool_;
+    std::string key_;
+    std::unordered_map<std::string, int64_t> indices_;
+    // The keys of indices_ in the order of their indices;
+    // the keys of an unordered_map are never moved
+    std::vector<const std::string*> values_;
+  };
+
+  // ENUM, and the columns in the dictionary_columns option
+  template <typename IndexType>
+  class DictionaryColumnWriter : public ColumnWriter {
+   public:
+    using IndexBuilderType = typename arrow::TypeTraits<IndexType>::BuilderType;
+    using IndexCType = typename IndexType::c_type;
+
+    DictionaryColumnWriter(const MYSQL_FIELD& field,
+                           std::shared_ptr<arrow::DataType> type,
+                           arrow::MemoryPool* pool)
+        : ColumnWriter(field),
+          type_(std::move(type)),
+          memo_(static_cast<const arrow::DictionaryType&>(*type_).value_type(), pool),
+          indices_builder_(pool) {}
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      int64_t index;
+      ARROW_RETURN_NOT_OK(memo_.get_or_insert(value, length,
+                                              std::numeric_limits<IndexCType>::max(),
+                                              &index));
+      return indices_builder_.Append(static_cast<IndexCType>(index));
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+
+    arrow::Status append_null() override { return indices_builder_.AppendNull(); }
+
+    arrow::Status append_nulls(int64_t n) override { return indices_builder_.AppendNulls(n); }
+
+    arrow::Status reserve(int64_t n_rows) override { return indices_builder_.Reserve(n_rows); }
+
+    arrow::Status finish(std::shared_ptr<arrow::Array>* out) override {
+      std::shared_ptr<arrow::Array> indices;
+      ARROW_RETURN_NOT_OK(indices_builder_.Finish(&indices));
+      std::shared_ptr<arrow::Array> dictionary;
+      ARROW_RETURN_NOT_OK(memo_.finish(&dictionary));
+      out->reset(new arrow::DictionaryArray(type_, indices, dictionary));
+      return arrow::Status::OK();
+    }
+
+   private:
+    std::shared_ptr<arrow::DataType> type_;
+    DictionaryMemo memo_;
+    IndexBuilderType indices_builder_;
+  };
+
+  // SET
+  //
+  // A value such as "a,b" is a list of the dictionary-encoded members,
+  // and the empty string is the empty set.
+  class SetColumnWriter : public ColumnWriter {
+   public:
+    SetColumnWriter(const MYSQL_FIELD& field,
+                    std::shared_ptr<arrow::DataType> type,
+                    arrow::MemoryPool* pool)
+        : ColumnWriter(field),
+          type_(std::move(type)),
+          memo_(arrow::utf8(), pool),
+          indices_builder_(std::make_shared<arrow::Int16Builder>(pool)),
+          list_builder_(pool, indices_builder_) {}
+
+    arrow::Status append(const char* value, unsigned long length) override {
+      ARROW_RETURN_NOT_OK(list_builder_.Append());
+      const char* end = value + length;
+      while (value < end) {
+        const char* separator = static_cast<const char*>(std::memchr(value, ',', end - value));
+        const char* member_end = separator ? separator : end;
+        int64_t index;
+        ARROW_RETURN_NOT_OK(memo_.get_or_insert(value, member_end - value,
+                                                std::numeric_limits<int16_t>::max(),
+                                                &index));
+        ARROW_RETURN_NOT_OK(indices_builder_->Append(static_cast<int16_t>(index)));
+        value = member_end + 1;
+      }
+      return arrow::Status::OK();
+    }
+
+    arrow::Status append(const MYSQL_BIND& bind, unsigned long length) override {
+      return append(static_cast<const char*>(bind.buffer), length);
+    }
+
+    arrow::Status append_null() override { return list_builder_.AppendNull(); }
+
+    // One member for each value is assumed
+    arrow::Status reserve(int64_t n_rows) override {
+      ARROW_RETURN_NOT_OK(list_builder_.Reserve(n_rows));
+      return indices_builder_->Reserve(n_rows);
+    }
+
+    // The list builder makes list<int16>, which is rewrapped
+    // as the list of the dictionary-encoded members
+    arrow::Status finish(std::shared_ptr<arrow::Array>* out) override {
+      std::shared_ptr<arrow::Array> array;
+      ARROW_RETURN_NOT_OK(list_builder_.Finish(&array));
+      const auto& list = static_cast<const arrow::ListArray&>(*array);
+      std::shared_ptr<arrow::Array> dictionary;
+      ARROW_RETURN_NOT_OK(memo_.finish(&dictionary));
+      const auto& list_type = static_cast<const arrow::ListType&>(*type_);
+      auto members = std::make_shared<arrow::DictionaryArray>(list_type.value_type(),
+                                                              list.values(),
+                                                              dictionary);
+      out->reset(new arrow::ListArray(type_,
+                                      list.length(),
+                                      list.value_offsets(),
+                                      members,
+                                      list.null_bitmap(),
+                                      list.null_count(),
+                                      list.offset()));
+      return arrow::Status::OK();
+    }
+
+   private:
+    std::shared_ptr<arrow::DataType> type_;
+    DictionaryMemo memo_;
+    std::shared_ptr<arrow::Int16Builder> indices_builder_;
+    arrow::ListBuilder list_builder_;
+  };
+
+  // Make the writer of the given field for the Arrow type in the schema
+  arrow::Status make_column_writer(const MYSQL_FIELD& field,
+                                   const std::shared_ptr<arrow::DataType>& type,
+                                   arrow::MemoryPool* pool,
+                                   const ColumnWriterOptions& options,
+                                   std::unique_ptr<ColumnWriter>* out);
+
+  // BatchBuilder appends rows into the column writers compiled from a schema,
+  // and flushes them as record batches.
+  //
+  // NULLs are counted for each column, and appended at once as a run
+  // before the next value of the column or the flush, which makes the
+  // sparse columns cheap.
+  class BatchBuilder {
+   public:
+    BatchBuilder(std::shared_ptr<arrow::Schema> schema,
+                 std::vector<std::unique_ptr<ColumnWriter>> writers)
+        : schema_(std::move(schema)),
+          writers_(std::move(writers)),
+          null_runs_(writers_.size(), 0),
+          num_rows_(0),
+          data_length_(0),
+          stats_(nullptr) {}
+
+    const std::shared_ptr<arrow::Schema>& schema() const { return schema_; }
+
+    int64_t num_rows() const { return num_rows_; }
+
+    // Whether the values appended since the last flush have reached
+    // kMaxBatchDataLength, so that a batch of at most the given rows
+    // should be flushed before the next row
+    bool full() const { return data_length_ >= kMaxBatchDataLength; }
+
+    // Record the statistics of the rows appended from now into stats,
+    // which must outlive the builder
+    void set_stats(FetchStats* stats) { stats_ = stats; }
+
+    // Append a row of the text protocol
+    arrow::Status append_row(const MYSQL_ROW row, const unsigned long* lengths) {
+      if (stats_) {
+        return append_row_with_stats(row, lengths);
+      }
+      const size_t n = writers_.size();
+      for (size_t i = 0; i < n; ++i) {
+        ARROW_RETURN_NOT_OK(append_value(i, row[i], lengths[i]));
+      }
+      ++num_rows_;
+      return arrow::Status::OK();
+    }
+
+    // Append a row in the result buffers bound by the binary protocol
+    arrow::Status append_row(const MYSQL_BIND* binds) {
+      if (stats_) {
+        return append_row_with_stats(binds);
+      }
+      const size_t n = writers_.size();
+      for (size_t i = 0; i < n; ++i) {
+        ARROW_RETURN_NOT_OK(append_value(i, binds[i]));
+      }
+      ++num_rows_;
+      return arrow::Status::OK();
+    }
+
+    // Append n_rows rows of the text protocol column by column: the j-th
+    // value of the i-th column is values[i * n_rows + j]
+    arrow::Status append_columns(const char* const* values,
+                                 const unsigned long* lengths,
+                                 int64_t n_rows);
+
+    // Reserve the capacity of all the columns for the next n_rows rows
+    arrow::Status reserve(int64_t n_rows) {
+      const int64_t start = stats_ ? monotonic_ns() : 0;
+      for (auto& writer : writers_) {
+        ARROW_RETURN_NOT_OK(writer->reserve(n_rows));
+      }
+      if (stats_) {
+        stats_->reserve_ns += monotonic_ns() - start;
+      }
+      return arrow::Status::OK();
+    }
+
+    // Make a record batch from the appended rows, and reset the builders
+    arrow::Status flush(std::shared_ptr<arrow::RecordBatch>* out);
+
+   private:
+    // A value of the text protocol is NULL if it is nullptr
+    arrow::Status append_value(size_t i, const char* value, unsigned long length) {
+      if (!value) {
+        ++null_runs_[i];
+        return arrow::Status::OK();
+      }
+      if (null_runs_[i] > 0) {
+        ARROW_RETURN_NOT_OK(append_null_run(i));
+      }
+      data_length_ += length;
+      return writers_[i]->append(value, length);
+    }
+
+    arrow::Status append_value(size_t i, const MYSQL_BIND& bind) {
+      if (*bind.is_null) {
+        ++null_runs_[i];
+        return arrow::Status::OK();
+      }
+      if (null_runs_[i] > 0) {
+        ARROW_RETURN_NOT_OK(append_null_run(i));
+      }
+      data_length_ += *bind.length;
+      return writers_[i]->append(bind, *bind.length);
+    }
+
+    arrow::Status append_null_run(size_t i) {
+      const int64_t n = null_runs_[i];
+      null_runs_[i] = 0;
+      return writers_[i]->append_nulls(n);
+    }
+
+    arrow::Status append_row_with_stats(const MYSQL_ROW row, const unsigned long* lengths);
+    arrow::Status append_row_with_stats(const MYSQL_BIND* binds);
+
+    std::shared_ptr<arrow::Schema> schema_;
+    std::vector<std::unique_ptr<ColumnWriter>> writers_;
+    // The numbers of the NULLs not appended yet
+    std::vector<int64_t> null_runs_;
+    int64_t num_rows_;
+    // The bytes of the values appended since the last flush
+    int64_t data_length_;
+    FetchStats* stats_;
+  };
+}
@@ -34,6 +34,11 @@ unless required_pkg_config_package("arrow-glib",
   exit(false)
 end
 
+# Parquet is optional for write_arrow(format: :parquet)
+if PKGConfig.have_package("parquet")
+  $defs << "-DMYSQL2_ARROW_HAVE_PARQUET"
+end
+
 [
   ["glib2", "ext/glib2"],
 ].each do |name, source_dir|
@@ -58,6 +63,20 @@ unless have_header('mysql.h') || have_header('mysql/mysql.h')
   abort
 end
 
+# libmysqlclient 8.0.16 or later for to_arrow(nonblocking: true)
+have_func('mysql_fetch_row_nonblocking',
+          $defs.include?('-DHAVE_MYSQL_H') ? 'mysql.h' : 'mysql/mysql.h')
+
+# libmysqlclient, not MariaDB Connector/C, for to_arrow(packet_reader: true)
+have_func('my_net_read',
+          $defs.include?('-DHAVE_MYSQL_H') ? 'mysql.h' : 'mysql/mysql.h')
+
+# Mysql2Arrow::Internal, the entry points of the tests into the parsers,
+# only by --enable-internal
+if enable_config("internal", false)
+  $defs << "-DMYSQL2_ARROW_INTERNAL"
+end
+
 checking_for(checking_message("mysql2"), "%s") do
   mysql2_spec = Gem::Specification.find_by_name("mysql2")
   $INCFLAGS += " -I#{mysql2_spec.gem_dir}/ext"
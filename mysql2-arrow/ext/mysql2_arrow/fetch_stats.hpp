@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace mysql2_arrow {
+  inline int64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // FetchStats accumulates where the time of a conversion goes, for the
+  // stats: true option.
+  //
+  // Reading the clock for each value would cost as much as parsing a short
+  // value, so that fetching and parsing are timed only on every
+  // kSampleInterval-th row and scaled to all the rows by estimate.
+  // Reserving and flushing happen once for each batch, and are timed
+  // exactly.
+  struct FetchStats {
+    static constexpr int64_t kSampleInterval = 64;
+
+    explicit FetchStats(size_t n_columns)
+        : n_fetches(0),
+          n_sampled_fetches(0),
+          sampled_fetch_ns(0),
+          n_rows(0),
+          n_bytes(0),
+          n_sampled_rows(0),
+          sampled_parse_ns(0),
+          sampled_column_parse_ns(n_columns, 0),
+          null_counts(n_columns, 0),
+          n_batches(0),
+          reserve_ns(0),
+          flush_ns(0),
+          total_ns(0) {}
+
+    // Whether to time the next call of mysql_fetch_row or mysql_stmt_fetch
+    bool sample_fetch() {
+      return n_fetches++ % kSampleInterval == 0;
+    }
+
+    // Whether to time the parsing of the next row
+    bool sample_row() const {
+      return n_rows % kSampleInterval == 0;
+    }
+
+    // Scale the time sampled from n_samples of n_total calls
+    static int64_t estimate(int64_t sampled_ns, int64_t n_samples, int64_t n_total) {
+      if (n_samples == 0) {
+        return 0;
+      }
+      return static_cast<int64_t>(static_cast<double>(sampled_ns) * n_total / n_samples);
+    }
+
+    int64_t fetch_ns() const {
+      return estimate(sampled_fetch_ns, n_sampled_fetches, n_fetches);
+    }
+
+    int64_t parse_ns() const {
+      return estimate(sampled_parse_ns, n_sampled_rows, n_rows);
+    }
+
+    int64_t column_parse_ns(size_t i) const {
+      return estimate(sampled_column_parse_ns[i], n_sampled_rows, n_rows);
+    }
+
+    int64_t n_fetches;
+    int64_t n_sampled_fetches;
+    int64_t sampled_fetch_ns;
+
+    int64_t n_rows;
+    // The bytes of the values read from the result
+    int64_t n_bytes;
+    int64_t n_sampled_rows;
+    int64_t sampled_parse_ns;
+    std::vector<int64_t> sampled_column_parse_ns;
+    std::vector<int64_t> null_counts;
+
+    int64_t n_batches;
+    int64_t reserve_ns;
+    int64_t flush_ns;
+    // The whole time of the conversion, which is measured by the caller
+    int64_t total_ns;
+  };
+}
@@ -0,0 +1,118 @@
+#include <vector>
+
+#include "mysql2_arrow.hpp"
+#include "packet_reader.hpp"
+#include "parser.hpp"
+
+#ifdef MYSQL2_ARROW_INTERNAL
+namespace mysql2_arrow {
+  namespace {
+    // The parsers of the column writers, which otherwise can only be fed
+    // by a server, for the tests of the values a server doesn't send.
+    // nil for a value they reject.
+    VALUE internal_parse_double(VALUE, VALUE rb_value) {
+      StringValue(rb_value);
+      double value;
+      if (!parser::parse_floating(RSTRING_PTR(rb_value),
+                                  static_cast<unsigned long>(RSTRING_LEN(rb_value)),
+                                  &value)) {
+        return Qnil;
+      }
+      return DBL2NUM(value);
+    }
+
+    VALUE internal_parse_float(VALUE, VALUE rb_value) {
+      StringValue(rb_value);
+      float value;
+      if (!parser::parse_floating(RSTRING_PTR(rb_value),
+                                  static_cast<unsigned long>(RSTRING_LEN(rb_value)),
+                                  &value)) {
+        return Qnil;
+      }
+      return DBL2NUM(value);
+    }
+
+    // The values of a row packet of the text protocol, nil for NULL.
+    // Mysql2::Error for a malformed packet like PacketReader.
+    VALUE split_row_packet_values(VALUE rb_packet, VALUE rb_n_fields) {
+      StringValue(rb_packet);
+      const unsigned int n_fields = NUM2UINT(rb_n_fields);
+      const auto packet = reinterpret_cast<const uint8_t*>(RSTRING_PTR(rb_packet));
+      std::vector<size_t> offsets(n_fields);
+      std::vector<unsigned long> lengths(n_fields);
+      const auto status = split_row_packet(packet,
+                                           static_cast<size_t>(RSTRING_LEN(rb_packet)),
+                                           n_fields,
+                                           0,
+                                           offsets.data(),
+                                           lengths.data());
+      if (!status.ok()) {
+        // Raised after the vectors are destroyed
+        return rb_exc_new_cstr(eMysql2Error, status.message().c_str());
+      }
+      VALUE values = rb_ary_new_capa(n_fields);
+      for (unsigned int i = 0; i < n_fields; ++i) {
+        if (offsets[i] == kNullValueOffset) {
+          rb_ary_push(values, Qnil);
+        } else {
+          rb_ary_push(values, rb_str_new(RSTRING_PTR(rb_packet) + offsets[i], lengths[i]));
+        }
+      }
+      return values;
+    }
+
+    VALUE internal_split_row_packet(VALUE, VALUE rb_packet, VALUE rb_n_fields) {
+      VALUE values = split_row_packet_values(rb_packet, rb_n_fields);
+      if (rb_obj_is_kind_of(values, rb_eException)) {
+        rb_exc_raise(values);
+      }
+      return values;
+    }
+
+    // [warning_count, server_status] of the packet at the end of the rows,
+    // or nil if it is too short
+    VALUE internal_parse_terminator_packet(VALUE, VALUE rb_packet, VALUE rb_deprecate_eof) {
+      StringValue(rb_packet);
+      const auto terminator =
+        parse_terminator_packet(reinterpret_cast<const uint8_t*>(RSTRING_PTR(rb_packet)),
+                                static_cast<size_t>(RSTRING_LEN(rb_packet)),
+                                RTEST(rb_deprecate_eof));
+      if (!terminator.valid) {
+        return Qnil;
+      }
+      return rb_ary_new_from_args(2,
+                                  UINT2NUM(terminator.warning_count),
+                                  UINT2NUM(terminator.server_status));
+    }
+
+    // [error_code, sqlstate, message] of an ERR packet
+    VALUE internal_parse_error_packet(VALUE, VALUE rb_packet) {
+      StringValue(rb_packet);
+      const auto error =
+        parse_error_packet(reinterpret_cast<const uint8_t*>(RSTRING_PTR(rb_packet)),
+                           static_cast<size_t>(RSTRING_LEN(rb_packet)));
+      return rb_ary_new_from_args(3,
+                                  UINT2NUM(error.error_code),
+                                  rb_str_new(error.sqlstate.data(), error.sqlstate.size()),
+                                  rb_str_new(error.message.data(), error.message.size()));
+    }
+  }
+
+  // Mysql2Arrow::Internal is not a part of the API; it is built only by
+  // extconf.rb --enable-internal for the tests
+  void init_internal_extension() {
+    VALUE mInternal = rb_define_module_under(mMysql2Arrow, "Internal");
+
+    rb_define_module_function(mInternal, "parse_double",
+                              reinterpret_cast<rb::RawMethod>(internal_parse_double), 1);
+    rb_define_module_function(mInternal, "parse_float",
+                              reinterpret_cast<rb::RawMethod>(internal_parse_float), 1);
+    rb_define_module_function(mInternal, "split_row_packet",
+                              reinterpret_cast<rb::RawMethod>(internal_split_row_packet), 2);
+    rb_define_module_function(mInternal, "parse_terminator_packet",
+                              reinterpret_cast<rb::RawMethod>(internal_parse_terminator_packet), 2);
+    rb_define_module_function(mInternal, "parse_error_packet",
+                              reinterpret_cast<rb::RawMethod>(internal_parse_error_packet), 1);
+  }
+}
+#endif
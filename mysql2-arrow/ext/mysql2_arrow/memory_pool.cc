@@ -0,0 +1,242 @@
+#include "memory_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace mysql2_arrow {
+  namespace {
+    constexpr int64_t kAlignment = 64;
+
+    // The size of the chunks of an arena; larger allocations get their own
+    constexpr int64_t kArenaChunkSize = 4 << 20;
+
+    int64_t align(int64_t size) {
+      return (size + kAlignment - 1) & ~(kAlignment - 1);
+    }
+
+    // A buffer keeping the pool alive, which frees the wrapped buffer
+    class PoolRetainingBuffer : public arrow::Buffer {
+     public:
+      PoolRetainingBuffer(std::shared_ptr<arrow::MemoryPool> pool,
+                          std::shared_ptr<arrow::Buffer> buffer)
+          : arrow::Buffer(buffer->data(), buffer->size()),
+            pool_(std::move(pool)),
+            buffer_(std::move(buffer)) {}
+
+     private:
+      // buffer_ is destroyed before pool_
+      std::shared_ptr<arrow::MemoryPool> pool_;
+      std::shared_ptr<arrow::Buffer> buffer_;
+    };
+
+    std::shared_ptr<arrow::ArrayData>
+    retain_memory_pool(const std::shared_ptr<arrow::ArrayData>& data,
+                       const std::shared_ptr<arrow::MemoryPool>& pool) {
+      auto retained = std::make_shared<arrow::ArrayData>(*data);
+      for (auto& buffer : retained->buffers) {
+        if (buffer) {
+          buffer = std::make_shared<PoolRetainingBuffer>(pool, buffer);
+        }
+      }
+      for (auto& child : retained->child_data) {
+        child = retain_memory_pool(child, pool);
+      }
+      if (retained->dictionary) {
+        retained->dictionary = retain_memory_pool(retained->dictionary, pool);
+      }
+      return retained;
+    }
+  }
+
+  QueryMemoryPool::QueryMemoryPool(arrow::MemoryPool* backend, bool arena, int64_t limit)
+      : backend_(backend),
+        arena_(arena),
+        limit_(limit),
+        bytes_allocated_(0),
+        max_memory_(0),
+        total_bytes_allocated_(0),
+        num_allocations_(0),
+        chunk_used_(0),
+        last_allocation_(nullptr) {}
+
+  QueryMemoryPool::~QueryMemoryPool() {
+    for (const auto& chunk : chunks_) {
+      backend_->Free(chunk.data, chunk.size);
+    }
+  }
+
+#if ARROW_VERSION_MAJOR >= 12
+  arrow::Status QueryMemoryPool::Allocate(int64_t size, int64_t, uint8_t** out) {
+    return allocate(size, out);
+  }
+
+  arrow::Status QueryMemoryPool::Reallocate(int64_t old_size, int64_t new_size, int64_t,
+                                            uint8_t** ptr) {
+    return reallocate(old_size, new_size, ptr);
+  }
+
+  void QueryMemoryPool::Free(uint8_t* buffer, int64_t size, int64_t) {
+    free(buffer, size);
+  }
+#else
+  arrow::Status QueryMemoryPool::Allocate(int64_t size, uint8_t** out) {
+    return allocate(size, out);
+  }
+
+  arrow::Status QueryMemoryPool::Reallocate(int64_t old_size, int64_t new_size, uint8_t** ptr) {
+    return reallocate(old_size, new_size, ptr);
+  }
+
+  void QueryMemoryPool::Free(uint8_t* buffer, int64_t size) {
+    free(buffer, size);
+  }
+#endif
+
+  int64_t QueryMemoryPool::bytes_allocated() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_allocated_;
+  }
+
+  int64_t QueryMemoryPool::max_memory() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_memory_;
+  }
+
+  int64_t QueryMemoryPool::total_bytes_allocated() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return total_bytes_allocated_;
+  }
+
+  int64_t QueryMemoryPool::num_allocations() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_allocations_;
+  }
+
+  std::string QueryMemoryPool::backend_name() const {
+    return arena_ ? "arena" : backend_->backend_name();
+  }
+
+  arrow::Status QueryMemoryPool::allocate(int64_t size, uint8_t** out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // An arena counts its chunks instead of the buffers
+    if (arena_) {
+      return arena_allocate(size, out);
+    }
+    ARROW_RETURN_NOT_OK(check_limit(size));
+    ARROW_RETURN_NOT_OK(backend_->Allocate(size, out));
+    allocated(size);
+    return arrow::Status::OK();
+  }
+
+  arrow::Status QueryMemoryPool::reallocate(int64_t old_size, int64_t new_size, uint8_t** ptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (arena_) {
+      return arena_reallocate(old_size, new_size, ptr);
+    }
+    ARROW_RETURN_NOT_OK(check_limit(new_size - old_size));
+    ARROW_RETURN_NOT_OK(backend_->Reallocate(old_size, new_size, ptr));
+    bytes_allocated_ -= old_size;
+    allocated(new_size);
+    return arrow::Status::OK();
+  }
+
+  void QueryMemoryPool::free(uint8_t* buffer, int64_t size) {
+    // Memory in an arena is freed with the pool
+    if (arena_) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    backend_->Free(buffer, size);
+    bytes_allocated_ -= size;
+  }
+
+  arrow::Status QueryMemoryPool::check_limit(int64_t additional_size) const {
+    if (limit_ > 0 && bytes_allocated_ + additional_size > limit_) {
+      return arrow::Status::OutOfMemory("Memory limit of ", limit_, " bytes exceeded: ",
+                                        bytes_allocated_, " bytes allocated and ",
+                                        additional_size, " bytes requested");
+    }
+    return arrow::Status::OK();
+  }
+
+  arrow::Status QueryMemoryPool::arena_allocate(int64_t size, uint8_t** out) {
+    const int64_t aligned_size = align(size);
+    if (chunks_.empty() || chunk_used_ + aligned_size > chunks_.back().size) {
+      // A smaller chunk for the rest of the limit, if it is enough
+      int64_t chunk_size = kArenaChunkSize;
+      if (limit_ > 0) {
+        chunk_size = std::min(chunk_size, limit_ - bytes_allocated_);
+      }
+      Chunk chunk{nullptr, std::max(chunk_size, aligned_size)};
+      ARROW_RETURN_NOT_OK(check_limit(chunk.size));
+      ARROW_RETURN_NOT_OK(backend_->Allocate(chunk.size, &chunk.data));
+      chunks_.push_back(chunk);
+      chunk_used_ = 0;
+      allocated(chunk.size);
+    }
+    *out = chunks_.back().data + chunk_used_;
+    chunk_used_ += aligned_size;
+    last_allocation_ = *out;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status QueryMemoryPool::arena_reallocate(int64_t old_size, int64_t new_size,
+                                                  uint8_t** ptr) {
+    // Builders grow the buffer they have just allocated in most cases
+    if (*ptr == last_allocation_) {
+      const Chunk& chunk = chunks_.back();
+      const int64_t offset = *ptr - chunk.data;
+      if (offset + align(new_size) <= chunk.size) {
+        chunk_used_ = offset + align(new_size);
+        return arrow::Status::OK();
+      }
+    }
+    uint8_t* new_ptr;
+    ARROW_RETURN_NOT_OK(arena_allocate(new_size, &new_ptr));
+    std::memcpy(new_ptr, *ptr, static_cast<size_t>(std::min(old_size, new_size)));
+    *ptr = new_ptr;
+    return arrow::Status::OK();
+  }
+
+  void QueryMemoryPool::allocated(int64_t size) {
+    bytes_allocated_ += size;
+    max_memory_ = std::max(max_memory_, bytes_allocated_);
+    total_bytes_allocated_ += size;
+    ++num_allocations_;
+  }
+
+  arrow::Status make_query_memory_pool(const std::string& name,
+                                       int64_t limit,
+                                       std::shared_ptr<QueryMemoryPool>* out) {
+    arrow::MemoryPool* backend = nullptr;
+    bool arena = false;
+    if (name == "default") {
+      backend = arrow::default_memory_pool();
+    } else if (name == "system") {
+      backend = arrow::system_memory_pool();
+    } else if (name == "jemalloc") {
+      ARROW_RETURN_NOT_OK(arrow::jemalloc_memory_pool(&backend));
+    } else if (name == "mimalloc") {
+      ARROW_RETURN_NOT_OK(arrow::mimalloc_memory_pool(&backend));
+    } else if (name == "arena") {
+      backend = arrow::default_memory_pool();
+      arena = true;
+    } else {
+      return arrow::Status::Invalid("Unknown memory pool: ", name,
+                                    ": must be default, system, jemalloc, mimalloc or arena");
+    }
+    out->reset(new QueryMemoryPool(backend, arena, limit));
+    return arrow::Status::OK();
+  }
+
+  std::shared_ptr<arrow::RecordBatch>
+  retain_memory_pool(const std::shared_ptr<arrow::RecordBatch>& batch,
+                     const std::shared_ptr<arrow::MemoryPool>& pool) {
+    std::vector<std::shared_ptr<arrow::ArrayData>> columns;
+    columns.reserve(batch->num_columns());
+    for (int i = 0; i < batch->num_columns(); ++i) {
+      columns.push_back(retain_memory_pool(batch->column_data(i), pool));
+    }
+    return arrow::RecordBatch::Make(batch->schema(), batch->num_rows(), std::move(columns));
+  }
+}
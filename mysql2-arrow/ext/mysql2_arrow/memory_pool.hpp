@@ -0,0 +1,95 @@
+#pragma once
+
+#include <arrow/api.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mysql2_arrow {
+  // QueryMemoryPool is the memory pool of a to_arrow or each_record_batch
+  // call, chosen by the memory_pool option.
+  //
+  // It allocates from the backend pool, or, as an arena, from large chunks
+  // of the backend pool that are freed all at once when the pool is
+  // destroyed. It keeps the statistics of the call and enforces the
+  // memory_limit option. For an arena, both count the chunks, which hold
+  // the freed buffers and the old copies of the grown ones until the end.
+  //
+  // Buffers are always aligned to 64 bytes, Arrow's default alignment.
+  class QueryMemoryPool : public arrow::MemoryPool {
+   public:
+    // limit is the maximum bytes allocated at the same time, or 0 for no limit
+    QueryMemoryPool(arrow::MemoryPool* backend, bool arena, int64_t limit);
+    ~QueryMemoryPool() override;
+
+#if ARROW_VERSION_MAJOR >= 12
+    using arrow::MemoryPool::Allocate;
+    using arrow::MemoryPool::Reallocate;
+    using arrow::MemoryPool::Free;
+
+    arrow::Status Allocate(int64_t size, int64_t alignment, uint8_t** out) override;
+    arrow::Status Reallocate(int64_t old_size, int64_t new_size, int64_t alignment,
+                             uint8_t** ptr) override;
+    void Free(uint8_t* buffer, int64_t size, int64_t alignment) override;
+
+    int64_t total_bytes_allocated() const override;
+    int64_t num_allocations() const override;
+#else
+    arrow::Status Allocate(int64_t size, uint8_t** out) override;
+    arrow::Status Reallocate(int64_t old_size, int64_t new_size, uint8_t** ptr) override;
+    void Free(uint8_t* buffer, int64_t size) override;
+
+    int64_t total_bytes_allocated() const;
+    int64_t num_allocations() const;
+#endif
+
+    int64_t bytes_allocated() const override;
+    int64_t max_memory() const override;
+    std::string backend_name() const override;
+
+   private:
+    struct Chunk {
+      uint8_t* data;
+      int64_t size;
+    };
+
+    arrow::Status allocate(int64_t size, uint8_t** out);
+    arrow::Status reallocate(int64_t old_size, int64_t new_size, uint8_t** ptr);
+    void free(uint8_t* buffer, int64_t size);
+
+    arrow::Status check_limit(int64_t additional_size) const;
+    arrow::Status arena_allocate(int64_t size, uint8_t** out);
+    arrow::Status arena_reallocate(int64_t old_size, int64_t new_size, uint8_t** ptr);
+    void allocated(int64_t size);
+
+    arrow::MemoryPool* backend_;
+    bool arena_;
+    int64_t limit_;
+
+    mutable std::mutex mutex_;
+    int64_t bytes_allocated_;
+    int64_t max_memory_;
+    int64_t total_bytes_allocated_;
+    int64_t num_allocations_;
+
+    std::vector<Chunk> chunks_;
+    // The bytes used in the last chunk
+    int64_t chunk_used_;
+    // The last allocation in the arena, which can be grown in place
+    uint8_t* last_allocation_;
+  };
+
+  // Make the memory pool for the memory_pool option:
+  // "default", "system", "jemalloc", "mimalloc" or "arena"
+  arrow::Status make_query_memory_pool(const std::string& name,
+                                       int64_t limit,
+                                       std::shared_ptr<QueryMemoryPool>* out);
+
+  // Make the batch keep the pool alive, which its buffers are allocated
+  // from, as long as any of its buffers are alive
+  std::shared_ptr<arrow::RecordBatch>
+  retain_memory_pool(const std::shared_ptr<arrow::RecordBatch>& batch,
+                     const std::shared_ptr<arrow::MemoryPool>& pool);
+}
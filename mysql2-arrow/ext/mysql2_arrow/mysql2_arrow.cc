@@ -11,4 +11,9 @@ Init_mysql2_arrow()
   mysql2_arrow::mMysql2Arrow = rb_define_module("Mysql2Arrow");
   mysql2_arrow::eMysql2Error = rb_path2class("Mysql2::Error");
   mysql2_arrow::init_mysql2_result_extension();
+  mysql2_arrow::init_mysql2_client_extension();
+  mysql2_arrow::init_record_batch_extension();
+#ifdef MYSQL2_ARROW_INTERNAL
+  mysql2_arrow::init_internal_extension();
+#endif
 }
@@ -3,17 +3,7 @@
 #include <ruby.hpp>
 #include <ruby/encoding.h>
 
-#ifdef HAVE_MYSQL_H
-#include <mysql.h>
-#include <mysql_com.h>
-#include <errmsg.h>
-#include <mysqld_error.h>
-#else
-#include <mysql/mysql.h>
-#include <mysql/mysql_com.h>
-#include <mysql/errmsg.h>
-#include <mysql/mysqld_error.h>
-#endif
+#include "mysql.hpp"
 
 #if defined(__GNUC__) && (__GNUC__ >= 3)
 #define RB_MYSQL_NORETURN __attribute__ ((noreturn))
@@ -31,9 +21,18 @@
   mysql2_result_wrapper *wrapper; \
   Data_Get_Struct(self, mysql2_result_wrapper, wrapper);
 
+#define GET_CLIENT_WRAPPER(self) \
+  mysql_client_wrapper *wrapper; \
+  Data_Get_Struct(self, mysql_client_wrapper, wrapper);
+
 namespace mysql2_arrow {
   extern VALUE mMysql2Arrow;
   extern VALUE eMysql2Error;
 
   void init_mysql2_result_extension();
+  void init_mysql2_client_extension();
+  void init_record_batch_extension();
+#ifdef MYSQL2_ARROW_INTERNAL
+  void init_internal_extension();
+#endif
 }
@@ -0,0 +1,288 @@
+#include "packet_reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace mysql2_arrow {
+  namespace {
+    uint64_t read_uint_le(const uint8_t* data, int n_bytes) {
+      uint64_t value = 0;
+      for (int i = n_bytes - 1; i >= 0; --i) {
+        value = (value << 8) | data[i];
+      }
+      return value;
+    }
+
+    // Read a length-encoded integer at *pos, where 0xfb means NULL.
+    // It returns false if the integer runs over end.
+    bool read_length(const uint8_t** pos, const uint8_t* end,
+                     uint64_t* length, bool* null) {
+      if (*pos >= end) {
+        return false;
+      }
+      const uint8_t first = *(*pos)++;
+      int n_bytes = 0;
+      *null = false;
+      switch (first) {
+        case 0xfb:
+          *null = true;
+          *length = 0;
+          return true;
+        case 0xfc:
+          n_bytes = 2;
+          break;
+        case 0xfd:
+          n_bytes = 3;
+          break;
+        case 0xfe:
+          n_bytes = 8;
+          break;
+        case 0xff:
+          return false;
+        default:
+          *length = first;
+          return true;
+      }
+      if (end - *pos < n_bytes) {
+        return false;
+      }
+      *length = read_uint_le(*pos, n_bytes);
+      *pos += n_bytes;
+      return true;
+    }
+  }
+
+  arrow::Status split_row_packet(const uint8_t* packet,
+                                 size_t length,
+                                 unsigned int n_fields,
+                                 size_t base,
+                                 size_t* offsets,
+                                 unsigned long* lengths) {
+    const uint8_t* pos = packet;
+    const uint8_t* end = packet + length;
+    for (unsigned int i = 0; i < n_fields; ++i) {
+      uint64_t value_length;
+      bool null;
+      if (!read_length(&pos, end, &value_length, &null) ||
+          value_length > static_cast<uint64_t>(end - pos)) {
+        return arrow::Status::IOError("Malformed row packet: the value of field ", i,
+                                      " runs over the packet of ", length, " bytes");
+      }
+      if (null) {
+        offsets[i] = kNullValueOffset;
+        lengths[i] = 0;
+      } else {
+        offsets[i] = base + (pos - packet);
+        lengths[i] = static_cast<unsigned long>(value_length);
+        pos += value_length;
+      }
+    }
+    if (pos != end) {
+      return arrow::Status::IOError("Malformed row packet: ", end - pos,
+                                    " bytes after ", n_fields, " fields");
+    }
+    return arrow::Status::OK();
+  }
+
+  TerminatorPacket parse_terminator_packet(const uint8_t* packet,
+                                           size_t length,
+                                           bool deprecate_eof) {
+    TerminatorPacket terminator{false, 0, 0};
+    const uint8_t* pos = packet + 1;
+    const uint8_t* end = packet + length;
+    if (deprecate_eof) {
+      // OK packet: affected rows, last insert ID, status and warnings.
+      // The session state information after them is ignored.
+      uint64_t value;
+      bool null;
+      if (!read_length(&pos, end, &value, &null) ||
+          !read_length(&pos, end, &value, &null)) {
+        return terminator;
+      }
+    }
+    // EOF packet: warnings and status
+    if (end - pos >= 4) {
+      terminator.valid = true;
+      if (deprecate_eof) {
+        terminator.server_status = static_cast<unsigned int>(read_uint_le(pos, 2));
+        terminator.warning_count = static_cast<unsigned int>(read_uint_le(pos + 2, 2));
+      } else {
+        terminator.warning_count = static_cast<unsigned int>(read_uint_le(pos, 2));
+        terminator.server_status = static_cast<unsigned int>(read_uint_le(pos + 2, 2));
+      }
+    }
+    return terminator;
+  }
+
+  ErrorPacket parse_error_packet(const uint8_t* packet, size_t length) {
+    // ERR packet: error code, "#" and SQL state, and message
+    const char* pos = reinterpret_cast<const char*>(packet) + 1;
+    const char* end = reinterpret_cast<const char*>(packet) + length;
+    ErrorPacket error{0, "HY000", ""};
+    if (end - pos >= 2) {
+      error.error_code = static_cast<unsigned int>(read_uint_le(packet + 1, 2));
+      pos += 2;
+    }
+    if (end - pos >= 6 && *pos == '#') {
+      error.sqlstate.assign(pos + 1, 5);
+      pos += 6;
+    }
+    error.message.assign(pos, end);
+    return error;
+  }
+
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+  PacketReader::PacketReader(MYSQL_RES* result, FetchStats* stats)
+      : result_(result),
+        mysql_(result->handle),
+        num_fields_(mysql_num_fields(result)),
+        deprecate_eof_((mysql_->server_capabilities & CLIENT_DEPRECATE_EOF) != 0),
+        stats_(stats),
+        eof_(false) {}
+
+  bool PacketReader::available(MYSQL_RES* result) {
+    return result->handle &&
+      !result->data &&
+      !result->eof &&
+      result->handle->status == MYSQL_STATUS_USE_RESULT;
+  }
+
+  arrow::Status PacketReader::read(BatchBuilder* builder,
+                                   int64_t max_rows,
+                                   const std::atomic<bool>* interrupted,
+                                   int64_t* n_rows) {
+    int64_t n = 0;
+    while (!eof_ && !*interrupted &&
+           (max_rows < 0 || (n < max_rows && !builder->full()))) {
+      int64_t chunk_rows = kChunkRows;
+      if (max_rows >= 0) {
+        chunk_rows = std::min(chunk_rows, max_rows - n);
+      }
+      int64_t n_chunk_rows = 0;
+      auto status = read_chunk(chunk_rows, interrupted, &n_chunk_rows);
+      if (!status.ok()) {
+        *n_rows = n;
+        return status;
+      }
+      if (n_chunk_rows > 0) {
+        status = append_chunk(builder, n_chunk_rows);
+        if (!status.ok()) {
+          *n_rows = n;
+          return status;
+        }
+        n += n_chunk_rows;
+      }
+    }
+    *n_rows = n;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status PacketReader::read_chunk(int64_t max_rows,
+                                         const std::atomic<bool>* interrupted,
+                                         int64_t* n_rows) {
+    data_.clear();
+    int64_t n = 0;
+    while (n < max_rows && data_.size() < kChunkBytes && !*interrupted) {
+      const bool sampling = stats_ && stats_->sample_fetch();
+      const int64_t start = sampling ? monotonic_ns() : 0;
+      const unsigned long length = my_net_read(&mysql_->net);
+      if (sampling) {
+        stats_->sampled_fetch_ns += monotonic_ns() - start;
+        ++stats_->n_sampled_fetches;
+      }
+      // The connection is left to mysql_free_result, which reports the
+      // error again and closes it
+      if (length == packet_error) {
+        return arrow::Status::IOError("Lost connection to MySQL server while reading rows");
+      }
+      if (length == 0) {
+        return arrow::Status::IOError("Malformed row packet: empty");
+      }
+
+      const uint8_t* packet = mysql_->net.read_pos;
+      if (packet[0] == 0xff) {
+        return read_error(packet, length);
+      }
+      if (is_terminator(packet, length)) {
+        read_terminator(packet, length);
+        break;
+      }
+
+      const size_t offset = static_cast<size_t>(n) * num_fields_;
+      offsets_.resize(offset + num_fields_);
+      row_lengths_.resize(offset + num_fields_);
+      ARROW_RETURN_NOT_OK(split_row_packet(packet, length, num_fields_, data_.size(),
+                                           offsets_.data() + offset,
+                                           row_lengths_.data() + offset));
+      data_.append(reinterpret_cast<const char*>(packet), length);
+      ++n;
+    }
+    result_->row_count += n;
+    *n_rows = n;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status PacketReader::append_chunk(BatchBuilder* builder, int64_t n_rows) {
+    // data_ doesn't grow any more; transpose the values into the columns
+    const size_t n_values = static_cast<size_t>(n_rows) * num_fields_;
+    values_.resize(n_values);
+    lengths_.resize(n_values);
+    const char* data = data_.data();
+    for (int64_t i = 0; i < n_rows; ++i) {
+      const size_t row_offset = static_cast<size_t>(i) * num_fields_;
+      for (unsigned int j = 0; j < num_fields_; ++j) {
+        const size_t offset = offsets_[row_offset + j];
+        const size_t k = static_cast<size_t>(j) * n_rows + i;
+        values_[k] = offset == kNullValueOffset ? nullptr : data + offset;
+        lengths_[k] = row_lengths_[row_offset + j];
+      }
+    }
+    return builder->append_columns(values_.data(), lengths_.data(), n_rows);
+  }
+
+  bool PacketReader::is_terminator(const uint8_t* packet, unsigned long length) const {
+    // A row packet can start with 0xfe only for a value of 16MiB or longer
+    if (packet[0] != 0xfe) {
+      return false;
+    }
+    return deprecate_eof_ ? length < 0xffffff : length < 8;
+  }
+
+  void PacketReader::read_terminator(const uint8_t* packet, unsigned long length) {
+    const auto terminator = parse_terminator_packet(packet, length, deprecate_eof_);
+    if (terminator.valid) {
+      mysql_->warning_count = terminator.warning_count;
+      mysql_->server_status = terminator.server_status;
+    }
+    finish();
+  }
+
+  arrow::Status PacketReader::read_error(const uint8_t* packet, unsigned long length) {
+    const auto error = parse_error_packet(packet, length);
+
+    // The same as cli_safe_read does, so that mysql_error returns it
+    NET* net = &mysql_->net;
+    net->last_errno = error.error_code;
+    const size_t message_length = std::min(error.message.size(), sizeof(net->last_error) - 1);
+    std::memcpy(net->last_error, error.message.data(), message_length);
+    net->last_error[message_length] = '\0';
+    std::memcpy(net->sqlstate, error.sqlstate.data(), error.sqlstate.size());
+    net->sqlstate[error.sqlstate.size()] = '\0';
+    mysql_->server_status &= ~SERVER_MORE_RESULTS_EXISTS;
+    finish();
+    return arrow::Status::IOError(error.message);
+  }
+
+  // This is based on the end of the unbuffered fetch in mysql_fetch_row
+  void PacketReader::finish() {
+    eof_ = true;
+    result_->eof = true;
+    mysql_->status = MYSQL_STATUS_READY;
+    if (mysql_->unbuffered_fetch_owner == &result_->unbuffered_fetch_cancelled) {
+      mysql_->unbuffered_fetch_owner = nullptr;
+    }
+    // Don't flush the connection in mysql_free_result
+    result_->handle = nullptr;
+  }
+#endif
+}
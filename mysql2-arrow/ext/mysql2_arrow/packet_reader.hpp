@@ -0,0 +1,123 @@
+#pragma once
+
+#include <arrow/api.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mysql.hpp"
+#include "column_writer.hpp"
+#include "fetch_stats.hpp"
+
+// The packets are read by my_net_read of libmysqlclient, whose NET and
+// MYSQL_RES are not compatible with MariaDB Connector/C
+#if defined(HAVE_MY_NET_READ) && \
+    !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_PACKAGE_VERSION)
+#  define MYSQL2_ARROW_HAVE_PACKET_READER
+#endif
+
+namespace mysql2_arrow {
+  // The offset of a NULL value split by split_row_packet
+  constexpr size_t kNullValueOffset = static_cast<size_t>(-1);
+
+  // Split a row packet of the text protocol into the length-encoded values
+  // of n_fields fields. The offset of the i-th value is base plus its offset
+  // in the packet, or kNullValueOffset for NULL.
+  arrow::Status split_row_packet(const uint8_t* packet,
+                                 size_t length,
+                                 unsigned int n_fields,
+                                 size_t base,
+                                 size_t* offsets,
+                                 unsigned long* lengths);
+
+  // The fields of the packet at the end of the rows: an OK packet if
+  // the client and the server deprecate EOF, or an EOF packet otherwise.
+  // valid is false if the packet is too short for them.
+  struct TerminatorPacket {
+    bool valid;
+    unsigned int warning_count;
+    unsigned int server_status;
+  };
+
+  TerminatorPacket parse_terminator_packet(const uint8_t* packet,
+                                           size_t length,
+                                           bool deprecate_eof);
+
+  // The fields of an ERR packet; the SQL state is HY000 if it is missing
+  struct ErrorPacket {
+    unsigned int error_code;
+    std::string sqlstate;
+    std::string message;
+  };
+
+  ErrorPacket parse_error_packet(const uint8_t* packet, size_t length);
+
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+  // PacketReader reads the rows of a streaming result set of the text
+  // protocol by the packets of the connection instead of mysql_fetch_row,
+  // which builds a MYSQL_ROW and NUL-terminates each value for a row only
+  // to be scanned again.
+  //
+  // The packets are split into values while they are copied into a chunk,
+  // and the chunk is appended column by column into a BatchBuilder.
+  // At the end of the result set, the state of the connection is updated
+  // in the same way as mysql_fetch_row does, so that the next query and
+  // mysql_free_result work as usual.
+  //
+  // Nothing here needs the GVL.
+  class PacketReader {
+   public:
+    // The maximum number of the rows, and the bytes of the rows, of a chunk
+    static constexpr int64_t kChunkRows = 1024;
+    static constexpr size_t kChunkBytes = 4 * 1024 * 1024;
+
+    // The fetch time is sampled into stats if it isn't nullptr
+    PacketReader(MYSQL_RES* result, FetchStats* stats);
+
+    // Whether the rest of the rows of the result can be read by PacketReader:
+    // the result is of mysql_use_result and nothing else has used the
+    // connection since then
+    static bool available(MYSQL_RES* result);
+
+    // Read at most max_rows rows, fewer if builder becomes full, or all the
+    // remaining rows if max_rows is negative, and append them into builder.
+    // It stops after the current chunk when *interrupted becomes true.
+    arrow::Status read(BatchBuilder* builder,
+                       int64_t max_rows,
+                       const std::atomic<bool>* interrupted,
+                       int64_t* n_rows);
+
+    // Whether the end of the result set has been read
+    bool eof() const { return eof_; }
+
+   private:
+    arrow::Status read_chunk(int64_t max_rows,
+                             const std::atomic<bool>* interrupted,
+                             int64_t* n_rows);
+    arrow::Status append_chunk(BatchBuilder* builder, int64_t n_rows);
+    bool is_terminator(const uint8_t* packet, unsigned long length) const;
+    void read_terminator(const uint8_t* packet, unsigned long length);
+    arrow::Status read_error(const uint8_t* packet, unsigned long length);
+    void finish();
+
+    MYSQL_RES* result_;
+    MYSQL* mysql_;
+    const unsigned int num_fields_;
+    // Whether the result set ends with an OK packet instead of EOF
+    const bool deprecate_eof_;
+    FetchStats* stats_;
+    bool eof_;
+
+    // The copied packets of the chunk, and the offsets and the lengths of
+    // their values in the order of the rows
+    std::string data_;
+    std::vector<size_t> offsets_;
+    std::vector<unsigned long> row_lengths_;
+    // The values and their lengths in the order of the columns
+    std::vector<const char*> values_;
+    std::vector<unsigned long> lengths_;
+  };
+#endif
+}
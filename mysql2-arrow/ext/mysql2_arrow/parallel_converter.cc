@@ -0,0 +1,228 @@
+#include "parallel_converter.hpp"
+
+#include <system_error>
+
+namespace mysql2_arrow {
+  namespace {
+    constexpr size_t kNullOffset = static_cast<size_t>(-1);
+  }
+
+  ParallelConverter::ParallelConverter(MYSQL_RES* result,
+                                       bool copy_values,
+                                       int64_t chunk_rows,
+                                       std::vector<std::unique_ptr<BatchBuilder>> builders)
+      : result_(result),
+        num_fields_(mysql_num_fields(result)),
+        copy_values_(copy_values),
+        chunk_rows_(chunk_rows),
+        max_queued_chunks_(2 * builders.size()),
+        builders_(std::move(builders)),
+        n_chunks_(0),
+        eof_(false),
+        interrupted_(false),
+        closed_(false),
+        failed_(false) {}
+
+  ParallelConverter::~ParallelConverter() {
+    stop_workers();
+  }
+
+  arrow::Status ParallelConverter::start() {
+    try {
+      for (size_t i = 0; i < builders_.size(); ++i) {
+        workers_.emplace_back(&ParallelConverter::work, this, i);
+      }
+    } catch (const std::system_error& e) {
+      stop_workers();
+      return arrow::Status::UnknownError("Failed to start a worker thread: ", e.what());
+    }
+    return arrow::Status::OK();
+  }
+
+  arrow::Status ParallelConverter::fetch() {
+    try {
+      while (!interrupted_ && !failed_) {
+        if (chunk_ && (chunk_->n_rows == chunk_rows_ ||
+                       chunk_->n_bytes >= kMaxBatchDataLength)) {
+          if (!push_chunk()) {
+            break;
+          }
+          continue;
+        }
+        MYSQL_ROW row = mysql_fetch_row(result_);
+        if (row == nullptr) {
+          // The last chunk is pushed by finish
+          eof_ = true;
+          break;
+        }
+        append_row(row, mysql_fetch_lengths(result_));
+      }
+    } catch (const std::exception& e) {
+      return arrow::Status::UnknownError(e.what());
+    }
+    return arrow::Status::OK();
+  }
+
+  void ParallelConverter::interrupt() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      interrupted_ = true;
+    }
+    condition_.notify_all();
+  }
+
+  void ParallelConverter::clear_interrupt() {
+    interrupted_ = false;
+  }
+
+  arrow::Status
+  ParallelConverter::finish(std::vector<std::shared_ptr<arrow::RecordBatch>>* out) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (chunk_ && chunk_->n_rows > 0 && !failed_) {
+        resolve_values(chunk_.get());
+        batches_.resize(chunk_->index + 1);
+        queue_.push_back(std::move(chunk_));
+      }
+      closed_ = true;
+    }
+    condition_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+    workers_.clear();
+
+    if (!status_.ok()) {
+      return status_;
+    }
+    *out = std::move(batches_);
+    return arrow::Status::OK();
+  }
+
+  void ParallelConverter::append_row(MYSQL_ROW row, const unsigned long* lengths) {
+    if (!chunk_) {
+      chunk_.reset(new Chunk());
+      chunk_->index = n_chunks_++;
+      chunk_->n_rows = 0;
+      chunk_->n_bytes = 0;
+      const size_t n_values = static_cast<size_t>(chunk_rows_) * num_fields_;
+      if (copy_values_) {
+        chunk_->offsets.reserve(n_values);
+      } else {
+        chunk_->values.reserve(n_values);
+      }
+      chunk_->lengths.reserve(n_values);
+    }
+    for (unsigned int i = 0; i < num_fields_; ++i) {
+      if (copy_values_) {
+        if (row[i]) {
+          chunk_->offsets.push_back(chunk_->data.size());
+          chunk_->data.append(row[i], lengths[i]);
+        } else {
+          chunk_->offsets.push_back(kNullOffset);
+        }
+      } else {
+        chunk_->values.push_back(row[i]);
+      }
+      chunk_->lengths.push_back(lengths[i]);
+      chunk_->n_bytes += lengths[i];
+    }
+    ++chunk_->n_rows;
+  }
+
+  void ParallelConverter::resolve_values(Chunk* chunk) {
+    if (!copy_values_) {
+      return;
+    }
+    // data doesn't grow any more
+    chunk->values.assign(chunk->offsets.size(), nullptr);
+    for (size_t i = 0; i < chunk->offsets.size(); ++i) {
+      if (chunk->offsets[i] != kNullOffset) {
+        chunk->values[i] = chunk->data.data() + chunk->offsets[i];
+      }
+    }
+  }
+
+  bool ParallelConverter::push_chunk() {
+    resolve_values(chunk_.get());
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [&]{
+        return queue_.size() < max_queued_chunks_ || interrupted_ || failed_;
+      });
+      if (interrupted_ || failed_) {
+        // The chunk is kept to be pushed by the next fetch
+        return false;
+      }
+      batches_.resize(chunk_->index + 1);
+      queue_.push_back(std::move(chunk_));
+    }
+    condition_.notify_all();
+    return true;
+  }
+
+  void ParallelConverter::work(size_t i) {
+    BatchBuilder* builder = builders_[i].get();
+    while (true) {
+      std::unique_ptr<Chunk> chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [&]{ return failed_ || closed_ || !queue_.empty(); });
+        if (failed_ || queue_.empty()) {
+          return;
+        }
+        chunk = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      // The fetching thread may wait for the room in the queue
+      condition_.notify_all();
+
+      std::shared_ptr<arrow::RecordBatch> batch;
+      arrow::Status status;
+      try {
+        status = convert(builder, *chunk, &batch);
+      } catch (const std::exception& e) {
+        status = arrow::Status::UnknownError(e.what());
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (status.ok()) {
+          batches_[chunk->index] = std::move(batch);
+        } else if (!failed_) {
+          status_ = status;
+          failed_ = true;
+        }
+      }
+      if (!status.ok()) {
+        condition_.notify_all();
+      }
+    }
+  }
+
+  arrow::Status ParallelConverter::convert(BatchBuilder* builder,
+                                           const Chunk& chunk,
+                                           std::shared_ptr<arrow::RecordBatch>* out) {
+    ARROW_RETURN_NOT_OK(builder->reserve(chunk.n_rows));
+    for (int64_t i = 0; i < chunk.n_rows; ++i) {
+      const size_t offset = static_cast<size_t>(i) * num_fields_;
+      ARROW_RETURN_NOT_OK(
+        builder->append_row(const_cast<MYSQL_ROW>(chunk.values.data() + offset),
+                            chunk.lengths.data() + offset));
+    }
+    return builder->flush(out);
+  }
+
+  void ParallelConverter::stop_workers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed_ = true;
+      closed_ = true;
+    }
+    condition_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+    workers_.clear();
+  }
+}
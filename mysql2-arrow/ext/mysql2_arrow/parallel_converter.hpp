@@ -0,0 +1,105 @@
+#pragma once
+
+#include <arrow/api.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mysql.hpp"
+#include "column_writer.hpp"
+
+namespace mysql2_arrow {
+  // ParallelConverter converts the rows of a text protocol result set into
+  // record batches with a pipeline: the fetching thread pulls the raw values
+  // of the rows into chunks, and the worker threads parse the chunks
+  // column-wise into record batches, which are returned in the order of
+  // the rows.
+  //
+  // Nothing here needs the GVL; fetch and finish are expected to be called
+  // without it from the same thread.
+  class ParallelConverter {
+   public:
+    // Each worker appends the rows into its own builder.
+    // The values of a streaming result set are overwritten by the next
+    // mysql_fetch_row, so that they are copied if copy_values is true.
+    ParallelConverter(MYSQL_RES* result,
+                      bool copy_values,
+                      int64_t chunk_rows,
+                      std::vector<std::unique_ptr<BatchBuilder>> builders);
+    ~ParallelConverter();
+
+    // Start the workers
+    arrow::Status start();
+
+    // Fetch the rows into chunks until the end of the result set,
+    // an error in a worker, or interrupt is called
+    arrow::Status fetch();
+
+    // Stop fetch as soon as possible, e.g. on a pending interrupt of Ruby.
+    // It can be called from another thread.
+    void interrupt();
+
+    // Clear the interrupt before calling fetch again
+    void clear_interrupt();
+
+    // Whether mysql_fetch_row has reached the end of the result set
+    bool eof() const { return eof_; }
+
+    // Wait for the workers and return the batches in the order of the rows
+    arrow::Status finish(std::vector<std::shared_ptr<arrow::RecordBatch>>* out);
+
+   private:
+    struct Chunk {
+      int64_t index;
+      int64_t n_rows;
+      // The bytes of the values, which end the chunk at kMaxBatchDataLength
+      int64_t n_bytes;
+      // The values and their lengths of the rows, n_rows * the number of fields
+      std::vector<const char*> values;
+      std::vector<unsigned long> lengths;
+      // The copied values when copy_values is true, whose offsets are
+      // resolved into values when the chunk is complete
+      std::string data;
+      std::vector<size_t> offsets;
+    };
+
+    void append_row(MYSQL_ROW row, const unsigned long* lengths);
+    void resolve_values(Chunk* chunk);
+    bool push_chunk();
+    void work(size_t i);
+    arrow::Status convert(BatchBuilder* builder,
+                          const Chunk& chunk,
+                          std::shared_ptr<arrow::RecordBatch>* out);
+    void stop_workers();
+
+    MYSQL_RES* result_;
+    const unsigned int num_fields_;
+    const bool copy_values_;
+    const int64_t chunk_rows_;
+    // The maximum number of the chunks waiting for the workers,
+    // which bounds the memory of the raw values copied
+    const size_t max_queued_chunks_;
+    std::vector<std::unique_ptr<BatchBuilder>> builders_;
+    std::vector<std::thread> workers_;
+
+    // The chunk being filled by fetch
+    std::unique_ptr<Chunk> chunk_;
+    int64_t n_chunks_;
+    bool eof_;
+    std::atomic<bool> interrupted_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::unique_ptr<Chunk>> queue_;
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches_;
+    bool closed_;
+    std::atomic<bool> failed_;
+    arrow::Status status_;
+  };
+}
@@ -0,0 +1,515 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+namespace mysql2_arrow {
+  // Length-bounded parsers of the values in the text protocol.
+  //
+  // They do not depend on the locale nor on the NUL terminator, and return
+  // false for values with garbage or out of the range of the output type.
+  namespace parser {
+    namespace internal {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+      // Whether all the 8 bytes loaded in little endian are ASCII digits
+      inline bool is_eight_digits(uint64_t chunk) {
+        return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+                (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+          == 0x3333333333333333ULL;
+      }
+
+      // Convert the 8 ASCII digits loaded in little endian with SWAR
+      inline uint32_t parse_eight_digits(uint64_t chunk) {
+        chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+        chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+        return static_cast<uint32_t>(((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+      }
+#endif
+
+      // Parse the digits in [p, end) into an unsigned 64-bit integer
+      inline bool parse_digits(const char* p, const char* end, uint64_t* out) {
+        if (p == end) {
+          return false;
+        }
+        uint64_t value = 0;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        while (end - p >= 8) {
+          uint64_t chunk;
+          std::memcpy(&chunk, p, 8);
+          if (!is_eight_digits(chunk)) {
+            return false;
+          }
+          const uint32_t digits = parse_eight_digits(chunk);
+          if (value > (std::numeric_limits<uint64_t>::max() - digits) / 100000000ULL) {
+            return false;
+          }
+          value = value * 100000000ULL + digits;
+          p += 8;
+        }
+#endif
+        for (; p < end; ++p) {
+          const unsigned int digit = static_cast<unsigned char>(*p) - '0';
+          if (digit > 9) {
+            return false;
+          }
+          if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+            return false;
+          }
+          value = value * 10 + digit;
+        }
+        *out = value;
+        return true;
+      }
+
+      template <typename T>
+      struct FloatTraits;
+
+      // The exact fast path by Clinger: the mantissa and the power of 10 are
+      // both exactly representable, so that one multiplication or division
+      // gives the correctly rounded result.
+      template <>
+      struct FloatTraits<double> {
+        static constexpr uint64_t kMaxExactMantissa = 1ULL << 53;
+        static constexpr int kMaxExactPower = 22;
+        static double power_of_ten(int e) {
+          static const double powers[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+          };
+          return powers[e];
+        }
+        static double fallback(const char* s, char** end) { return std::strtod(s, end); }
+      };
+
+      template <>
+      struct FloatTraits<float> {
+        static constexpr uint64_t kMaxExactMantissa = 1ULL << 24;
+        static constexpr int kMaxExactPower = 10;
+        static float power_of_ten(int e) {
+          static const float powers[] = {
+            1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+          };
+          return powers[e];
+        }
+        static float fallback(const char* s, char** end) { return std::strtof(s, end); }
+      };
+    }
+
+    // Days since the UNIX epoch of the given proleptic Gregorian date
+    // (days_from_civil by Howard Hinnant)
+    inline int32_t days_from_civil(int year, unsigned int month, unsigned int day) {
+      year -= month <= 2;
+      const int era = (year >= 0 ? year : year - 399) / 400;
+      const unsigned int yoe = static_cast<unsigned int>(year - era * 400);   // [0, 399]
+      const unsigned int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;  // [0, 365]
+      const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;        // [0, 146096]
+      return era * 146097 + static_cast<int32_t>(doe) - 719468;
+    }
+
+    // The proleptic Gregorian date of the given days since the UNIX epoch
+    // (civil_from_days by Howard Hinnant), the inverse of days_from_civil
+    inline void civil_from_days(int64_t days, int64_t* year, unsigned int* month,
+                                unsigned int* day) {
+      days += 719468;
+      const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+      const unsigned int doe = static_cast<unsigned int>(days - era * 146097);        // [0, 146096]
+      const unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;  // [0, 399]
+      const unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);               // [0, 365]
+      const unsigned int mp = (5 * doy + 2) / 153;                                    // [0, 11]
+      *day = doy - (153 * mp + 2) / 5 + 1;
+      *month = mp < 10 ? mp + 3 : mp - 9;
+      *year = static_cast<int64_t>(yoe) + era * 400 + (*month <= 2);
+    }
+
+    namespace internal {
+      inline unsigned int digit(char c) {
+        return static_cast<unsigned char>(c) - '0';
+      }
+
+      // Read the fixed number of digits without branching on each of them;
+      // ok becomes false if any of them is not a digit.
+      inline unsigned int read_2digits(const char* p, bool& ok) {
+        const unsigned int d0 = digit(p[0]), d1 = digit(p[1]);
+        ok &= (d0 <= 9) & (d1 <= 9);
+        return d0 * 10 + d1;
+      }
+
+      inline unsigned int read_4digits(const char* p, bool& ok) {
+        return read_2digits(p, ok) * 100 + read_2digits(p + 2, ok);
+      }
+
+      // Read the optional fractional part ".f{1,6}" into microseconds
+      inline bool read_microsecond(const char* p, const char* end, unsigned int* out) {
+        static const unsigned int scales[] = {1000000, 100000, 10000, 1000, 100, 10, 1};
+        *out = 0;
+        if (p == end) {
+          return true;
+        }
+        if (*p != '.' || end - p < 2 || end - p > 7) {
+          return false;
+        }
+        ++p;
+        const int n_digits = static_cast<int>(end - p);
+        unsigned int value = 0;
+        for (; p < end; ++p) {
+          const unsigned int d = digit(*p);
+          if (d > 9) {
+            return false;
+          }
+          value = value * 10 + d;
+        }
+        *out = value * scales[n_digits];
+        return true;
+      }
+    }
+
+    struct DateTime {
+      unsigned int year;
+      unsigned int month;
+      unsigned int day;
+      unsigned int hour;
+      unsigned int minute;
+      unsigned int second;
+      unsigned int microsecond;
+    };
+
+    // The length of "YYYY-MM-DD"
+    constexpr unsigned long kDateLength = 10;
+
+    // Parse "YYYY-MM-DD"
+    inline bool parse_date(const char* value, unsigned long length, DateTime* out) {
+      if (length != kDateLength) {
+        return false;
+      }
+      bool ok = (value[4] == '-') & (value[7] == '-');
+      out->year = internal::read_4digits(value, ok);
+      out->month = internal::read_2digits(value + 5, ok);
+      out->day = internal::read_2digits(value + 8, ok);
+      return ok;
+    }
+
+    // Parse "HH:MM:SS[.ffffff]" following the date part "YYYY-MM-DD "
+    // of a DATETIME or TIMESTAMP value
+    inline bool parse_datetime_time(const char* value, unsigned long length, DateTime* out) {
+      if (length < 19) {
+        return false;
+      }
+      bool ok = (value[10] == ' ') & (value[13] == ':') & (value[16] == ':');
+      out->hour = internal::read_2digits(value + 11, ok);
+      out->minute = internal::read_2digits(value + 14, ok);
+      out->second = internal::read_2digits(value + 17, ok);
+      return ok && internal::read_microsecond(value + 19, value + length, &out->microsecond);
+    }
+
+    // Parse "YYYY-MM-DD HH:MM:SS[.ffffff]"
+    inline bool parse_datetime(const char* value, unsigned long length, DateTime* out) {
+      return length >= 19 &&
+        parse_date(value, kDateLength, out) &&
+        parse_datetime_time(value, length, out);
+    }
+
+    // Parse "[-]H{1,3}:MM:SS[.ffffff]" of a TIME value
+    // into the signed number of microseconds
+    inline bool parse_time(const char* value, unsigned long length, int64_t* out) {
+      const char* p = value;
+      const char* end = value + length;
+      const bool negative = p < end && *p == '-';
+      if (negative) {
+        ++p;
+      }
+      unsigned int hour = 0;
+      int n_hour_digits = 0;
+      for (; p < end && n_hour_digits < 3 && internal::digit(*p) <= 9; ++p, ++n_hour_digits) {
+        hour = hour * 10 + internal::digit(*p);
+      }
+      if (n_hour_digits == 0 || end - p < 6) {
+        return false;
+      }
+      bool ok = (p[0] == ':') & (p[3] == ':');
+      const unsigned int minute = internal::read_2digits(p + 1, ok);
+      const unsigned int second = internal::read_2digits(p + 4, ok);
+      unsigned int microsecond;
+      if (!ok || !internal::read_microsecond(p + 6, end, &microsecond)) {
+        return false;
+      }
+      const int64_t usec =
+        1000000LL * (3600LL * hour + 60LL * minute + second) + microsecond;
+      *out = negative ? -usec : usec;
+      return true;
+    }
+
+    // Parse a decimal integer of the given length into any integer type.
+    // Overflows and any character other than the leading sign and the
+    // digits are reported by returning false.
+    template <typename T>
+    inline bool parse_integer(const char* value, unsigned long length, T* out) {
+      static_assert(std::is_integral<T>::value, "T must be an integer type");
+      const char* p = value;
+      const char* end = value + length;
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+      }
+
+      uint64_t magnitude;
+      if (!internal::parse_digits(p, end, &magnitude)) {
+        return false;
+      }
+
+      if (negative) {
+        if (!std::is_signed<T>::value) {
+          if (magnitude != 0) {
+            return false;
+          }
+          *out = 0;
+          return true;
+        }
+        const uint64_t limit =
+          static_cast<uint64_t>(std::numeric_limits<T>::max()) + 1;
+        if (magnitude > limit) {
+          return false;
+        }
+        *out = static_cast<T>(0 - magnitude);
+      } else {
+        if (magnitude > static_cast<uint64_t>(std::numeric_limits<T>::max())) {
+          return false;
+        }
+        *out = static_cast<T>(magnitude);
+      }
+      return true;
+    }
+
+    // Parse a decimal floating point number of the given length.
+    //
+    // Numbers whose significand fits in the mantissa with a small exponent,
+    // which are most of the values MySQL sends, are converted exactly without
+    // strtod; the others fall back to strtod/strtof on a NUL-terminated copy.
+    template <typename T>
+    inline bool parse_floating(const char* value, unsigned long length, T* out) {
+      using Traits = internal::FloatTraits<T>;
+      const char* p = value;
+      const char* end = value + length;
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+      }
+
+      uint64_t mantissa = 0;
+      int n_digits = 0;
+      int exponent = 0;
+      bool any_digits = false;
+      for (; p < end && static_cast<unsigned int>(*p - '0') <= 9; ++p) {
+        any_digits = true;
+        if (mantissa == 0 && *p == '0') {
+          continue;
+        }
+        if (n_digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          ++n_digits;
+        } else {
+          ++exponent;
+          n_digits = 20;  // too many significant digits for the fast path
+        }
+      }
+      if (p < end && *p == '.') {
+        ++p;
+        for (; p < end && static_cast<unsigned int>(*p - '0') <= 9; ++p) {
+          any_digits = true;
+          if (mantissa == 0 && *p == '0') {
+            --exponent;
+            continue;
+          }
+          if (n_digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            ++n_digits;
+            --exponent;
+          } else {
+            n_digits = 20;
+          }
+        }
+      }
+      if (!any_digits) {
+        return false;
+      }
+      if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+          negative_exponent = *p == '-';
+          ++p;
+        }
+        // Only one sign is allowed, so the digits are parsed without
+        // parse_integer, which accepts another one
+        uint64_t explicit_exponent;
+        if (!internal::parse_digits(p, end, &explicit_exponent)) {
+          return false;
+        }
+        p = end;
+        // Such an exponent is out of the fast path and is left to strtod
+        constexpr uint64_t kMaxExponent = 100000;
+        if (explicit_exponent > kMaxExponent) {
+          explicit_exponent = kMaxExponent;
+        }
+        const int exponent_value = static_cast<int>(explicit_exponent);
+        exponent += negative_exponent ? -exponent_value : exponent_value;
+      }
+      if (p != end) {
+        return false;
+      }
+
+      if (n_digits <= 19 &&
+          mantissa <= Traits::kMaxExactMantissa &&
+          -Traits::kMaxExactPower <= exponent && exponent <= Traits::kMaxExactPower) {
+        T result = static_cast<T>(mantissa);
+        if (exponent < 0) {
+          result /= Traits::power_of_ten(-exponent);
+        } else {
+          result *= Traits::power_of_ten(exponent);
+        }
+        *out = negative ? -result : result;
+        return true;
+      }
+
+      const std::string copy(value, length);
+      char* copy_end = nullptr;
+      *out = Traits::fallback(copy.c_str(), &copy_end);
+      return copy_end == copy.c_str() + copy.size();
+    }
+
+    namespace internal {
+      constexpr uint32_t kPowersOfTen9[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+      };
+
+      // limbs = limbs * multiplier + addend on the little-endian 32-bit limbs;
+      // false on overflow
+      template <size_t N>
+      inline bool multiply_add(uint32_t (&limbs)[N], uint32_t multiplier, uint32_t addend) {
+        uint64_t carry = addend;
+        for (size_t i = 0; i < N; ++i) {
+          const uint64_t value = static_cast<uint64_t>(limbs[i]) * multiplier + carry;
+          limbs[i] = static_cast<uint32_t>(value);
+          carry = value >> 32;
+        }
+        return carry == 0;
+      }
+
+      // Accumulate the digits in [p, end) into limbs, 9 digits at a time
+      template <size_t N>
+      inline bool accumulate_digits(const char* p, const char* end, uint32_t (&limbs)[N]) {
+        while (p < end) {
+          const long n = std::min<long>(end - p, 9);
+          uint32_t chunk = 0;
+          for (long i = 0; i < n; ++i) {
+            chunk = chunk * 10 + static_cast<uint32_t>(p[i] - '0');
+          }
+          if (!multiply_add(limbs, kPowersOfTen9[n], chunk)) {
+            return false;
+          }
+          p += n;
+        }
+        return true;
+      }
+    }
+
+    // Parse a DECIMAL value "[-]D*[.D*]" with at most scale fractional
+    // digits into its unscaled integer, i.e. the value * 10^scale, as the
+    // two's complement little-endian 64-bit words of the N * 64-bit integer.
+    //
+    // MySQL formats a DECIMAL value with exactly its scale of fractional
+    // digits, so that the digits are accumulated as is: in a 64-bit integer
+    // for up to 18 digits, or in 32-bit limbs for the wider ones.
+    template <size_t N>
+    inline bool parse_decimal(const char* value, unsigned long length, int32_t scale,
+                              uint64_t (&words)[N]) {
+      const char* p = value;
+      const char* end = value + length;
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+      }
+
+      const char* integer_begin = p;
+      while (p < end && static_cast<unsigned int>(*p - '0') <= 9) {
+        ++p;
+      }
+      const char* integer_end = p;
+      const char* fraction_begin = p;
+      const char* fraction_end = p;
+      if (p < end && *p == '.') {
+        fraction_begin = ++p;
+        while (p < end && static_cast<unsigned int>(*p - '0') <= 9) {
+          ++p;
+        }
+        fraction_end = p;
+      }
+      const long n_integer_digits = integer_end - integer_begin;
+      const long n_fraction_digits = fraction_end - fraction_begin;
+      if (p != end || n_integer_digits + n_fraction_digits == 0 ||
+          n_fraction_digits > scale) {
+        return false;
+      }
+      // Leading zeros don't count for the width
+      while (integer_begin < integer_end && *integer_begin == '0') {
+        ++integer_begin;
+      }
+      long n_padding_digits = scale - n_fraction_digits;
+
+      for (size_t i = 0; i < N; ++i) {
+        words[i] = 0;
+      }
+      if ((integer_end - integer_begin) + n_fraction_digits + n_padding_digits <= 18) {
+        uint64_t unscaled = 0;
+        for (const char* q = integer_begin; q < integer_end; ++q) {
+          unscaled = unscaled * 10 + static_cast<uint64_t>(*q - '0');
+        }
+        for (const char* q = fraction_begin; q < fraction_end; ++q) {
+          unscaled = unscaled * 10 + static_cast<uint64_t>(*q - '0');
+        }
+        for (; n_padding_digits > 0; --n_padding_digits) {
+          unscaled *= 10;
+        }
+        words[0] = unscaled;
+      } else {
+        uint32_t limbs[2 * N] = {};
+        if (!internal::accumulate_digits(integer_begin, integer_end, limbs) ||
+            !internal::accumulate_digits(fraction_begin, fraction_end, limbs)) {
+          return false;
+        }
+        for (; n_padding_digits > 0; n_padding_digits -= 9) {
+          if (!internal::multiply_add(limbs,
+                                      internal::kPowersOfTen9[std::min<long>(n_padding_digits, 9)],
+                                      0)) {
+            return false;
+          }
+        }
+        for (size_t i = 0; i < N; ++i) {
+          words[i] = static_cast<uint64_t>(limbs[2 * i]) |
+            (static_cast<uint64_t>(limbs[2 * i + 1]) << 32);
+        }
+      }
+
+      // The magnitude must fit in the signed integer
+      if (words[N - 1] >> 63) {
+        return false;
+      }
+      if (negative) {
+        // Two's complement: invert and add one
+        bool carry = true;
+        for (size_t i = 0; i < N; ++i) {
+          words[i] = ~words[i] + (carry ? 1 : 0);
+          carry = carry && words[i] == 0;
+        }
+      }
+      return true;
+    }
+  }
+}
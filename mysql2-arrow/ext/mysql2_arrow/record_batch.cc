@@ -0,0 +1,556 @@
+#include <arrow/api.h>
+
+#include <arrow-glib/record-batch.hpp>
+
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mysql2_arrow.hpp"
+#include "parser.hpp"
+
+#include <rbgobject.h>
+
+namespace mysql2_arrow {
+  namespace {
+    ID intern_BigDecimal, intern_new, intern_get_column_data, intern_to_a;
+    VALUE cDate;
+    VALUE sym_as, sym_array, sym_hash;
+
+    // rb_time_timespec_new offsets for the local time and UTC
+    constexpr int kLocalTimeOffset = INT_MAX;
+    constexpr int kUTCOffset = INT_MAX - 1;
+
+    // ValueConverter converts the values of a column into Ruby objects
+    // like the ones mysql2 makes.
+    //
+    // A converter is chosen once for each column from the type of the
+    // array, so that the row loop does not need to dispatch on the type
+    // for each value.
+    // Ruby methods are called through rb::protect, so that exceptions
+    // unwind the converters as C++ exceptions.
+    class ValueConverter {
+     public:
+      explicit ValueConverter(const std::shared_ptr<arrow::Array>& array)
+          : array_(array),
+            has_nulls_(array->null_count() > 0) {}
+      virtual ~ValueConverter() = default;
+
+      VALUE convert(int64_t i) {
+        if (has_nulls_ && array_->IsNull(i)) {
+          return Qnil;
+        }
+        return convert_value(i);
+      }
+
+     protected:
+      virtual VALUE convert_value(int64_t i) = 0;
+
+      std::shared_ptr<arrow::Array> array_;
+      bool has_nulls_;
+    };
+
+    // column is the index of the column of the array in the record batch,
+    // or -1 for the arrays in a column
+    std::unique_ptr<ValueConverter> make_converter(VALUE rb_record_batch,
+                                                   int column,
+                                                   const std::shared_ptr<arrow::Array>& array,
+                                                   VALUE keep);
+
+    template <typename ArrayType>
+    class TypedValueConverter : public ValueConverter {
+     public:
+      explicit TypedValueConverter(const std::shared_ptr<arrow::Array>& array)
+          : ValueConverter(array),
+            typed_array_(static_cast<const ArrayType&>(*array)) {}
+
+     protected:
+      const ArrayType& typed_array_;
+    };
+
+    class NullConverter : public ValueConverter {
+     public:
+      using ValueConverter::ValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t) override { return Qnil; }
+    };
+
+    class BooleanConverter : public TypedValueConverter<arrow::BooleanArray> {
+     public:
+      using TypedValueConverter::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        return typed_array_.Value(i) ? Qtrue : Qfalse;
+      }
+    };
+
+    template <typename ArrowType>
+    class SignedIntegerConverter
+        : public TypedValueConverter<typename arrow::TypeTraits<ArrowType>::ArrayType> {
+     public:
+      using TypedValueConverter<typename arrow::TypeTraits<ArrowType>::ArrayType>::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        return LL2NUM(this->typed_array_.Value(i));
+      }
+    };
+
+    template <typename ArrowType>
+    class UnsignedIntegerConverter
+        : public TypedValueConverter<typename arrow::TypeTraits<ArrowType>::ArrayType> {
+     public:
+      using TypedValueConverter<typename arrow::TypeTraits<ArrowType>::ArrayType>::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        return ULL2NUM(this->typed_array_.Value(i));
+      }
+    };
+
+    template <typename ArrowType>
+    class FloatingConverter
+        : public TypedValueConverter<typename arrow::TypeTraits<ArrowType>::ArrayType> {
+     public:
+      using TypedValueConverter<typename arrow::TypeTraits<ArrowType>::ArrayType>::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        return DBL2NUM(this->typed_array_.Value(i));
+      }
+    };
+
+    template <typename ArrayType>
+    class DecimalConverter : public TypedValueConverter<ArrayType> {
+     public:
+      using TypedValueConverter<ArrayType>::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        const auto value = this->typed_array_.FormatValue(i);
+        VALUE str = rb_str_new(value.data(), value.size());
+        return rb::protect([&]{ return rb_funcall(rb_mKernel, intern_BigDecimal, 1, str); });
+      }
+    };
+
+    class TimestampConverter : public TypedValueConverter<arrow::TimestampArray> {
+     public:
+      explicit TimestampConverter(const std::shared_ptr<arrow::Array>& array)
+          : TypedValueConverter(array) {
+        const auto& type = static_cast<const arrow::TimestampType&>(*array->type());
+        switch (type.unit()) {
+          case arrow::TimeUnit::SECOND:
+            units_per_second_ = 1;
+            break;
+          case arrow::TimeUnit::MILLI:
+            units_per_second_ = 1000;
+            break;
+          case arrow::TimeUnit::MICRO:
+            units_per_second_ = 1000000;
+            break;
+          default:
+            units_per_second_ = 1000000000;
+            break;
+        }
+        // Time objects are in the application timezone, which the schema has
+        offset_ = type.timezone() == "UTC" ? kUTCOffset : kLocalTimeOffset;
+      }
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        const int64_t value = typed_array_.Value(i);
+        int64_t sec = value / units_per_second_;
+        int64_t sub = value % units_per_second_;
+        if (sub < 0) {
+          --sec;
+          sub += units_per_second_;
+        }
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(sec);
+        ts.tv_nsec = static_cast<long>(sub * (1000000000 / units_per_second_));
+        return rb_time_timespec_new(&ts, offset_);
+      }
+
+     private:
+      int64_t units_per_second_;
+      int offset_;
+    };
+
+    // DECIMAL values narrowed into int64 by decimal_as: :int64_scaled,
+    // whose scale is in the metadata of the field
+    class ScaledDecimalConverter : public TypedValueConverter<arrow::Int64Array> {
+     public:
+      ScaledDecimalConverter(const std::shared_ptr<arrow::Array>& array, int scale)
+          : TypedValueConverter(array),
+            scale_(scale) {}
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        const int64_t value = typed_array_.Value(i);
+        uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+        // The digits from the end, with the decimal point after scale_ of them
+        char buffer[48];
+        char* end = buffer + sizeof(buffer);
+        char* p = end;
+        int n_digits = 0;
+        do {
+          if (n_digits == scale_ && n_digits > 0) {
+            *--p = '.';
+          }
+          *--p = static_cast<char>('0' + magnitude % 10);
+          magnitude /= 10;
+          ++n_digits;
+        } while (magnitude > 0 || n_digits <= scale_);
+        if (value < 0) {
+          *--p = '-';
+        }
+        VALUE str = rb_str_new(p, end - p);
+        return rb::protect([&]{ return rb_funcall(rb_mKernel, intern_BigDecimal, 1, str); });
+      }
+
+     private:
+      int scale_;
+    };
+
+    // Date.new of the civil date like mysql2, which is a date of the
+    // Julian calendar before 1582-10-15 unlike Date.jd of the day
+    class DateConverter : public TypedValueConverter<arrow::Date32Array> {
+     public:
+      using TypedValueConverter::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        int64_t year;
+        unsigned int month, day;
+        parser::civil_from_days(typed_array_.Value(i), &year, &month, &day);
+        return rb::protect([&]{
+          return rb_funcall(cDate, intern_new, 3,
+                            LL2NUM(year), UINT2NUM(month), UINT2NUM(day));
+        });
+      }
+    };
+
+    // StringArray or LargeStringArray
+    template <typename ArrayType>
+    class StringConverter : public TypedValueConverter<ArrayType> {
+     public:
+      using TypedValueConverter<ArrayType>::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        const auto value = this->typed_array_.GetView(i);
+        return rb_utf8_str_new(value.data(), value.size());
+      }
+    };
+
+    // BinaryArray or LargeBinaryArray
+    template <typename ArrayType>
+    class BinaryConverter : public TypedValueConverter<ArrayType> {
+     public:
+      using TypedValueConverter<ArrayType>::TypedValueConverter;
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        const auto value = this->typed_array_.GetView(i);
+        return rb_str_new(value.data(), value.size());
+      }
+    };
+
+    // The values of the dictionary are converted once,
+    // and each value is a copy of them
+    template <typename IndexType>
+    class DictionaryConverter : public ValueConverter {
+     public:
+      DictionaryConverter(const std::shared_ptr<arrow::Array>& array, VALUE values)
+          : ValueConverter(array),
+            indices_(static_cast<const typename arrow::TypeTraits<IndexType>::ArrayType&>(
+                *static_cast<const arrow::DictionaryArray&>(*array).indices())),
+            values_(values) {}
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        VALUE value = RARRAY_AREF(values_, indices_.Value(i));
+        return RB_TYPE_P(value, T_STRING) ? rb_str_dup(value) : value;
+      }
+
+     private:
+      const typename arrow::TypeTraits<IndexType>::ArrayType& indices_;
+      VALUE values_;
+    };
+
+    // SET values as the comma separated members like mysql2
+    class SetConverter : public TypedValueConverter<arrow::ListArray> {
+     public:
+      SetConverter(const std::shared_ptr<arrow::Array>& array,
+                   std::unique_ptr<ValueConverter> member_converter)
+          : TypedValueConverter(array),
+            member_converter_(std::move(member_converter)) {}
+
+     protected:
+      VALUE convert_value(int64_t i) override {
+        VALUE str = rb_utf8_str_new(nullptr, 0);
+        const int32_t begin = typed_array_.value_offset(i);
+        const int32_t end = typed_array_.value_offset(i + 1);
+        for (int32_t j = begin; j < end; ++j) {
+          if (j > begin) {
+            rb_str_cat(str, ",", 1);
+          }
+          rb_str_buf_append(str, member_converter_->convert(j));
+        }
+        return str;
+      }
+
+     private:
+      std::unique_ptr<ValueConverter> member_converter_;
+    };
+
+    // Columns of the other types are converted by Red Arrow at once
+    class FallbackConverter : public ValueConverter {
+     public:
+      FallbackConverter(const std::shared_ptr<arrow::Array>& array, VALUE values)
+          : ValueConverter(array),
+            values_(values) {}
+
+     protected:
+      VALUE convert_value(int64_t i) override { return RARRAY_AREF(values_, i); }
+
+     private:
+      VALUE values_;
+    };
+
+    // The scale of the column of decimal_as: :int64_scaled
+    bool scaled_decimal_scale(VALUE rb_record_batch, int column, int* scale) {
+      auto record_batch = garrow_record_batch_get_raw(
+          reinterpret_cast<GArrowRecordBatch*>(RVAL2GOBJ(rb_record_batch)));
+      const auto& metadata = record_batch->schema()->field(column)->metadata();
+      if (!metadata) {
+        return false;
+      }
+      const int index = metadata->FindKey("mysql2_arrow:scale");
+      if (index < 0) {
+        return false;
+      }
+      *scale = std::atoi(metadata->value(index).c_str());
+      return 0 <= *scale && *scale <= 30;
+    }
+
+    // Convert all the values of the array, a part of a column such as the
+    // dictionary, into a Ruby array kept alive by keep
+    VALUE convert_all(VALUE rb_record_batch,
+                      int column,
+                      const std::shared_ptr<arrow::Array>& array,
+                      VALUE keep) {
+      auto converter = make_converter(rb_record_batch, -1, array, keep);
+      VALUE values = rb_ary_new_capa(array->length());
+      rb_ary_push(keep, values);
+      for (int64_t i = 0; i < array->length(); ++i) {
+        rb_ary_push(values, converter->convert(i));
+      }
+      return values;
+    }
+
+    std::unique_ptr<ValueConverter> make_converter(VALUE rb_record_batch,
+                                                   int column,
+                                                   const std::shared_ptr<arrow::Array>& array,
+                                                   VALUE keep) {
+      switch (array->type_id()) {
+        case arrow::Type::NA:
+          return std::unique_ptr<ValueConverter>(new NullConverter(array));
+        case arrow::Type::BOOL:
+          return std::unique_ptr<ValueConverter>(new BooleanConverter(array));
+        case arrow::Type::INT8:
+          return std::unique_ptr<ValueConverter>(new SignedIntegerConverter<arrow::Int8Type>(array));
+        case arrow::Type::INT16:
+          return std::unique_ptr<ValueConverter>(new SignedIntegerConverter<arrow::Int16Type>(array));
+        case arrow::Type::INT32:
+          return std::unique_ptr<ValueConverter>(new SignedIntegerConverter<arrow::Int32Type>(array));
+        case arrow::Type::INT64:
+          if (column >= 0) {
+            int scale;
+            if (scaled_decimal_scale(rb_record_batch, column, &scale)) {
+              return std::unique_ptr<ValueConverter>(new ScaledDecimalConverter(array, scale));
+            }
+          }
+          return std::unique_ptr<ValueConverter>(new SignedIntegerConverter<arrow::Int64Type>(array));
+        case arrow::Type::UINT8:
+          return std::unique_ptr<ValueConverter>(new UnsignedIntegerConverter<arrow::UInt8Type>(array));
+        case arrow::Type::UINT16:
+          return std::unique_ptr<ValueConverter>(new UnsignedIntegerConverter<arrow::UInt16Type>(array));
+        case arrow::Type::UINT32:
+          return std::unique_ptr<ValueConverter>(new UnsignedIntegerConverter<arrow::UInt32Type>(array));
+        case arrow::Type::UINT64:
+          return std::unique_ptr<ValueConverter>(new UnsignedIntegerConverter<arrow::UInt64Type>(array));
+        case arrow::Type::FLOAT:
+          return std::unique_ptr<ValueConverter>(new FloatingConverter<arrow::FloatType>(array));
+        case arrow::Type::DOUBLE:
+          return std::unique_ptr<ValueConverter>(new FloatingConverter<arrow::DoubleType>(array));
+        case arrow::Type::DECIMAL:
+          return std::unique_ptr<ValueConverter>(new DecimalConverter<arrow::Decimal128Array>(array));
+#if ARROW_VERSION_MAJOR >= 3
+        case arrow::Type::DECIMAL256:
+          return std::unique_ptr<ValueConverter>(new DecimalConverter<arrow::Decimal256Array>(array));
+#endif
+        case arrow::Type::TIMESTAMP:
+          return std::unique_ptr<ValueConverter>(new TimestampConverter(array));
+        case arrow::Type::DATE32:
+          return std::unique_ptr<ValueConverter>(new DateConverter(array));
+        case arrow::Type::STRING:
+          return std::unique_ptr<ValueConverter>(new StringConverter<arrow::StringArray>(array));
+        case arrow::Type::LARGE_STRING:
+          return std::unique_ptr<ValueConverter>(
+              new StringConverter<arrow::LargeStringArray>(array));
+        case arrow::Type::BINARY:
+          return std::unique_ptr<ValueConverter>(new BinaryConverter<arrow::BinaryArray>(array));
+        case arrow::Type::LARGE_BINARY:
+          return std::unique_ptr<ValueConverter>(
+              new BinaryConverter<arrow::LargeBinaryArray>(array));
+        case arrow::Type::DICTIONARY:
+          {
+            const auto& dictionary_array = static_cast<const arrow::DictionaryArray&>(*array);
+            VALUE values = convert_all(rb_record_batch, column,
+                                       dictionary_array.dictionary(), keep);
+            switch (dictionary_array.indices()->type_id()) {
+              case arrow::Type::INT8:
+                return std::unique_ptr<ValueConverter>(
+                    new DictionaryConverter<arrow::Int8Type>(array, values));
+              case arrow::Type::INT16:
+                return std::unique_ptr<ValueConverter>(
+                    new DictionaryConverter<arrow::Int16Type>(array, values));
+              case arrow::Type::INT32:
+                return std::unique_ptr<ValueConverter>(
+                    new DictionaryConverter<arrow::Int32Type>(array, values));
+              case arrow::Type::INT64:
+                return std::unique_ptr<ValueConverter>(
+                    new DictionaryConverter<arrow::Int64Type>(array, values));
+              default:
+                break;
+            }
+          }
+          break;
+        case arrow::Type::LIST:
+          {
+            const auto& list_array = static_cast<const arrow::ListArray&>(*array);
+            const auto value_type_id = list_array.value_type()->id();
+            if (value_type_id == arrow::Type::DICTIONARY ||
+                value_type_id == arrow::Type::STRING) {
+              auto member_converter = make_converter(rb_record_batch, -1,
+                                                     list_array.values(), keep);
+              return std::unique_ptr<ValueConverter>(
+                  new SetConverter(array, std::move(member_converter)));
+            }
+          }
+          break;
+        default:
+          break;
+      }
+
+      // Only the whole columns can be converted by Red Arrow
+      if (column < 0) {
+        const auto type = array->type()->ToString();
+        rb::protect([&]{
+          rb_raise(rb_eNotImpError, "Unsupported type in a column: %s", type.c_str());
+          return Qnil;
+        });
+      }
+
+      VALUE values = rb::protect([&]{
+        VALUE rb_array = rb_funcall(rb_record_batch, intern_get_column_data, 1, INT2NUM(column));
+        return rb_funcall(rb_array, intern_to_a, 0);
+      });
+      rb_ary_push(keep, values);
+      return std::unique_ptr<ValueConverter>(new FallbackConverter(array, values));
+    }
+
+    VALUE record_batch_to_rows_impl(int argc, VALUE* argv, VALUE self) {
+      VALUE opts;
+      rb_scan_args(argc, argv, "0:", &opts);
+      bool as_hash = false;
+      if (!NIL_P(opts)) {
+        VALUE as = rb_hash_aref(opts, sym_as);
+        if (as == sym_hash) {
+          as_hash = true;
+        } else if (!NIL_P(as) && as != sym_array) {
+          rb_raise(rb_eArgError, ":as must be :array or :hash");
+        }
+      }
+
+      auto record_batch = garrow_record_batch_get_raw(
+          reinterpret_cast<GArrowRecordBatch*>(RVAL2GOBJ(self)));
+      const int n_columns = record_batch->num_columns();
+      const int64_t n_rows = record_batch->num_rows();
+
+      // Ruby objects referred only by the converters
+      VALUE keep = rb_ary_new();
+
+      std::vector<std::unique_ptr<ValueConverter>> converters;
+      converters.reserve(n_columns);
+      for (int i = 0; i < n_columns; ++i) {
+        converters.push_back(make_converter(self, i, record_batch->column(i), keep));
+      }
+
+      // The keys shared by all the hashes
+      VALUE keys = rb_ary_new_capa(n_columns);
+      if (as_hash) {
+        for (int i = 0; i < n_columns; ++i) {
+          const auto& name = record_batch->schema()->field(i)->name();
+          rb_ary_push(keys, rb_obj_freeze(rb_utf8_str_new(name.data(), name.size())));
+        }
+      }
+
+      VALUE rows = rb_ary_new_capa(n_rows);
+      for (int64_t r = 0; r < n_rows; ++r) {
+        VALUE row;
+        if (as_hash) {
+          row = rb_hash_new();
+          rb_ary_push(rows, row);
+          for (int i = 0; i < n_columns; ++i) {
+            rb_hash_aset(row, RARRAY_AREF(keys, i), converters[i]->convert(r));
+          }
+          rb_obj_freeze(row);
+        } else {
+          row = rb_ary_new_capa(n_columns);
+          rb_ary_push(rows, row);
+          for (int i = 0; i < n_columns; ++i) {
+            rb_ary_push(row, converters[i]->convert(r));
+          }
+        }
+      }
+
+      RB_GC_GUARD(keep);
+      RB_GC_GUARD(keys);
+      return rows;
+    }
+
+    VALUE record_batch_to_rows(int argc, VALUE* argv, VALUE self) {
+      try {
+        return record_batch_to_rows_impl(argc, argv, self);
+      } catch (rb::State& state) {
+        state.jump();
+      }
+    }
+  }
+
+  void init_record_batch_extension() {
+    VALUE mRecordBatchExtension =
+      rb_define_module_under(mMysql2Arrow, "RecordBatchExtension");
+
+    rb_define_method(mRecordBatchExtension, "to_rows",
+                     reinterpret_cast<rb::RawMethod>(record_batch_to_rows), -1);
+
+    intern_BigDecimal       = rb_intern("BigDecimal");
+    intern_new              = rb_intern("new");
+    intern_get_column_data  = rb_intern("get_column_data");
+    intern_to_a             = rb_intern("to_a");
+
+    sym_as    = ID2SYM(rb_intern("as"));
+    sym_array = ID2SYM(rb_intern("array"));
+    sym_hash  = ID2SYM(rb_intern("hash"));
+
+    cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+  }
+}
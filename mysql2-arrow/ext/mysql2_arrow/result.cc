@@ -1,28 +1,51 @@
 #include <arrow/api.h>
-#include <arrow/util/decimal.h>
-#include <arrow/vendored/datetime.h>
 
 #include <arrow-glib/record-batch.hpp>
+#include <arrow-glib/table.hpp>
 
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
 
 #include "mysql2_arrow.hpp"
+#include "column_writer.hpp"
+#include "memory_pool.hpp"
+#include "batch_writer.hpp"
+#include "parallel_converter.hpp"
+#include "packet_reader.hpp"
 
 #include <mysql2/mysql_enc_to_ruby.h>
 
+#include <ruby/io.h>
 #include <ruby/thread.h>
 
 #include <rbgobject.h>
 
 namespace mysql2_arrow {
   namespace {
-    rb_encoding *binaryEncoding;
-
-    ID intern_utc, intern_local, intern_merge;
+    ID intern_utc, intern_local, intern_merge, intern_arrow_canceled;
     VALUE sym_symbolize_keys, sym_as, sym_array, sym_cast_booleans,
           sym_cache_rows, sym_cast, sym_database_timezone, sym_application_timezone, sym_local,
-          sym_utc;
+          sym_utc, sym_rows, sym_dictionary_columns, sym_memory_pool, sym_memory_limit,
+          sym_backend, sym_bytes_allocated, sym_peak_bytes, sym_total_bytes_allocated,
+          sym_workers, sym_format, sym_batch_size, sym_compression,
+          sym_decimal_as, sym_int64_scaled, sym_float64, sym_nonblocking,
+          sym_packet_reader, sym_stats, sym_batches, sym_bytes, sym_total_ns, sym_fetch_ns, sym_parse_ns,
+          sym_reserve_ns, sym_flush_ns, sym_sampled_rows, sym_columns, sym_name,
+          sym_null_count;
+
+    VALUE eCanceled;
+
+    // The number of rows in a batch yielded by each_record_batch by default
+    constexpr int64_t kDefaultBatchRows = 65536;
+
+    // The initial length of a string buffer bound to a prepared statement
+    // when the maximum length of the values is unknown
+    constexpr unsigned long kInitialStmtBufferLength = 1024;
 
     // this is copied from mysql2/result.c
     // this may be called manually or during
@@ -70,16 +93,38 @@ namespace mysql2_arrow {
       }
     }
 
-    void *nogvl_fetch_row(void *ptr) {
-      MYSQL_RES *result = reinterpret_cast<MYSQL_RES*>(ptr);
-      return mysql_fetch_row(result);
-    }
+    // An error of a method, which is raised as a Ruby exception only after
+    // the C++ objects of the method are destroyed: rb_raise longjmps over
+    // their destructors
+    class Error {
+     public:
+      Error(VALUE klass, std::string message)
+          : klass_(klass),
+            message_(std::move(message)) {}
 
-    void *nogvl_stmt_fetch(void *ptr) {
-      MYSQL_STMT *stmt = reinterpret_cast<MYSQL_STMT*>(ptr);
-      uintptr_t r = mysql_stmt_fetch(stmt);
+      VALUE exception() const {
+        return rb_exc_new(klass_, message_.data(), static_cast<long>(message_.size()));
+      }
+
+     private:
+      VALUE klass_;
+      std::string message_;
+    };
 
-      return (void *)r;
+    [[noreturn]] void throw_error(VALUE klass, std::string message) {
+      throw Error(klass, std::move(message));
+    }
+
+    void check_status(const arrow::Status& status) {
+      if (status.ok()) {
+        return;
+      }
+      // Invalid is used for malformed values found in the result set,
+      // and IOError for errors reported by the MySQL client library
+      if (status.IsInvalid() || status.IsIOError()) {
+        throw_error(eMysql2Error, status.message());
+      }
+      throw_error(rb_eRuntimeError, status.message());
     }
 
     struct Timezone {
@@ -90,14 +135,53 @@ namespace mysql2_arrow {
       };
     };
 
+    struct DecimalAs {
+      enum type {
+        decimal,
+        int64_scaled,
+        float64
+      };
+    };
+
+    struct Charset {
+      enum type {
+        binary,
+        utf8,
+        latin1
+      };
+    };
+
     class ResultWrapper {
      public:
-      ResultWrapper(mysql2_result_wrapper* wrapper)
-          : result_(wrapper->result),
+      ResultWrapper(VALUE self, mysql2_result_wrapper* wrapper)
+          : self_(self),
+            wrapper_(wrapper),
+            stmt_(wrapper->stmt_wrapper ? wrapper->stmt_wrapper->stmt : nullptr),
+            result_(wrapper->result),
             num_fields_(mysql_num_fields(result_)),
             fields_(mysql_fetch_fields(result_)),
-            default_internal_enc_(rb_default_internal_encoding()),
-            conn_enc(rb_to_encoding(wrapper->encoding)) {}
+            conn_enc(rb_to_encoding(wrapper->encoding)),
+            eof_(false),
+            canceled_(false),
+            fetched_(false),
+            discarding_(false),
+            interrupted_(false) {
+        resolve_field_charsets();
+      }
+
+      // A streaming result whose conversion has stopped by an exception,
+      // e.g. in the block of each_record_batch or by Thread#raise, is freed,
+      // which reads the rest of the rows, so that the connection can run
+      // the next query
+      ~ResultWrapper() {
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+        packet_reader_.reset();
+#endif
+        if (fetched_ && wrapper_->is_streaming && !wrapper_->streamingComplete) {
+          rb_mysql_result_free_result(wrapper_);
+          wrapper_->streamingComplete = 1;
+        }
+      }
 
       bool symbolizeKeys;
       bool asArray;
@@ -105,6 +189,21 @@ namespace mysql2_arrow {
       bool cast;
       Timezone::type dbTimezone;
       Timezone::type appTimezone;
+      DecimalAs::type decimalAs;
+      // Whether to fetch the rows of a streaming result without blocking
+      bool nonblocking;
+      // Whether to read the rows of a streaming result by PacketReader
+      bool packetReader;
+      // Names of the string columns to be dictionary-encoded
+      std::unordered_set<std::string> dictionaryColumns;
+
+      // Collect the statistics of the conversion from now
+      void enable_stats() {
+        stats_.reset(new FetchStats(num_fields()));
+      }
+
+      // The statistics of the conversion, or nullptr if they are not collected
+      FetchStats* stats() const { return stats_.get(); }
 
       unsigned int num_fields() const { return num_fields_; }
 
@@ -119,277 +218,631 @@ namespace mysql2_arrow {
         return schema_;
       }
 
-      unsigned int usec_char_to_uint(char* msec_char, size_t len)
-      {
-        for (size_t i = 0; i < (len - 1); ++i) {
-          if (msec_char[i] == '\0') {
-            msec_char[i] = '0';
+      // Allocate the result buffers of the prepared statement in the same
+      // way as mysql2 does, and bind them to the statement.
+      // This is based on rb_mysql_result_alloc_result_buffers in mysql2/result.c
+      void bind_result_buffers() {
+        if (!stmt_) {
+          return;
+        }
+
+        if (wrapper_->result_buffers == NULL) {
+          wrapper_->numberOfFields = num_fields();
+          wrapper_->result_buffers = static_cast<MYSQL_BIND*>(
+              xcalloc(num_fields(), sizeof(MYSQL_BIND)));
+          wrapper_->is_null = static_cast<decltype(wrapper_->is_null)>(
+              xcalloc(num_fields(), sizeof(*wrapper_->is_null)));
+          wrapper_->error = static_cast<decltype(wrapper_->error)>(
+              xcalloc(num_fields(), sizeof(*wrapper_->error)));
+          wrapper_->length = static_cast<unsigned long*>(
+              xcalloc(num_fields(), sizeof(unsigned long)));
+
+          for (unsigned int i = 0; i < num_fields(); ++i) {
+            MYSQL_BIND& bind = wrapper_->result_buffers[i];
+            bind.buffer_type = field(i).type;
+
+            //      mysql type    |            C type
+            switch (field(i).type) {
+              case MYSQL_TYPE_NULL:         // NULL
+                break;
+              case MYSQL_TYPE_TINY:         // signed char
+                bind.buffer_length = sizeof(signed char);
+                break;
+              case MYSQL_TYPE_SHORT:        // short int
+              case MYSQL_TYPE_YEAR:         // short int
+                bind.buffer_length = sizeof(short int);
+                break;
+              case MYSQL_TYPE_INT24:        // int
+              case MYSQL_TYPE_LONG:         // int
+                bind.buffer_length = sizeof(int);
+                break;
+              case MYSQL_TYPE_LONGLONG:     // long long int
+                bind.buffer_length = sizeof(long long int);
+                break;
+              case MYSQL_TYPE_FLOAT:        // float
+                bind.buffer_length = sizeof(float);
+                break;
+              case MYSQL_TYPE_DOUBLE:       // double
+                bind.buffer_length = sizeof(double);
+                break;
+              case MYSQL_TYPE_TIME:         // MYSQL_TIME
+              case MYSQL_TYPE_DATE:         // MYSQL_TIME
+              case MYSQL_TYPE_NEWDATE:      // MYSQL_TIME
+              case MYSQL_TYPE_DATETIME:     // MYSQL_TIME
+              case MYSQL_TYPE_TIMESTAMP:    // MYSQL_TIME
+                bind.buffer_length = sizeof(MYSQL_TIME);
+                break;
+              default:                      // char[]
+                // max_length is not available while streaming;
+                // longer values are handled in fetch_truncated_columns
+                bind.buffer_length = field(i).max_length > 0
+                  ? field(i).max_length
+                  : std::min<unsigned long>(field(i).length, kInitialStmtBufferLength);
+                break;
+            }
+            if (bind.buffer_length > 0) {
+              bind.buffer = xcalloc(1, bind.buffer_length);
+            }
+
+            bind.is_null = &wrapper_->is_null[i];
+            bind.length  = &wrapper_->length[i];
+            bind.error   = &wrapper_->error[i];
+            bind.is_unsigned = ((field(i).flags & UNSIGNED_FLAG) != 0);
           }
         }
-        return (unsigned int)std::strtoul(msec_char, NULL, 10);
+
+        if (mysql_stmt_bind_result(stmt_, wrapper_->result_buffers)) {
+          throw_error(eMysql2Error, mysql_stmt_error(stmt_));
+        }
       }
 
-      bool fetch_row(std::unique_ptr<arrow::RecordBatchBuilder>& rbb) {
-        MYSQL_ROW row = (MYSQL_ROW)rb_thread_call_without_gvl(
-            (void* (*)(void*))nogvl_fetch_row, result_, RUBY_UBF_IO, 0);
-        if (row == nullptr) {
-          return false;
+      // Rewind the buffered result set so that it can be converted again
+      void rewind() {
+        if (stmt_) {
+          mysql_stmt_data_seek(stmt_, 0);
+        } else {
+          mysql_data_seek(result_, 0);
         }
+      }
 
-        unsigned long* field_lengths = mysql_fetch_lengths(result_);
+      // Fetch at most max_rows rows, fewer if the data of the batch reaches
+      // kMaxBatchDataLength, or all the remaining rows if max_rows is
+      // negative, and append them into builder.
+      // The whole loop runs without the GVL; errors found in the values are
+      // returned as a status and should be raised after the GVL is reacquired.
+      arrow::Status fetch_rows(BatchBuilder* builder,
+                               int64_t max_rows = -1,
+                               int64_t* n_rows = nullptr) {
+        fetched_ = true;
+#ifdef HAVE_MYSQL_FETCH_ROW_NONBLOCKING
+        if (nonblocking && wrapper_->is_streaming && !stmt_) {
+          return fetch_rows_nonblocking(builder, max_rows, n_rows);
+        }
+#endif
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+        if (packetReader && !packet_reader_ && !eof_ && PacketReader::available(result_)) {
+          packet_reader_.reset(new PacketReader(result_, stats_.get()));
+        }
+#endif
+        FetchRowsArgs args{this, builder, max_rows, 0, arrow::Status::OK()};
+        do {
+          interrupted_ = false;
+          rb_thread_call_without_gvl(nogvl_fetch_rows, &args, ubf_fetch_rows, this);
+          if (interrupted_) {
+            // Raise the pending interrupt, e.g. Thread#raise or Thread#kill,
+            // as rb::State so that the builders are destroyed
+            rb::protect([&]{
+              rb_thread_check_ints();
+              return Qnil;
+            });
+          }
+        } while (interrupted_ && args.status.ok() && !eof_ &&
+                 (max_rows < 0 || args.n_rows < max_rows));
+        if (n_rows) {
+          *n_rows = args.n_rows;
+        }
+        return args.status;
+      }
 
-        for (unsigned int i = 0; i < num_fields(); ++i) {
-          const enum enum_field_types field_type = field(i).type;
-          const unsigned int flags = field(i).flags;
-          const bool is_unsigned = 0 != (flags & UNSIGNED_FLAG);
+      // Whether mysql_fetch_row has reached the end of the result set
+      bool eof() const { return eof_; }
+
+      // Whether the conversion has stopped by cancel_arrow
+      bool canceled() const { return canceled_; }
+
+      // Fetch all the remaining rows into batches of at most batch_rows rows
+      arrow::Status fetch_batches(arrow::MemoryPool* pool,
+                                  int64_t batch_rows,
+                                  std::vector<std::shared_ptr<arrow::RecordBatch>>* batches) {
+        std::unique_ptr<BatchBuilder> builder;
+        ARROW_RETURN_NOT_OK(make_batch_builder(pool, &builder));
+        while (!eof_) {
+          ARROW_RETURN_NOT_OK(builder->reserve(batch_rows));
+          int64_t n_rows = 0;
+          ARROW_RETURN_NOT_OK(fetch_rows(builder.get(), batch_rows, &n_rows));
+          if (n_rows == 0) {
+            continue;
+          }
+          std::shared_ptr<arrow::RecordBatch> batch;
+          ARROW_RETURN_NOT_OK(builder->flush(&batch));
+          batches->push_back(std::move(batch));
+        }
+        return arrow::Status::OK();
+      }
 
-          if (!cast) {
-            if (field_type == MYSQL_TYPE_NULL) {
-              rbb->GetFieldAs<arrow::NullBuilder>(i)->AppendNull();
+      // Fetch all the remaining rows of the text protocol into batches of
+      // batch_rows rows, which are parsed by n_workers threads in parallel.
+      // The batches are in the order of the rows, but each of them has its
+      // own dictionaries of the dictionary-encoded columns.
+      arrow::Status fetch_batches_in_parallel(arrow::MemoryPool* pool,
+                                              int64_t batch_rows,
+                                              int n_workers,
+                                              std::vector<std::shared_ptr<arrow::RecordBatch>>* batches) {
+        fetched_ = true;
+        std::vector<std::unique_ptr<BatchBuilder>> builders(n_workers);
+        for (auto& builder : builders) {
+          ARROW_RETURN_NOT_OK(make_batch_builder(pool, &builder));
+          // The statistics are not shared by the workers
+          builder->set_stats(nullptr);
+        }
+        // The workers are joined by the destructor when an exception is thrown
+        ParallelConverter converter(result_, wrapper_->is_streaming, batch_rows,
+                                    std::move(builders));
+        ARROW_RETURN_NOT_OK(converter.start());
+
+        ParallelFetchArgs args{this, &converter, arrow::Status::OK()};
+        do {
+          interrupted_ = false;
+          converter.clear_interrupt();
+          rb_thread_call_without_gvl(nogvl_fetch_in_parallel, &args,
+                                     ubf_fetch_in_parallel, &args);
+          if (interrupted_) {
+            // The pending interrupt must not longjmp over the running workers
+            rb::protect([&]{
+              rb_thread_check_ints();
+              return Qnil;
+            });
+          }
+        } while (interrupted_ && args.status.ok() && !converter.eof());
+        ARROW_RETURN_NOT_OK(args.status);
+
+        // The workers parse the rest of the chunks
+        rb_thread_call_without_gvl(nogvl_finish_in_parallel, &args, nullptr, nullptr);
+        ARROW_RETURN_NOT_OK(args.status);
+        eof_ = true;
+        *batches = std::move(args.batches);
+        return arrow::Status::OK();
+      }
+
+      // Compile the column writers of the schema
+      arrow::Status make_batch_builder(arrow::MemoryPool* pool,
+                                       std::unique_ptr<BatchBuilder>* out) {
+        auto schema = this->schema();
+        ColumnWriterOptions options;
+        options.local_time = dbTimezone == Timezone::local;
+        std::vector<std::unique_ptr<ColumnWriter>> writers(num_fields());
+        for (unsigned int i = 0; i < num_fields(); ++i) {
+          const auto& type = schema->field(i)->type();
+          if (!cast && field_charsets_[i] == Charset::latin1 &&
+              field(i).type != MYSQL_TYPE_NULL) {
+            std::unique_ptr<arrow::ArrayBuilder> builder;
+            ARROW_RETURN_NOT_OK(arrow::MakeBuilder(pool, type, &builder));
+            if (type->id() == arrow::Type::LARGE_STRING) {
+              writers[i].reset(new Latin1ColumnWriter<arrow::LargeStringBuilder>(
+                field(i), std::move(builder)));
             } else {
-              auto val = rb_str_new(row[i], field_lengths[i]);
-              val = mysql2_set_field_string_encoding(val, field(i));
-              const auto len = static_cast<int32_t>(RSTRING_LEN(val)); // FIXME overflow care
-              rbb->GetFieldAs<arrow::BinaryBuilder>(i)->Append(RSTRING_PTR(val), len);
+              writers[i].reset(new Latin1ColumnWriter<arrow::StringBuilder>(
+                field(i), std::move(builder)));
             }
-            continue;
+          } else {
+            ARROW_RETURN_NOT_OK(make_column_writer(field(i), type, pool, options, &writers[i]));
           }
+        }
+        out->reset(new BatchBuilder(schema, std::move(writers)));
+        (*out)->set_stats(stats_.get());
+        return arrow::Status::OK();
+      }
 
-          switch (field_type) {
-            case MYSQL_TYPE_NULL:
-              rbb->GetFieldAs<arrow::NullBuilder>(i)->AppendNull();
-              continue;
-
-            case MYSQL_TYPE_BIT:
-              if (castBool && field_lengths[i] == 1) {
-                rbb->GetFieldAs<arrow::BooleanBuilder>(i)->Append(*row[i] == 1);
-              } else {
-                const auto len = static_cast<int32_t>(field_lengths[i]); // FIXME overflow care
-                rbb->GetFieldAs<arrow::BinaryBuilder>(i)->Append(row[i], len);
-              }
-              continue;
-
-            case MYSQL_TYPE_TINY:
-              if (castBool && field_lengths[i] == 1) {
-                rbb->GetFieldAs<arrow::BooleanBuilder>(i)->Append(*row[i] == 1);
-              } else if (is_unsigned) {
-                uint8_t val = static_cast<uint8_t>(std::strtoul(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::UInt8Builder>(i)->Append(val);
+     private:
+#ifdef HAVE_MYSQL_FETCH_ROW_NONBLOCKING
+      // Fetch at most max_rows rows, or all the remaining rows if max_rows is
+      // negative, of the streaming result without blocking the thread.
+      //
+      // While the rows are not received yet, it waits for the socket to be
+      // readable by rb_wait_for_single_fd, which lets the other fibers run
+      // under a Fiber::Scheduler and the other threads run otherwise.
+      // It runs with the GVL, and stops at the wait after cancel_arrow.
+      arrow::Status fetch_rows_nonblocking(BatchBuilder* builder,
+                                           int64_t max_rows,
+                                           int64_t* n_rows) {
+        arrow::Status status;
+        int64_t n = 0;
+        bool cancel_checked = false;
+        while (status.ok() && !eof_ &&
+               (max_rows < 0 || (n < max_rows && !builder->full()))) {
+          if (!cancel_checked && cancel_requested()) {
+            status = discard_rows_nonblocking();
+            canceled_ = true;
+            break;
+          }
+          cancel_checked = true;
+
+          MYSQL_ROW row = nullptr;
+          // The time waiting for the socket is not counted as fetching
+          const bool sampling = stats_ && stats_->sample_fetch();
+          const int64_t start = sampling ? monotonic_ns() : 0;
+          const auto fetch_status = mysql_fetch_row_nonblocking(result_, &row);
+          if (sampling) {
+            stats_->sampled_fetch_ns += monotonic_ns() - start;
+            ++stats_->n_sampled_fetches;
+          }
+          switch (fetch_status) {
+            case NET_ASYNC_NOT_READY:
+              wait_readable();
+              cancel_checked = false;
+              break;
+            case NET_ASYNC_ERROR:
+              status = arrow::Status::IOError(mysql_error(wrapper_->client_wrapper->client));
+              break;
+            default:
+              if (row == nullptr) {
+                eof_ = true;
               } else {
-                int8_t val = static_cast<int8_t>(std::strtol(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::Int8Builder>(i)->Append(val);
+                status = builder->append_row(row, mysql_fetch_lengths(result_));
+                ++n;
               }
-              continue;
+              break;
+          }
+        }
+        if (n_rows) {
+          *n_rows = n;
+        }
+        return status;
+      }
 
-            case MYSQL_TYPE_SHORT:
-            case MYSQL_TYPE_YEAR:
-              if (is_unsigned) {
-                uint16_t val = static_cast<uint16_t>(std::strtoul(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::UInt16Builder>(i)->Append(val);
-              } else {
-                int16_t val = static_cast<int16_t>(std::strtol(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::Int16Builder>(i)->Append(val);
-              }
-              continue;
+      // Read the rest of the rows so that the result can be freed
+      // without blocking
+      arrow::Status discard_rows_nonblocking() {
+        while (!eof_) {
+          MYSQL_ROW row = nullptr;
+          switch (mysql_fetch_row_nonblocking(result_, &row)) {
+            case NET_ASYNC_NOT_READY:
+              wait_readable();
+              break;
+            case NET_ASYNC_ERROR:
+              return arrow::Status::IOError(mysql_error(wrapper_->client_wrapper->client));
+            default:
+              eof_ = row == nullptr;
+              break;
+          }
+        }
+        return arrow::Status::OK();
+      }
 
-            case MYSQL_TYPE_LONG:
-            case MYSQL_TYPE_INT24:
-              if (is_unsigned) {
-                uint32_t val = static_cast<uint32_t>(std::strtoul(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::UInt32Builder>(i)->Append(val);
-              } else {
-                int32_t val = static_cast<int32_t>(std::strtol(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::Int32Builder>(i)->Append(val);
-              }
-              continue;
+      bool cancel_requested() const {
+        return RTEST(rb_attr_get(self_, intern_arrow_canceled));
+      }
 
-            case MYSQL_TYPE_LONGLONG:
-              if (is_unsigned) {
-                uint64_t val = static_cast<uint64_t>(std::strtoull(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::UInt64Builder>(i)->Append(val);
-              } else {
-                int64_t val = static_cast<int64_t>(std::strtoll(row[i], nullptr, 10));
-                rbb->GetFieldAs<arrow::Int64Builder>(i)->Append(val);
-              }
-              continue;
-
-            case MYSQL_TYPE_DECIMAL:
-            case MYSQL_TYPE_NEWDECIMAL:
-              rbb->GetFieldAs<arrow::Decimal128Builder>(i)->Append(arrow::Decimal128(row[i]));
-              continue;
-
-            case MYSQL_TYPE_FLOAT:
-              rbb->GetFieldAs<arrow::FloatBuilder>(i)->Append(
-                  std::strtof(row[i], nullptr));
-              continue;
-
-            case MYSQL_TYPE_DOUBLE:
-              rbb->GetFieldAs<arrow::DoubleBuilder>(i)->Append(
-                  std::strtod(row[i], nullptr));
-              continue;
-
-            case MYSQL_TYPE_TIME:
-              {
-                unsigned int hour = 0, min = 0, sec = 0;
-                char usec_char[7] = {'0', '0', '0', '0', '0', '0', '\0'};
-                int tokens = std::sscanf(row[i], "%2u:%2u:%2u.%6s", &hour, &min, &sec, usec_char);
-                if (tokens < 3) {
-                  rbb->GetFieldAs<arrow::TimestampBuilder>(i)->AppendNull();
-                  continue;
-                }
-
-                // Note that we convert the TIME value to Timestamp
-                // because mysql2 converts it to Time object
-                arrow::util::date::year_month_day ymd(
-                    arrow::util::date::year(2000),
-                    arrow::util::date::month(1),
-                    arrow::util::date::day(1));
-                auto seconds = std::chrono::duration<int64_t>(3600U * hour + 60U * min + sec);
-                auto tp = arrow::util::date::sys_days(ymd) + seconds;
-                auto duration = tp.time_since_epoch();
-                auto value = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                auto usec = usec_char_to_uint(usec_char, sizeof(usec_char));
-                rbb->GetFieldAs<arrow::TimestampBuilder>(i)->Append(value + usec);
-              }
-              continue;
-
-            case MYSQL_TYPE_TIMESTAMP:
-            case MYSQL_TYPE_DATETIME:
-              {
-                unsigned int year = 0, month = 0, day = 0, hour = 0, min = 0, sec = 0;
-                char usec_char[7] = {'0', '0', '0', '0', '0', '0', '\0'};
-                int tokens = std::sscanf(row[i], "%4u-%2u-%2u %2u:%2u:%2u.%6s",
-                                         &year, &month, &day, &hour, &min, &sec, usec_char);
-                if (tokens < 6 /* msec might be empty */
-                    || year+month+day == 0) {
-                  rbb->GetFieldAs<arrow::TimestampBuilder>(i)->AppendNull();
-                  continue;
-                }
-                else if (month < 1 || day < 1) {
-                  rb_raise(eMysql2Error, "Invalid date in field '%.*s': %s",
-                           field(i).name_length, field(i).name, row[i]);
-                }
-
-                arrow::util::date::year_month_day ymd{
-                    arrow::util::date::year(year),
-                    arrow::util::date::month(month),
-                    arrow::util::date::day(day)};
-                auto seconds = std::chrono::duration<int64_t>(3600U * hour + 60U * min + sec);
-                auto tp = arrow::util::date::sys_days(ymd) + seconds;
-                auto duration = tp.time_since_epoch();
-                auto value = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                auto usec = usec_char_to_uint(usec_char, sizeof(usec_char));
-                rbb->GetFieldAs<arrow::TimestampBuilder>(i)->Append(value + usec);
-              }
-              continue;
-
-            case MYSQL_TYPE_DATE:
-            case MYSQL_TYPE_NEWDATE:
-              {
-                unsigned int year = 0, month = 0, day = 0;
-                int tokens = std::sscanf(row[i], "%4u-%2u-%2u", &year, &month, &day);
-                if (tokens < 3 || year+month+day == 0) {
-                  rbb->GetFieldAs<arrow::Date32Builder>(i)->AppendNull();
-                }
-                else if (month < 1 || day < 1) {
-                  rb_raise(eMysql2Error, "Invalid date in field '%.*s': %s", field(i).name_length, field(i).name, row[i]);
-                }
-                arrow::util::date::year_month_day ymd{
-                    arrow::util::date::year(year),
-                    arrow::util::date::month(month),
-                    arrow::util::date::day(day)};
-                auto tp = arrow::util::date::sys_days(ymd);
-                auto duration = tp.time_since_epoch();
-                auto days = static_cast<int32_t>(duration.count());
-                rbb->GetFieldAs<arrow::Date32Builder>(i)->Append(days);
-              }
-              continue;
-
-            case MYSQL_TYPE_TINY_BLOB:
-            case MYSQL_TYPE_MEDIUM_BLOB:
-            case MYSQL_TYPE_LONG_BLOB:
-            case MYSQL_TYPE_BLOB:
-            case MYSQL_TYPE_VAR_STRING:
-            case MYSQL_TYPE_VARCHAR:
-            case MYSQL_TYPE_STRING:
-              {
-                /* TODO: encoding */
-                const auto len = static_cast<int32_t>(field_lengths[i]); // FIXME overflow care
-                rbb->GetFieldAs<arrow::StringBuilder>(i)->Append(row[i], len);
-              }
-              continue;
+      static VALUE wait_readable_body(VALUE fd) {
+        rb_wait_for_single_fd(NUM2INT(fd), RB_WAITFD_IN, nullptr);
+        return Qnil;
+      }
 
-              // TODO: support following types
-            case MYSQL_TYPE_SET:
-            case MYSQL_TYPE_ENUM:
-            case MYSQL_TYPE_GEOMETRY:
-              /* TODO */
-              continue;
+      void wait_readable() {
+        int state = 0;
+        rb_protect(wait_readable_body,
+                   INT2NUM(wrapper_->client_wrapper->client->net.fd),
+                   &state);
+        if (state) {
+          // e.g. Timeout.timeout in the fiber; the connection can't be used
+          // until the rest of the rows are read, which lets the other fibers
+          // run too. The result is freed by the destructor, which blocks
+          // only if the rows are interrupted again.
+          if (!discarding_) {
+            discarding_ = true;
+            ARROW_UNUSED(discard_rows_nonblocking());
+          }
+          throw rb::State(state);
+        }
+      }
+#endif
 
-            default:
-              continue;
+      struct ParallelFetchArgs {
+        ResultWrapper* self;
+        ParallelConverter* converter;
+        arrow::Status status;
+        std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+      };
+
+      static void* nogvl_fetch_in_parallel(void* ptr) {
+        auto args = static_cast<ParallelFetchArgs*>(ptr);
+        args->status = args->converter->fetch();
+        return nullptr;
+      }
+
+      static void ubf_fetch_in_parallel(void* ptr) {
+        auto args = static_cast<ParallelFetchArgs*>(ptr);
+        args->self->interrupted_ = true;
+        args->converter->interrupt();
+      }
+
+      static void* nogvl_finish_in_parallel(void* ptr) {
+        auto args = static_cast<ParallelFetchArgs*>(ptr);
+        args->status = args->converter->finish(&args->batches);
+        return nullptr;
+      }
+
+      struct FetchRowsArgs {
+        ResultWrapper* self;
+        BatchBuilder* builder;
+        int64_t max_rows;
+        int64_t n_rows;
+        arrow::Status status;
+      };
+
+      static void* nogvl_fetch_rows(void* ptr) {
+        auto args = static_cast<FetchRowsArgs*>(ptr);
+        auto self = args->self;
+        try {
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+          if (self->packet_reader_) {
+            const int64_t max_rows =
+              args->max_rows < 0 ? -1 : args->max_rows - args->n_rows;
+            int64_t n_rows = 0;
+            args->status = self->packet_reader_->read(args->builder, max_rows,
+                                                      &self->interrupted_, &n_rows);
+            args->n_rows += n_rows;
+            self->eof_ = self->packet_reader_->eof();
+            return nullptr;
+          }
+#endif
+          // A batch of at most max_rows rows is also split by its data
+          while (!self->interrupted_ &&
+                 (args->max_rows < 0 ||
+                  (args->n_rows < args->max_rows && !args->builder->full()))) {
+            bool fetched = false;
+            if (self->stmt_) {
+              args->status = self->fetch_stmt_row(args->builder, &fetched);
+            } else {
+              args->status = self->fetch_row(args->builder, &fetched);
+            }
+            if (!args->status.ok() || !fetched) {
+              break;
+            }
+            ++args->n_rows;
           }
+        } catch (const std::exception& e) {
+          args->status = arrow::Status::UnknownError(e.what());
+        }
+        return nullptr;
+      }
+
+      static void ubf_fetch_rows(void* ptr) {
+        static_cast<ResultWrapper*>(ptr)->interrupted_ = true;
+      }
+
+      arrow::Status fetch_row(BatchBuilder* builder, bool* fetched) {
+        const bool sampling = stats_ && stats_->sample_fetch();
+        const int64_t start = sampling ? monotonic_ns() : 0;
+        MYSQL_ROW row = mysql_fetch_row(result_);
+        if (sampling) {
+          stats_->sampled_fetch_ns += monotonic_ns() - start;
+          ++stats_->n_sampled_fetches;
         }
+        if (row == nullptr) {
+          eof_ = true;
+          return arrow::Status::OK();
+        }
+        *fetched = true;
+        unsigned long* field_lengths = mysql_fetch_lengths(result_);
+        return builder->append_row(row, field_lengths);
+      }
+
 
-        return true;
+      arrow::Status fetch_stmt_row(BatchBuilder* builder, bool* fetched) {
+        const bool sampling = stats_ && stats_->sample_fetch();
+        const int64_t start = sampling ? monotonic_ns() : 0;
+        const int fetch_status = mysql_stmt_fetch(stmt_);
+        if (sampling) {
+          stats_->sampled_fetch_ns += monotonic_ns() - start;
+          ++stats_->n_sampled_fetches;
+        }
+        switch (fetch_status) {
+          case 0: /* success */
+            break;
+
+          case 1: /* error */
+            return arrow::Status::IOError(mysql_stmt_error(stmt_));
+
+          case MYSQL_NO_DATA: /* no more row */
+            eof_ = true;
+            return arrow::Status::OK();
+
+          case MYSQL_DATA_TRUNCATED:
+            ARROW_RETURN_NOT_OK(fetch_truncated_columns());
+            break;
+        }
+        *fetched = true;
+        return builder->append_row(wrapper_->result_buffers);
       }
 
-      [[noreturn]] bool fetch_row_stmt(std::unique_ptr<arrow::RecordBatchBuilder>& rbb) {
-        rb_raise(rb_eNotImpError, "Prepared statement is not supported");
+      // Values longer than the bound buffer, which can happen when
+      // max_length is not available, are fetched again after growing the buffer.
+      arrow::Status fetch_truncated_columns() {
+        MYSQL_BIND* result_buffers = wrapper_->result_buffers;
+        bool rebind = false;
+        for (unsigned int i = 0; i < num_fields(); ++i) {
+          if (!wrapper_->error[i]) {
+            continue;
+          }
+          if (wrapper_->length[i] > result_buffers[i].buffer_length) {
+            GrowBufferArgs args{&result_buffers[i], wrapper_->length[i]};
+            rb_thread_call_with_gvl(grow_result_buffer, &args);
+            rebind = true;
+          }
+          if (mysql_stmt_fetch_column(stmt_, &result_buffers[i], i, 0)) {
+            return arrow::Status::IOError(mysql_stmt_error(stmt_));
+          }
+        }
+        if (rebind && mysql_stmt_bind_result(stmt_, result_buffers)) {
+          return arrow::Status::IOError(mysql_stmt_error(stmt_));
+        }
+        return arrow::Status::OK();
       }
 
-     private:
-      VALUE mysql2_set_field_string_encoding(VALUE val, const MYSQL_FIELD& field) {
-        /* if binary flag is set, respect its wishes */
-        if (field.flags & BINARY_FLAG && field.charsetnr == 63) {
-          rb_enc_associate(val, binaryEncoding);
-        } else if (!field.charsetnr) {
-          /* MySQL 4.x may not provide an encoding, binary will get the bytes through */
-          rb_enc_associate(val, binaryEncoding);
-        } else {
-          /* lookup the encoding configured on this field */
-          const char *enc_name;
-          int enc_index;
+      struct GrowBufferArgs {
+        MYSQL_BIND* bind;
+        unsigned long length;
+      };
 
-          enc_name = (field.charsetnr-1 < CHARSETNR_SIZE)
-            ? mysql2_mysql_enc_to_rb[field.charsetnr-1]
+      static void* grow_result_buffer(void* ptr) {
+        auto args = static_cast<GrowBufferArgs*>(ptr);
+        // The buffers are released by xfree in rb_mysql_result_free_result
+        args->bind->buffer = xrealloc(args->bind->buffer, args->length);
+        args->bind->buffer_length = args->length;
+        return nullptr;
+      }
+
+      // Resolve the charset of the values of each field not to be casted,
+      // in the same way as mysql2 associates the encoding with the string.
+      // This is done here because rb_enc_name of the connection encoding
+      // needs the GVL.
+      void resolve_field_charsets() {
+        field_charsets_.assign(num_fields(), Charset::binary);
+        for (unsigned int i = 0; i < num_fields(); ++i) {
+          const MYSQL_FIELD& f = field(i);
+          if (f.charsetnr == 63) {
+            /* numbers and temporal values are ASCII text with the binary charset */
+            if (IS_NUM(f.type) ||
+                f.type == MYSQL_TYPE_DATE || f.type == MYSQL_TYPE_NEWDATE ||
+                f.type == MYSQL_TYPE_TIME || f.type == MYSQL_TYPE_DATETIME ||
+                f.type == MYSQL_TYPE_TIMESTAMP) {
+              field_charsets_[i] = Charset::utf8;
+            }
+            continue;
+          }
+          if (!f.charsetnr) {
+            /* MySQL 4.x may not provide an encoding, binary will get the bytes through */
+            continue;
+          }
+          const char* enc_name = (f.charsetnr-1 < CHARSETNR_SIZE)
+            ? mysql2_mysql_enc_to_rb[f.charsetnr-1]
             : nullptr;
-          if (enc_name != nullptr) {
-            /* use the field encoding we were able to match */
-            enc_index = rb_enc_find_index(enc_name);
-            rb_enc_set_index(val, enc_index);
-          } else {
+          if (enc_name == nullptr) {
             /* otherwise fall-back to the connection's encoding */
-            rb_enc_associate(val, conn_enc);
+            enc_name = rb_enc_name(conn_enc);
           }
-          if (default_internal_enc_) {
-            val = rb_str_export_to_enc(val, default_internal_enc_);
+          if (strcmp(enc_name, "UTF-8") == 0 || strcmp(enc_name, "US-ASCII") == 0) {
+            field_charsets_[i] = Charset::utf8;
+          } else if (strcmp(enc_name, "ISO-8859-1") == 0) {
+            field_charsets_[i] = Charset::latin1;
           }
         }
-        return val;
+      }
+
+      // The type of the values not to be casted; the bytes are kept as is,
+      // but the ones in Latin-1 are transcoded into UTF-8
+      std::shared_ptr<arrow::DataType> uncast_field_type(unsigned int i) const {
+        if (field(i).type == MYSQL_TYPE_NULL) {
+          return arrow::null();
+        }
+        switch (field_charsets_[i]) {
+          case Charset::utf8:
+          case Charset::latin1:
+            return is_long_field(i) ? arrow::large_utf8() : arrow::utf8();
+          default:
+            return is_long_field(i) ? arrow::large_binary() : arrow::binary();
+        }
+      }
+
+      // LONGTEXT, LONGBLOB and JSON, whose values can be up to 4 GiB,
+      // have 64-bit offsets. The other values are 16 MiB at most, and the
+      // batches of them are flushed before the 2 GiB of 32-bit offsets.
+      bool is_long_field(unsigned int i) const {
+        if (field(i).type == MYSQL_TYPE_GEOMETRY) {
+          return false;
+        }
+        return field(i).type == MYSQL_TYPE_LONG_BLOB || field(i).length >= 0xffffffffUL;
       }
 
       void makeArrowSchema() {
+        timestamp_type_ = arrow::timestamp(arrow::TimeUnit::MICRO, timestamp_timezone());
         std::vector<std::shared_ptr<arrow::Field>> arrow_fields;
         arrow_fields.reserve(num_fields());
         for (unsigned int i = 0; i < num_fields(); ++i) {
           bool nullable = 0 == (field_flags(i) & NOT_NULL_FLAG);
-          arrow_fields.emplace_back(std::make_shared<arrow::Field>(field_name(i), mysql_field_to_arrow_type(i), nullable));
+          arrow_fields.emplace_back(std::make_shared<arrow::Field>(field_name(i),
+                                                                   mysql_field_to_arrow_type(i),
+                                                                   nullable,
+                                                                   field_metadata(i)));
         }
         schema_ = std::make_shared<arrow::Schema>(std::move(arrow_fields));
       }
 
+      // The timezone of the timestamp type, which mysql2 converts Time
+      // objects into with application_timezone, or database_timezone if it
+      // is not given. The values are always in UTC.
+      std::string timestamp_timezone() const {
+        const auto timezone = appTimezone == Timezone::unknown ? dbTimezone : appTimezone;
+        if (timezone == Timezone::utc) {
+          return "UTC";
+        }
+        return local_timezone_name();
+      }
+
+      // The length of a DECIMAL field is the display length,
+      // which has the sign unless unsigned and the point if any
+      int32_t decimal_precision(unsigned int i) const {
+        int64_t precision = field(i).length;
+        if (field(i).decimals > 0) {
+          --precision;
+        }
+        if (!(field(i).flags & UNSIGNED_FLAG)) {
+          --precision;
+        }
+        return static_cast<int32_t>(
+          std::max<int64_t>(precision, std::max<unsigned int>(field(i).decimals, 1)));
+      }
+
+      std::shared_ptr<arrow::DataType> decimal_type(unsigned int i) const {
+        const int32_t precision = decimal_precision(i);
+        const int32_t scale = static_cast<int32_t>(field(i).decimals);
+        if (precision <= arrow::Decimal128Type::kMaxPrecision) {
+          return std::make_shared<arrow::Decimal128Type>(precision, scale);
+        }
+#if ARROW_VERSION_MAJOR >= 3
+        return std::make_shared<arrow::Decimal256Type>(precision, scale);
+#else
+        /* the exact text for the precision Decimal128 can't hold */
+        return arrow::utf8();
+#endif
+      }
+
+      // The scale of DECIMAL values narrowed into int64 is kept in the metadata
+      std::shared_ptr<const arrow::KeyValueMetadata> field_metadata(unsigned int i) const {
+        if (cast && decimalAs == DecimalAs::int64_scaled &&
+            (field(i).type == MYSQL_TYPE_DECIMAL || field(i).type == MYSQL_TYPE_NEWDECIMAL)) {
+          return arrow::key_value_metadata({"mysql2_arrow:scale"},
+                                           {std::to_string(field(i).decimals)});
+        }
+        return nullptr;
+      }
+
       std::shared_ptr<arrow::DataType> mysql_field_to_arrow_type(unsigned int i) const {
         const enum enum_field_types field_type = field(i).type;
         const unsigned int flags = field(i).flags;
         const bool is_unsigned = 0 != (flags & UNSIGNED_FLAG);
 
         if (!cast) {
-          if (field_type == MYSQL_TYPE_NULL) {
-            return arrow::null();
-          }
+          return uncast_field_type(i);
+        }
 
-          return arrow::utf8();
+        /* ENUM and SET are sent as MYSQL_TYPE_STRING with these flags */
+        if (field_type == MYSQL_TYPE_ENUM || (flags & ENUM_FLAG)) {
+          return arrow::dictionary(arrow::int16(), arrow::utf8());
+        }
+        if (field_type == MYSQL_TYPE_SET || (flags & SET_FLAG)) {
+          return arrow::list(arrow::dictionary(arrow::int16(), arrow::utf8()));
         }
 
         switch (field_type) {
@@ -412,7 +865,14 @@ namespace mysql2_arrow {
 
           case MYSQL_TYPE_DECIMAL:  /* DECIMAL or NUMERIC */
           case MYSQL_TYPE_NEWDECIMAL: /* high precision DECIMAL or NUMERIC */
-            return std::make_shared<arrow::Decimal128Type>(field(i).length, field(i).decimals);
+            switch (decimalAs) {
+              case DecimalAs::int64_scaled:
+                return arrow::int64();
+              case DecimalAs::float64:
+                return arrow::float64();
+              default:
+                return decimal_type(i);
+            }
 
           case MYSQL_TYPE_FLOAT:    /* FLOAT: 4 bytes */
             return arrow::float32();
@@ -427,7 +887,7 @@ namespace mysql2_arrow {
             return arrow::binary();
 
           case MYSQL_TYPE_TIMESTAMP:
-            return std::make_shared<arrow::TimestampType>(arrow::TimeUnit::MICRO);
+            return timestamp_type_;
 
           case MYSQL_TYPE_DATE:
           case MYSQL_TYPE_NEWDATE:
@@ -436,7 +896,7 @@ namespace mysql2_arrow {
 
           case MYSQL_TYPE_TIME:
           case MYSQL_TYPE_DATETIME:
-            return std::make_shared<arrow::TimestampType>(arrow::TimeUnit::MICRO);
+            return timestamp_type_;
 
           case MYSQL_TYPE_YEAR:    /* YEAR: 1 byte */
             return arrow::uint16();
@@ -444,19 +904,21 @@ namespace mysql2_arrow {
           case MYSQL_TYPE_STRING:     /* CHAR, BINARY */
           case MYSQL_TYPE_VAR_STRING: /* VARCHAR, VARBINARY */
           case MYSQL_TYPE_VARCHAR:
+            if (dictionaryColumns.count(field_name(i)) > 0) {
+              /* BINARY and VARBINARY values aren't UTF-8 */
+              return arrow::dictionary(arrow::int32(),
+                                       field(i).charsetnr == 63 ? arrow::binary() : arrow::utf8());
+            }
             return arrow::utf8();
 
           case MYSQL_TYPE_TINY_BLOB:   /* TINYBLOB, TINYTEXT */
           case MYSQL_TYPE_MEDIUM_BLOB: /* MEDIUMBLOB, MEDIUMTEXT */
           case MYSQL_TYPE_LONG_BLOB:   /* LONGBLOB, LONGTEXT */
           case MYSQL_TYPE_BLOB:        /* BLOB, TEXT */
-            return arrow::utf8();
+            return is_long_field(i) ? arrow::large_utf8() : arrow::utf8();
 
-          case MYSQL_TYPE_SET:
-          case MYSQL_TYPE_ENUM:
-          case MYSQL_TYPE_GEOMETRY:
-            /* TODO */
-            return nullptr;
+          case MYSQL_TYPE_GEOMETRY: /* WKB with the SRID prefix */
+            return arrow::binary();
 
           case MYSQL_TYPE_NULL:
             return arrow::null();
@@ -465,29 +927,39 @@ namespace mysql2_arrow {
             break;
         }
 
-        return arrow::binary();
+        return is_long_field(i) ? arrow::large_binary() : arrow::binary();
       }
 
+      VALUE self_;
+      mysql2_result_wrapper* wrapper_;
+      MYSQL_STMT* stmt_;
       MYSQL_RES* result_;
       unsigned int num_fields_;
       MYSQL_FIELD* fields_;
       std::shared_ptr<arrow::Schema> schema_;
-      rb_encoding* default_internal_enc_;
+      std::shared_ptr<arrow::DataType> timestamp_type_;
       rb_encoding* conn_enc;
+      std::vector<Charset::type> field_charsets_;
+      bool eof_;
+      bool canceled_;
+      // Whether fetching the rows has started
+      bool fetched_;
+      // Whether the rest of the rows are discarded after an exception
+      bool discarding_;
+      std::atomic<bool> interrupted_;
+      std::unique_ptr<FetchStats> stats_;
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+      std::unique_ptr<PacketReader> packet_reader_;
+#endif
     };
 
-    VALUE mysql2_result_to_arrow_impl(int argc, VALUE* argv, VALUE self) {
-      GET_RESULT(self);
-
-      /* TODO: support prepared statement */
-      if (wrapper->stmt_wrapper) {
-        rb_raise(rb_eNotImpError, "Prepared statement is not supported");
-      }
-
+    void check_result_wrapper(mysql2_result_wrapper* wrapper) {
       if (wrapper->stmt_wrapper && wrapper->stmt_wrapper->closed) {
-        rb_raise(eMysql2Error, "Statement handle already closed");
+        throw_error(eMysql2Error, "Statement handle already closed");
       }
+    }
 
+    VALUE merge_query_options(int argc, VALUE* argv, VALUE self) {
       VALUE defaults = rb_iv_get(self, "@query_options");
       Check_Type(defaults, T_HASH);
 
@@ -497,19 +969,16 @@ namespace mysql2_arrow {
       } else {
         opts = defaults;
       }
+      return opts;
+    }
 
+    void configure_result_wrapper(ResultWrapper& res, mysql2_result_wrapper* wrapper, VALUE opts) {
       int cacheRows = RTEST(rb_hash_aref(opts, sym_cache_rows));
       if (cacheRows) {
         rb_warn(":cache_rows is ignored in to_arrow method");
         cacheRows = 0;
       }
 
-      if (wrapper->stmt_wrapper && !wrapper->is_streaming) {
-        rb_warn("Rows are not cached in to_arrow method even for prepared statements (if not streaming)");
-      }
-
-      ResultWrapper res(wrapper);
-
       res.symbolizeKeys = RTEST(rb_hash_aref(opts, sym_symbolize_keys));
       res.asArray       = rb_hash_aref(opts, sym_as) == sym_array;
       res.castBool      = RTEST(rb_hash_aref(opts, sym_cast_booleans));
@@ -517,6 +986,7 @@ namespace mysql2_arrow {
 
       if (wrapper->stmt_wrapper && !res.cast) {
         rb_warn(":cast is forced for prepared statements");
+        res.cast = true;
       }
 
       VALUE dbTz = rb_hash_aref(opts, sym_database_timezone);
@@ -540,70 +1010,584 @@ namespace mysql2_arrow {
         res.appTimezone = Timezone::unknown;
       }
 
+      if (RTEST(rb_hash_aref(opts, sym_stats))) {
+        res.enable_stats();
+      }
+
+      res.nonblocking = RTEST(rb_hash_aref(opts, sym_nonblocking));
+#ifndef HAVE_MYSQL_FETCH_ROW_NONBLOCKING
+      if (res.nonblocking) {
+        rb_warn(":nonblocking needs mysql_fetch_row_nonblocking of libmysqlclient 8.0.16 or later");
+        res.nonblocking = false;
+      }
+#endif
+      if (wrapper->stmt_wrapper && res.nonblocking) {
+        rb_warn(":nonblocking is ignored for prepared statements");
+        res.nonblocking = false;
+      }
+
+      res.packetReader = RTEST(rb_hash_aref(opts, sym_packet_reader));
+#ifndef MYSQL2_ARROW_HAVE_PACKET_READER
+      if (res.packetReader) {
+        rb_warn(":packet_reader needs my_net_read of libmysqlclient");
+        res.packetReader = false;
+      }
+#endif
+      if (res.packetReader && (wrapper->stmt_wrapper || !wrapper->is_streaming)) {
+        // The rows of a stored result have been read already
+        rb_warn(":packet_reader is ignored without stream: true or for prepared statements");
+        res.packetReader = false;
+      }
+      if (res.packetReader && res.nonblocking) {
+        rb_warn(":packet_reader is ignored with :nonblocking");
+        res.packetReader = false;
+      }
+
+      VALUE decimalAs = rb_hash_aref(opts, sym_decimal_as);
+      if (NIL_P(decimalAs)) {
+        res.decimalAs = DecimalAs::decimal;
+      } else if (decimalAs == sym_int64_scaled) {
+        res.decimalAs = DecimalAs::int64_scaled;
+      } else if (decimalAs == sym_float64) {
+        res.decimalAs = DecimalAs::float64;
+      } else {
+        throw_error(rb_eArgError, ":decimal_as option must be :int64_scaled or :float64");
+      }
+
+      VALUE dictionaryColumns = rb_hash_aref(opts, sym_dictionary_columns);
+      if (!NIL_P(dictionaryColumns)) {
+        dictionaryColumns = rb::protect([&]{ return rb_Array(dictionaryColumns); });
+        for (long i = 0; i < RARRAY_LEN(dictionaryColumns); ++i) {
+          VALUE name = rb::protect([&]{
+            return rb_obj_as_string(rb_ary_entry(dictionaryColumns, i));
+          });
+          res.dictionaryColumns.emplace(RSTRING_PTR(name), RSTRING_LEN(name));
+        }
+      }
+
       wrapper->numberOfRows = wrapper->stmt_wrapper
         ? mysql_stmt_num_rows(wrapper->stmt_wrapper->stmt)
         : mysql_num_rows(wrapper->result);
 
-      using fetch_row_func_t = bool (ResultWrapper::*)(std::unique_ptr<arrow::RecordBatchBuilder>&);
-      fetch_row_func_t fetch_row_func;
-      if (wrapper->stmt_wrapper) {
-        fetch_row_func = &ResultWrapper::fetch_row_stmt;
-      } else {
-        fetch_row_func = &ResultWrapper::fetch_row;
+      res.bind_result_buffers();
+    }
+
+    // Make the memory pool of a call from the memory_pool and memory_limit options
+    std::shared_ptr<QueryMemoryPool> make_memory_pool(VALUE opts) {
+      std::string name("default");
+      VALUE rb_name = rb_hash_aref(opts, sym_memory_pool);
+      if (!NIL_P(rb_name)) {
+        rb_name = rb::protect([&]{ return rb_obj_as_string(rb_name); });
+        name.assign(RSTRING_PTR(rb_name), RSTRING_LEN(rb_name));
       }
 
-      auto schema = res.schema();
-      auto memory_pool = arrow::default_memory_pool();
-      std::unique_ptr<arrow::RecordBatchBuilder> rbb;
-      auto status = arrow::RecordBatchBuilder::Make(schema, memory_pool, &rbb);
-      if (!status.ok()) {
-        rb_raise(rb_eRuntimeError, "%s", status.message().c_str());
+      int64_t limit = 0;
+      VALUE rb_limit = rb_hash_aref(opts, sym_memory_limit);
+      if (!NIL_P(rb_limit)) {
+        rb::protect([&]{
+          limit = NUM2LL(rb_limit);
+          return Qnil;
+        });
+        if (limit <= 0) {
+          throw_error(rb_eArgError, ":memory_limit must be positive");
+        }
+      }
+
+      std::shared_ptr<QueryMemoryPool> pool;
+      auto status = make_query_memory_pool(name, limit, &pool);
+      if (status.IsInvalid()) {
+        throw_error(rb_eArgError, status.message());
+      }
+      check_status(status);
+      return pool;
+    }
+
+    VALUE make_rb_fetch_stats(const ResultWrapper& res, const FetchStats& stats) {
+      VALUE rb_stats = rb_hash_new();
+      rb_hash_aset(rb_stats, sym_rows, LL2NUM(stats.n_rows));
+      rb_hash_aset(rb_stats, sym_bytes, LL2NUM(stats.n_bytes));
+      rb_hash_aset(rb_stats, sym_batches, LL2NUM(stats.n_batches));
+      rb_hash_aset(rb_stats, sym_total_ns, LL2NUM(stats.total_ns));
+      rb_hash_aset(rb_stats, sym_fetch_ns, LL2NUM(stats.fetch_ns()));
+      rb_hash_aset(rb_stats, sym_parse_ns, LL2NUM(stats.parse_ns()));
+      rb_hash_aset(rb_stats, sym_reserve_ns, LL2NUM(stats.reserve_ns));
+      rb_hash_aset(rb_stats, sym_flush_ns, LL2NUM(stats.flush_ns));
+      rb_hash_aset(rb_stats, sym_sampled_rows, LL2NUM(stats.n_sampled_rows));
+      VALUE columns = rb_ary_new_capa(res.num_fields());
+      for (unsigned int i = 0; i < res.num_fields(); ++i) {
+        VALUE column = rb_hash_new();
+        const auto name = res.field_name(i);
+        rb_hash_aset(column, sym_name, rb_utf8_str_new(name.data(), name.size()));
+        rb_hash_aset(column, sym_parse_ns, LL2NUM(stats.column_parse_ns(i)));
+        rb_hash_aset(column, sym_null_count, LL2NUM(stats.null_counts[i]));
+        rb_ary_push(columns, rb_obj_freeze(column));
+      }
+      rb_hash_aset(rb_stats, sym_columns, rb_obj_freeze(columns));
+      return rb_obj_freeze(rb_stats);
+    }
+
+    // Wrap the batch for Ruby with the memory statistics of the call so far,
+    // and the statistics of the conversion so far if they are collected
+    VALUE make_rb_record_batch(const std::shared_ptr<arrow::RecordBatch>& batch,
+                               const std::shared_ptr<QueryMemoryPool>& pool,
+                               const ResultWrapper* res = nullptr) {
+      auto retained_batch = retain_memory_pool(batch, pool);
+      auto gobj_batch = garrow_record_batch_new_raw(&retained_batch);
+      VALUE rb_batch = GOBJ2RVAL_UNREF(gobj_batch);
+
+      VALUE stats = rb_hash_new();
+      const auto backend = pool->backend_name();
+      rb_hash_aset(stats, sym_backend, rb_str_new(backend.data(), backend.size()));
+      rb_hash_aset(stats, sym_bytes_allocated, LL2NUM(pool->bytes_allocated()));
+      rb_hash_aset(stats, sym_peak_bytes, LL2NUM(pool->max_memory()));
+      rb_hash_aset(stats, sym_total_bytes_allocated, LL2NUM(pool->total_bytes_allocated()));
+      rb_iv_set(rb_batch, "@memory_stats", rb_obj_freeze(stats));
+      if (res && res->stats()) {
+        rb_iv_set(rb_batch, "@fetch_stats", make_rb_fetch_stats(*res, *res->stats()));
+      }
+      return rb_batch;
+    }
+
+    void check_streaming_not_complete(mysql2_result_wrapper* wrapper) {
+      if (wrapper->is_streaming && wrapper->streamingComplete) {
+        throw_error(eMysql2Error,
+                    "You have already fetched all the rows for this query and "
+                    "streaming is true. (to reiterate you must requery).");
+      }
+    }
+
+    void complete_streaming(mysql2_result_wrapper* wrapper) {
+      rb_mysql_result_free_result(wrapper);
+      wrapper->streamingComplete = 1;
+
+      // Check for errors, the connection might have gone out from under us
+      // mysql_error returns an empty string if there is no error
+      const char* errstr = mysql_error(wrapper->client_wrapper->client);
+      if (errstr[0]) {
+        throw_error(eMysql2Error, errstr);
+      }
+    }
+
+    // The rows of a batch from the rows option
+    int64_t batch_rows_option(VALUE opts) {
+      int64_t batch_rows = kDefaultBatchRows;
+      VALUE rows = rb_hash_aref(opts, sym_rows);
+      if (!NIL_P(rows)) {
+        batch_rows = NUM2LL(rows);
+        if (batch_rows <= 0) {
+          throw_error(rb_eArgError, ":rows must be positive");
+        }
+      }
+      return batch_rows;
+    }
+
+    // Raise Mysql2Arrow::Canceled if the conversion has stopped by
+    // cancel_arrow; the result has been freed by complete_streaming
+    void check_canceled(const ResultWrapper& res) {
+      if (res.canceled()) {
+        throw_error(eCanceled, "Conversion into Arrow has been canceled");
       }
+    }
+
+    // Request the nonblocking conversion of the result, which is waiting
+    // for the rows in another fiber, to stop
+    VALUE mysql2_result_cancel_arrow(VALUE self) {
+      rb_ivar_set(self, intern_arrow_canceled, Qtrue);
+      return self;
+    }
+
+    VALUE mysql2_result_to_arrow_impl(int argc, VALUE* argv, VALUE self) {
+      GET_RESULT(self);
+      check_result_wrapper(wrapper);
+
+      VALUE opts = merge_query_options(argc, argv, self);
 
+      ResultWrapper res(self, wrapper);
+      configure_result_wrapper(res, wrapper, opts);
+      const int64_t start = res.stats() ? monotonic_ns() : 0;
+
+      auto memory_pool = make_memory_pool(opts);
+      std::unique_ptr<BatchBuilder> builder;
+      check_status(res.make_batch_builder(memory_pool.get(), &builder));
+
+      arrow::Status status;
       if (wrapper->is_streaming) {
         if (wrapper->rows == Qnil) {
           wrapper->rows = rb_ary_new();
         }
 
-        if (!wrapper->streamingComplete) {
-          while ((res.*fetch_row_func)(rbb));
+        check_streaming_not_complete(wrapper);
+        status = res.fetch_rows(builder.get());
+        complete_streaming(wrapper);
+        check_canceled(res);
+        check_status(status);
+      } else { /* not streaming */
+        res.rewind();
+        // The number of rows is known, so that the builders grow only once
+        check_status(builder->reserve(wrapper->numberOfRows));
+        check_status(res.fetch_rows(builder.get()));
+      }
+
+      std::shared_ptr<arrow::RecordBatch> batch;
+      check_status(builder->flush(&batch));
+
+      if (res.stats()) {
+        res.stats()->total_ns = monotonic_ns() - start;
+      }
+      return make_rb_record_batch(batch, memory_pool, &res);
+    }
+
+    VALUE mysql2_result_to_arrow(int argc, VALUE* argv, VALUE self) {
+      VALUE exception;
+      try {
+        return mysql2_result_to_arrow_impl(argc, argv, self);
+      } catch (rb::State& state) {
+        state.jump();
+      } catch (Error& error) {
+        exception = error.exception();
+      }
+      rb_exc_raise(exception);
+    }
+
+    VALUE mysql2_result_each_record_batch_impl(int argc, VALUE* argv, VALUE self) {
+      GET_RESULT(self);
+      check_result_wrapper(wrapper);
+
+      VALUE opts = merge_query_options(argc, argv, self);
+
+      int64_t batch_rows = batch_rows_option(opts);
+
+      check_streaming_not_complete(wrapper);
+
+      ResultWrapper res(self, wrapper);
+      configure_result_wrapper(res, wrapper, opts);
+      // The time in the block is not counted
+      int64_t start = res.stats() ? monotonic_ns() : 0;
 
-          rb_mysql_result_free_result(wrapper);
-          wrapper->streamingComplete = 1;
+      auto memory_pool = make_memory_pool(opts);
+      std::unique_ptr<BatchBuilder> builder;
+      check_status(res.make_batch_builder(memory_pool.get(), &builder));
 
-          // Check for errors, the connection might have gone out from under us
-          // mysql_error returns an empty string if there is no error
-          const char* errstr = mysql_error(wrapper->client_wrapper->client);
-          if (errstr[0]) {
-            rb_raise(eMysql2Error, "%s", errstr);
+      if (!wrapper->is_streaming) {
+        res.rewind();
+      }
+
+      int64_t n_fetched_rows = 0;
+      while (!res.eof()) {
+        // The rows of the last batch are known only for the buffered result;
+        // the data capacity of variable-width columns follows the previous batch
+        int64_t capacity = batch_rows;
+        if (!wrapper->is_streaming) {
+          capacity = std::min<int64_t>(capacity, wrapper->numberOfRows - n_fetched_rows);
+        }
+        if (capacity > 0) {
+          check_status(builder->reserve(capacity));
+        }
+
+        int64_t n_rows = 0;
+        auto status = res.fetch_rows(builder.get(), batch_rows, &n_rows);
+        if (!status.ok()) {
+          if (wrapper->is_streaming) {
+            complete_streaming(wrapper);
           }
+          check_status(status);
+        }
+        if (n_rows == 0) {
+          continue;
+        }
+        n_fetched_rows += n_rows;
+
+        std::shared_ptr<arrow::RecordBatch> batch;
+        check_status(builder->flush(&batch));
+        if (res.stats()) {
+          res.stats()->total_ns += monotonic_ns() - start;
+        }
+        auto rb_batch = make_rb_record_batch(batch, memory_pool, &res);
+        // break or an exception in the block is thrown as rb::State
+        rb::protect([&]{ return rb_yield(rb_batch); });
+        if (res.stats()) {
+          start = monotonic_ns();
+        }
+      }
+
+      if (wrapper->is_streaming) {
+        complete_streaming(wrapper);
+        check_canceled(res);
+      }
+
+      return self;
+    }
+
+    VALUE mysql2_result_each_record_batch(int argc, VALUE* argv, VALUE self) {
+      RETURN_ENUMERATOR(self, argc, argv);
+      VALUE exception;
+      try {
+        return mysql2_result_each_record_batch_impl(argc, argv, self);
+      } catch (rb::State& state) {
+        state.jump();
+      } catch (Error& error) {
+        exception = error.exception();
+      }
+      rb_exc_raise(exception);
+    }
+    VALUE mysql2_result_to_arrow_table_impl(int argc, VALUE* argv, VALUE self) {
+      GET_RESULT(self);
+      check_result_wrapper(wrapper);
+
+      VALUE opts = merge_query_options(argc, argv, self);
+
+      int64_t batch_rows = batch_rows_option(opts);
+
+      int n_workers = 0;
+      VALUE workers = rb_hash_aref(opts, sym_workers);
+      if (!NIL_P(workers)) {
+        n_workers = NUM2INT(workers);
+        if (n_workers < 0) {
+          throw_error(rb_eArgError, ":workers must not be negative");
+        }
+      }
+      if (n_workers > 1 && wrapper->stmt_wrapper) {
+        // The result buffers of a statement are overwritten by each fetch
+        rb_warn(":workers is ignored for prepared statements");
+        n_workers = 0;
+      }
+
+      check_streaming_not_complete(wrapper);
+
+      ResultWrapper res(self, wrapper);
+      configure_result_wrapper(res, wrapper, opts);
+      if (n_workers > 1 && res.packetReader) {
+        // ParallelConverter fetches the rows by mysql_fetch_row
+        rb_warn(":packet_reader is ignored with :workers");
+        res.packetReader = false;
+      }
+
+      auto memory_pool = make_memory_pool(opts);
+
+      if (!wrapper->is_streaming) {
+        res.rewind();
+      }
+
+      std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+      arrow::Status status;
+      if (n_workers > 1) {
+        status = res.fetch_batches_in_parallel(memory_pool.get(), batch_rows, n_workers,
+                                               &batches);
+      } else {
+        status = res.fetch_batches(memory_pool.get(), batch_rows, &batches);
+      }
+      if (wrapper->is_streaming) {
+        complete_streaming(wrapper);
+        check_canceled(res);
+      }
+      check_status(status);
+
+      for (auto& batch : batches) {
+        batch = retain_memory_pool(batch, memory_pool);
+      }
+
+      // The batches are the chunks of the columns as is
+      auto schema = res.schema();
+      std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+      columns.reserve(schema->num_fields());
+      for (int i = 0; i < schema->num_fields(); ++i) {
+        arrow::ArrayVector chunks;
+        chunks.reserve(batches.size());
+        for (const auto& batch : batches) {
+          chunks.push_back(batch->column(i));
+        }
+        columns.push_back(
+          std::make_shared<arrow::ChunkedArray>(std::move(chunks), schema->field(i)->type()));
+      }
+      auto table = arrow::Table::Make(schema, std::move(columns));
+      auto gobj_table = garrow_table_new_raw(&table);
+      return GOBJ2RVAL_UNREF(gobj_table);
+    }
+
+    VALUE mysql2_result_to_arrow_table(int argc, VALUE* argv, VALUE self) {
+      VALUE exception;
+      try {
+        return mysql2_result_to_arrow_table_impl(argc, argv, self);
+      } catch (rb::State& state) {
+        state.jump();
+      } catch (Error& error) {
+        exception = error.exception();
+      }
+      rb_exc_raise(exception);
+    }
+    // The string of a symbol or string option, or default_value if it is nil
+    std::string string_option(VALUE opts, VALUE key, const char* default_value) {
+      VALUE value = rb_hash_aref(opts, key);
+      if (NIL_P(value)) {
+        return std::string(default_value);
+      }
+      value = rb::protect([&]{ return rb_obj_as_string(value); });
+      return std::string(RSTRING_PTR(value), RSTRING_LEN(value));
+    }
+
+    // Close the sink of write_arrow when it stops by an exception, e.g. an
+    // interrupt while the rows are fetched, so that the file isn't leaked
+    class SinkCloser {
+     public:
+      explicit SinkCloser(std::shared_ptr<arrow::io::OutputStream> sink)
+          : sink_(std::move(sink)) {}
+
+      ~SinkCloser() {
+        if (!sink_->closed()) {
+          ARROW_UNUSED(sink_->Close());
+        }
+      }
+
+     private:
+      std::shared_ptr<arrow::io::OutputStream> sink_;
+    };
+
+    struct WriteBatchArgs {
+      BatchWriter* writer;
+      const arrow::RecordBatch* batch;
+      arrow::Status status;
+    };
+
+    void* nogvl_write_batch(void* ptr) {
+      auto args = static_cast<WriteBatchArgs*>(ptr);
+      args->status = args->writer->write(*args->batch);
+      return nullptr;
+    }
+
+    // Fetch the rows and write them batch by batch,
+    // so that at most one batch is in memory at the same time
+    arrow::Status write_batches(ResultWrapper& res,
+                                mysql2_result_wrapper* wrapper,
+                                BatchBuilder* builder,
+                                BatchWriter* writer,
+                                bool with_gvl,
+                                int64_t batch_rows,
+                                int64_t* n_written_rows) {
+      while (!res.eof()) {
+        int64_t capacity = batch_rows;
+        if (!wrapper->is_streaming) {
+          capacity = std::min<int64_t>(capacity, wrapper->numberOfRows - *n_written_rows);
+        }
+        if (capacity > 0) {
+          ARROW_RETURN_NOT_OK(builder->reserve(capacity));
+        }
+
+        int64_t n_rows = 0;
+        ARROW_RETURN_NOT_OK(res.fetch_rows(builder, batch_rows, &n_rows));
+        if (n_rows == 0) {
+          continue;
+        }
+
+        std::shared_ptr<arrow::RecordBatch> batch;
+        ARROW_RETURN_NOT_OK(builder->flush(&batch));
+        WriteBatchArgs args{writer, batch.get(), arrow::Status::OK()};
+        if (with_gvl) {
+          nogvl_write_batch(&args);
         } else {
-          rb_raise(eMysql2Error,
-                   "You have already fetched all the rows for this query and "
-                   "streaming is true. (to reiterate you must requery).");
+          // Compression and file IO don't need the GVL
+          rb_thread_call_without_gvl(nogvl_write_batch, &args, nullptr, nullptr);
         }
-      } else { /* not streaming */
-        for (unsigned long i = 0; i < wrapper->numberOfRows; i++) {
-          (void)(res.*fetch_row_func)(rbb);
+        ARROW_RETURN_NOT_OK(args.status);
+        *n_written_rows += n_rows;
+      }
+      return arrow::Status::OK();
+    }
+
+    VALUE mysql2_result_write_arrow_impl(int argc, VALUE* argv, VALUE self) {
+      GET_RESULT(self);
+      check_result_wrapper(wrapper);
+
+      VALUE target;
+      VALUE write_opts;
+      rb_scan_args(argc, argv, "11", &target, &write_opts);
+      VALUE opts = merge_query_options(NIL_P(write_opts) ? 0 : 1, &write_opts, self);
+
+      int64_t batch_rows = batch_rows_option(opts);
+      VALUE batch_size = rb_hash_aref(opts, sym_batch_size);
+      if (!NIL_P(batch_size)) {
+        batch_rows = NUM2LL(batch_size);
+        if (batch_rows <= 0) {
+          throw_error(rb_eArgError, ":batch_size must be positive");
         }
       }
 
-      std::shared_ptr<arrow::RecordBatch> batch;
-      status = rbb->Flush(&batch);
-      if (!status.ok()) {
-        rb_raise(rb_eRuntimeError, "%s", status.message().c_str());
+      const bool to_path =
+        RB_TYPE_P(target, T_STRING) || rb_respond_to(target, rb_intern("to_path"));
+      const bool to_io = !to_path && rb_respond_to(target, rb_intern("write"));
+      if (!to_path && !to_io) {
+        VALUE inspected = rb_inspect(target);
+        throw_error(rb_eTypeError,
+                    "path or IO is expected: " +
+                    std::string(RSTRING_PTR(inspected), RSTRING_LEN(inspected)));
+      }
+      VALUE path = to_path ? rb_get_path(target) : Qnil;
+
+      const auto format = string_option(opts, sym_format, "ipc_stream");
+      const auto compression = string_option(opts, sym_compression, "");
+
+      // Everything is checked before the sink is opened, which truncates
+      // the file
+      auto status = check_batch_writer_options(format, compression);
+      if (status.IsInvalid()) {
+        throw_error(rb_eArgError, status.message());
+      }
+      check_status(status);
+
+      check_streaming_not_complete(wrapper);
+
+      ResultWrapper res(self, wrapper);
+      configure_result_wrapper(res, wrapper, opts);
+
+      auto memory_pool = make_memory_pool(opts);
+      std::unique_ptr<BatchBuilder> builder;
+      check_status(res.make_batch_builder(memory_pool.get(), &builder));
+
+      std::shared_ptr<arrow::io::OutputStream> sink;
+      if (to_path) {
+        check_status(open_file_output_stream(std::string(RSTRING_PTR(path), RSTRING_LEN(path)),
+                                             &sink));
+      } else {
+        check_status(open_ruby_output_stream(target, &sink));
       }
+      SinkCloser sink_closer(sink);
 
-      auto gobj_batch = garrow_record_batch_new_raw(&batch);
-      return GOBJ2RVAL_UNREF(gobj_batch);
+      std::unique_ptr<BatchWriter> writer;
+      check_status(make_batch_writer(format, compression, sink, res.schema(),
+                                     memory_pool.get(), &writer));
+
+      if (!wrapper->is_streaming) {
+        res.rewind();
+      }
+
+      int64_t n_written_rows = 0;
+      status = write_batches(res, wrapper, builder.get(), writer.get(), to_io,
+                             batch_rows, &n_written_rows);
+      if (status.ok()) {
+        status = writer->close();
+      } else {
+        ARROW_UNUSED(sink->Close());
+      }
+      if (wrapper->is_streaming) {
+        complete_streaming(wrapper);
+        check_canceled(res);
+      }
+      // An exception raised by IO#write is raised as is
+      rethrow_ruby_error(sink);
+      check_status(status);
+
+      return LL2NUM(n_written_rows);
     }
 
-    VALUE mysql2_result_to_arrow(int argc, VALUE* argv, VALUE self) {
+    VALUE mysql2_result_write_arrow(int argc, VALUE* argv, VALUE self) {
+      VALUE exception;
       try {
-        return rb::protect([&]{ return mysql2_result_to_arrow_impl(argc, argv, self); });
+        return mysql2_result_write_arrow_impl(argc, argv, self);
       } catch (rb::State& state) {
         state.jump();
+      } catch (Error& error) {
+        exception = error.exception();
       }
+      rb_exc_raise(exception);
     }
   }
 
@@ -614,6 +1598,28 @@ namespace mysql2_arrow {
 
     rb_define_method(mResultExtension, "to_arrow",
                      reinterpret_cast<rb::RawMethod>(mysql2_result_to_arrow), -1);
+    rb_define_method(mResultExtension, "each_record_batch",
+                     reinterpret_cast<rb::RawMethod>(mysql2_result_each_record_batch), -1);
+    rb_define_method(mResultExtension, "to_arrow_table",
+                     reinterpret_cast<rb::RawMethod>(mysql2_result_to_arrow_table), -1);
+    rb_define_method(mResultExtension, "write_arrow",
+                     reinterpret_cast<rb::RawMethod>(mysql2_result_write_arrow), -1);
+    rb_define_method(mResultExtension, "cancel_arrow",
+                     reinterpret_cast<rb::RawMethod>(mysql2_result_cancel_arrow), 0);
+
+    eCanceled = rb_define_class_under(mMysql2Arrow, "Canceled", eMysql2Error);
+
+#ifdef HAVE_MYSQL_FETCH_ROW_NONBLOCKING
+    rb_define_const(mMysql2Arrow, "NONBLOCKING_FETCH_AVAILABLE", Qtrue);
+#else
+    rb_define_const(mMysql2Arrow, "NONBLOCKING_FETCH_AVAILABLE", Qfalse);
+#endif
+
+#ifdef MYSQL2_ARROW_HAVE_PACKET_READER
+    rb_define_const(mMysql2Arrow, "PACKET_READER_AVAILABLE", Qtrue);
+#else
+    rb_define_const(mMysql2Arrow, "PACKET_READER_AVAILABLE", Qfalse);
+#endif
 
     intern_utc          = rb_intern("utc");
     intern_local        = rb_intern("local");
@@ -634,11 +1640,38 @@ namespace mysql2_arrow {
     sym_application_timezone  = ID2SYM(rb_intern("application_timezone"));
     sym_cache_rows     = ID2SYM(rb_intern("cache_rows"));
     sym_cast           = ID2SYM(rb_intern("cast"));
+    sym_rows           = ID2SYM(rb_intern("rows"));
+    sym_dictionary_columns = ID2SYM(rb_intern("dictionary_columns"));
+    sym_memory_pool    = ID2SYM(rb_intern("memory_pool"));
+    sym_memory_limit   = ID2SYM(rb_intern("memory_limit"));
+    sym_backend        = ID2SYM(rb_intern("backend"));
+    sym_bytes_allocated = ID2SYM(rb_intern("bytes_allocated"));
+    sym_peak_bytes     = ID2SYM(rb_intern("peak_bytes"));
+    sym_total_bytes_allocated = ID2SYM(rb_intern("total_bytes_allocated"));
+    sym_workers        = ID2SYM(rb_intern("workers"));
+    sym_format         = ID2SYM(rb_intern("format"));
+    sym_batch_size     = ID2SYM(rb_intern("batch_size"));
+    sym_compression    = ID2SYM(rb_intern("compression"));
+    sym_decimal_as     = ID2SYM(rb_intern("decimal_as"));
+    sym_int64_scaled   = ID2SYM(rb_intern("int64_scaled"));
+    sym_float64        = ID2SYM(rb_intern("float64"));
+    sym_nonblocking    = ID2SYM(rb_intern("nonblocking"));
+    sym_packet_reader  = ID2SYM(rb_intern("packet_reader"));
+    sym_stats          = ID2SYM(rb_intern("stats"));
+    sym_batches        = ID2SYM(rb_intern("batches"));
+    sym_bytes          = ID2SYM(rb_intern("bytes"));
+    sym_total_ns       = ID2SYM(rb_intern("total_ns"));
+    sym_fetch_ns       = ID2SYM(rb_intern("fetch_ns"));
+    sym_parse_ns       = ID2SYM(rb_intern("parse_ns"));
+    sym_reserve_ns     = ID2SYM(rb_intern("reserve_ns"));
+    sym_flush_ns       = ID2SYM(rb_intern("flush_ns"));
+    sym_sampled_rows   = ID2SYM(rb_intern("sampled_rows"));
+    sym_columns        = ID2SYM(rb_intern("columns"));
+    sym_name           = ID2SYM(rb_intern("name"));
+    sym_null_count     = ID2SYM(rb_intern("null_count"));
+
+    intern_arrow_canceled = rb_intern("@arrow_canceled");
     // sym_stream         = ID2SYM(rb_intern("stream"));
     // sym_name           = ID2SYM(rb_intern("name"));
-
-    binaryEncoding = rb_enc_find("binary");
-
-    (void)nogvl_stmt_fetch; // FIXME suppress unused warning
   }
 }
@@ -0,0 +1,599 @@
+#include "row_serializer.hpp"
+#include "parser.hpp"
+#include "timezone.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+namespace mysql2_arrow {
+  namespace {
+    constexpr int64_t kMicrosecondsPerDay = 86400LL * 1000000LL;
+
+    int64_t floor_div(int64_t value, int64_t divisor) {
+      return value / divisor - (value % divisor < 0 ? 1 : 0);
+    }
+
+    // Append the value in width digits padded by zeros
+    void append_digits(std::string* out, uint64_t value, int width) {
+      char buffer[20];
+      char* end = buffer + sizeof(buffer);
+      char* p = end;
+      do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+      } while (value > 0);
+      while (end - p < width) {
+        *--p = '0';
+      }
+      out->append(p, end);
+    }
+
+    template <typename T>
+    void append_integer(std::string* out, T value) {
+      char buffer[24];
+      auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+      out->append(buffer, result.ptr);
+    }
+
+    // The shortest of the precisions from digits10 to max_digits10 which
+    // reads back as the same value. std::to_chars of floating point values,
+    // which gives the shortest one directly, is used only where the standard
+    // library has it, as the toolchains this extension supports don't.
+    template <typename T>
+    void append_floating(std::string* out, T value) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+      char buffer[32];
+      auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+      out->append(buffer, result.ptr);
+#else
+      char buffer[32];
+      int length = 0;
+      for (int precision = std::numeric_limits<T>::digits10;
+           precision <= std::numeric_limits<T>::max_digits10;
+           ++precision) {
+        length = std::snprintf(buffer, sizeof(buffer), "%.*g", precision,
+                               static_cast<double>(value));
+        if (static_cast<T>(std::strtod(buffer, nullptr)) == value) {
+          break;
+        }
+      }
+      out->append(buffer, length);
+#endif
+    }
+
+    // YYYY-MM-DD, in the range of DATE and DATETIME
+    arrow::Status append_date(std::string* out, int64_t days) {
+      int64_t year;
+      unsigned int month, day;
+      parser::civil_from_days(days, &year, &month, &day);
+      if (year < 0 || year > 9999) {
+        return arrow::Status::Invalid("Date out of the range of MySQL: year ", year);
+      }
+      append_digits(out, year, 4);
+      out->push_back('-');
+      append_digits(out, month, 2);
+      out->push_back('-');
+      append_digits(out, day, 2);
+      return arrow::Status::OK();
+    }
+
+    // HH:MM:SS[.ffffff] of the microseconds, whose hours can exceed 24
+    void append_time(std::string* out, uint64_t microseconds) {
+      const uint64_t seconds = microseconds / 1000000;
+      const uint64_t fraction = microseconds % 1000000;
+      append_digits(out, seconds / 3600, 2);
+      out->push_back(':');
+      append_digits(out, seconds / 60 % 60, 2);
+      out->push_back(':');
+      append_digits(out, seconds % 60, 2);
+      if (fraction > 0) {
+        out->push_back('.');
+        append_digits(out, fraction, 6);
+      }
+    }
+
+    void append_null(ValueSyntax::type syntax, std::string* out) {
+      if (syntax == ValueSyntax::tsv) {
+        out->append("\\N");
+      } else {
+        out->append("NULL");
+      }
+    }
+
+    // The escapes of ESCAPED BY '\\' of LOAD DATA
+    void append_tsv_escaped(std::string* out, const char* data, size_t length) {
+      size_t start = 0;
+      for (size_t i = 0; i < length; ++i) {
+        char escaped;
+        switch (data[i]) {
+          case '\\': escaped = '\\'; break;
+          case '\t': escaped = 't';  break;
+          case '\n': escaped = 'n';  break;
+          case '\r': escaped = 'r';  break;
+          case '\0': escaped = '0';  break;
+          default: continue;
+        }
+        out->append(data + start, i - start);
+        out->push_back('\\');
+        out->push_back(escaped);
+        start = i + 1;
+      }
+      out->append(data + start, length - start);
+    }
+
+    // A string literal escaped as mysql_real_escape_string does for an
+    // ASCII compatible character set, or with the doubled quotes for
+    // NO_BACKSLASH_ESCAPES
+    void append_sql_quoted(std::string* out, const char* data, size_t length,
+                           bool no_backslash_escapes) {
+      out->push_back('\'');
+      size_t start = 0;
+      for (size_t i = 0; i < length; ++i) {
+        const char c = data[i];
+        const char* escaped;
+        if (no_backslash_escapes) {
+          if (c != '\'') {
+            continue;
+          }
+          escaped = "''";
+        } else {
+          switch (c) {
+            case '\\':   escaped = "\\\\"; break;
+            case '\'':   escaped = "\\'";  break;
+            case '"':    escaped = "\\\""; break;
+            case '\n':   escaped = "\\n";  break;
+            case '\r':   escaped = "\\r";  break;
+            case '\0':   escaped = "\\0";  break;
+            case '\032': escaped = "\\Z";  break;
+            default: continue;
+          }
+        }
+        out->append(data + start, i - start);
+        out->append(escaped);
+        start = i + 1;
+      }
+      out->append(data + start, length - start);
+      out->push_back('\'');
+    }
+
+    void append_hex(std::string* out, const uint8_t* data, size_t length) {
+      static const char digits[] = "0123456789ABCDEF";
+      for (size_t i = 0; i < length; ++i) {
+        out->push_back(digits[data[i] >> 4]);
+        out->push_back(digits[data[i] & 0x0f]);
+      }
+    }
+
+    // X'...', which doesn't depend on the character set of the connection
+    void append_sql_hex(std::string* out, const uint8_t* data, size_t length) {
+      out->append("X'");
+      append_hex(out, data, length);
+      out->push_back('\'');
+    }
+
+    template <typename ArrayType>
+    class TypedValueFormatter : public ValueFormatter {
+     public:
+      TypedValueFormatter(const std::shared_ptr<arrow::Array>& array,
+                          ValueSyntax::type syntax)
+          : array_(array),
+            typed_array_(static_cast<const ArrayType&>(*array)),
+            syntax_(syntax) {}
+
+     protected:
+      void open_quote(std::string* out) const {
+        if (syntax_ == ValueSyntax::sql) {
+          out->push_back('\'');
+        }
+      }
+
+      std::shared_ptr<arrow::Array> array_;
+      const ArrayType& typed_array_;
+      const ValueSyntax::type syntax_;
+    };
+
+    class NullFormatter : public ValueFormatter {
+     public:
+      explicit NullFormatter(ValueSyntax::type syntax) : syntax_(syntax) {}
+
+      arrow::Status append(int64_t, std::string* out) override {
+        append_null(syntax_, out);
+        return arrow::Status::OK();
+      }
+
+     private:
+      const ValueSyntax::type syntax_;
+    };
+
+    class BooleanFormatter : public TypedValueFormatter<arrow::BooleanArray> {
+     public:
+      using TypedValueFormatter::TypedValueFormatter;
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        out->push_back(typed_array_.Value(i) ? '1' : '0');
+        return arrow::Status::OK();
+      }
+    };
+
+    template <typename ArrowType>
+    class IntegerFormatter : public TypedValueFormatter<arrow::NumericArray<ArrowType>> {
+     public:
+      using TypedValueFormatter<arrow::NumericArray<ArrowType>>::TypedValueFormatter;
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        append_integer(out, this->typed_array_.Value(i));
+        return arrow::Status::OK();
+      }
+    };
+
+    template <typename ArrowType>
+    class FloatingFormatter : public TypedValueFormatter<arrow::NumericArray<ArrowType>> {
+     public:
+      using TypedValueFormatter<arrow::NumericArray<ArrowType>>::TypedValueFormatter;
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        const auto value = this->typed_array_.Value(i);
+        if (!std::isfinite(value)) {
+          return arrow::Status::Invalid("NaN and infinity can't be stored in MySQL");
+        }
+        append_floating(out, value);
+        return arrow::Status::OK();
+      }
+    };
+
+    template <typename ArrayType>
+    class DecimalFormatter : public TypedValueFormatter<ArrayType> {
+     public:
+      using TypedValueFormatter<ArrayType>::TypedValueFormatter;
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        out->append(this->typed_array_.FormatValue(i));
+        return arrow::Status::OK();
+      }
+    };
+
+    // Date32 in days, or Date64 in milliseconds
+    template <typename ArrowType>
+    class DateFormatter : public TypedValueFormatter<arrow::NumericArray<ArrowType>> {
+     public:
+      DateFormatter(const std::shared_ptr<arrow::Array>& array,
+                    ValueSyntax::type syntax,
+                    int64_t units_per_day)
+          : TypedValueFormatter<arrow::NumericArray<ArrowType>>(array, syntax),
+            units_per_day_(units_per_day) {}
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        this->open_quote(out);
+        ARROW_RETURN_NOT_OK(
+          append_date(out, floor_div(this->typed_array_.Value(i), units_per_day_)));
+        this->open_quote(out);
+        return arrow::Status::OK();
+      }
+
+     private:
+      const int64_t units_per_day_;
+    };
+
+    // The timestamps are converted into the microseconds of the wall clock
+    // of the database for the whole array at first, as ColumnWriter
+    // converts the other way for each batch
+    class TimestampFormatter : public TypedValueFormatter<arrow::TimestampArray> {
+     public:
+      TimestampFormatter(const std::shared_ptr<arrow::Array>& array,
+                         ValueSyntax::type syntax,
+                         const ValueFormatterOptions& options)
+          : TypedValueFormatter(array, syntax),
+            microseconds_(array->length()) {
+        const auto& type = static_cast<const arrow::TimestampType&>(*array->type());
+        const int64_t* values = typed_array_.raw_values();
+        for (int64_t i = 0; i < array->length(); ++i) {
+          switch (type.unit()) {
+            case arrow::TimeUnit::SECOND:
+              microseconds_[i] = values[i] * 1000000;
+              break;
+            case arrow::TimeUnit::MILLI:
+              microseconds_[i] = values[i] * 1000;
+              break;
+            case arrow::TimeUnit::MICRO:
+              microseconds_[i] = values[i];
+              break;
+            case arrow::TimeUnit::NANO:
+              // MySQL has microseconds at most
+              microseconds_[i] = floor_div(values[i], 1000);
+              break;
+          }
+        }
+        // The timestamps without a time zone are of the wall clock already
+        if (!type.timezone().empty() && options.local_time) {
+          LocalTimeOffsets offsets;
+          offsets.to_local(microseconds_.data(), array->length());
+        }
+      }
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        const int64_t value = microseconds_[i];
+        const int64_t days = floor_div(value, kMicrosecondsPerDay);
+        open_quote(out);
+        ARROW_RETURN_NOT_OK(append_date(out, days));
+        out->push_back(' ');
+        append_time(out, value - days * kMicrosecondsPerDay);
+        open_quote(out);
+        return arrow::Status::OK();
+      }
+
+     private:
+      std::vector<int64_t> microseconds_;
+    };
+
+    // Time32 or Time64 into TIME, which can be negative or over 24 hours
+    template <typename ArrowType>
+    class TimeFormatter : public TypedValueFormatter<arrow::NumericArray<ArrowType>> {
+     public:
+      TimeFormatter(const std::shared_ptr<arrow::Array>& array,
+                    ValueSyntax::type syntax)
+          : TypedValueFormatter<arrow::NumericArray<ArrowType>>(array, syntax),
+            unit_(static_cast<const ArrowType&>(*array->type()).unit()) {}
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        int64_t value = this->typed_array_.Value(i);
+        switch (unit_) {
+          case arrow::TimeUnit::SECOND:
+            value *= 1000000;
+            break;
+          case arrow::TimeUnit::MILLI:
+            value *= 1000;
+            break;
+          case arrow::TimeUnit::MICRO:
+            break;
+          case arrow::TimeUnit::NANO:
+            // Rounded toward negative infinity like TimestampFormatter
+            value = floor_div(value, 1000);
+            break;
+        }
+        this->open_quote(out);
+        if (value < 0) {
+          out->push_back('-');
+          value = -value;
+        }
+        append_time(out, static_cast<uint64_t>(value));
+        this->open_quote(out);
+        return arrow::Status::OK();
+      }
+
+     private:
+      const arrow::TimeUnit::type unit_;
+    };
+
+    // String, LargeString, Binary, LargeBinary and FixedSizeBinary;
+    // the binary values are written in hex, as literals for INSERT and
+    // as the digits for UNHEX() of LOAD DATA
+    template <typename ArrayType>
+    class BinaryFormatter : public TypedValueFormatter<ArrayType> {
+     public:
+      BinaryFormatter(const std::shared_ptr<arrow::Array>& array,
+                      ValueSyntax::type syntax,
+                      const ValueFormatterOptions& options,
+                      bool is_utf8)
+          : TypedValueFormatter<ArrayType>(array, syntax),
+            no_backslash_escapes_(options.no_backslash_escapes),
+            is_utf8_(is_utf8) {}
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        const auto value = this->typed_array_.GetView(i);
+        const auto data = reinterpret_cast<const uint8_t*>(value.data());
+        if (!is_utf8_) {
+          if (this->syntax_ == ValueSyntax::tsv) {
+            append_hex(out, data, value.size());
+          } else {
+            append_sql_hex(out, data, value.size());
+          }
+        } else if (this->syntax_ == ValueSyntax::tsv) {
+          append_tsv_escaped(out, value.data(), value.size());
+        } else {
+          append_sql_quoted(out, value.data(), value.size(), no_backslash_escapes_);
+        }
+        return arrow::Status::OK();
+      }
+
+     private:
+      const bool no_backslash_escapes_;
+      const bool is_utf8_;
+    };
+
+    // The values of the dictionary for the indices
+    class DictionaryFormatter : public TypedValueFormatter<arrow::DictionaryArray> {
+     public:
+      DictionaryFormatter(const std::shared_ptr<arrow::Array>& array,
+                          ValueSyntax::type syntax,
+                          std::unique_ptr<ValueFormatter> dictionary_formatter)
+          : TypedValueFormatter(array, syntax),
+            dictionary_formatter_(std::move(dictionary_formatter)) {}
+
+      arrow::Status append(int64_t i, std::string* out) override {
+        const int64_t index = typed_array_.GetValueIndex(i);
+        if (typed_array_.dictionary()->IsNull(index)) {
+          append_null(syntax_, out);
+          return arrow::Status::OK();
+        }
+        return dictionary_formatter_->append(index, out);
+      }
+
+     private:
+      std::unique_ptr<ValueFormatter> dictionary_formatter_;
+    };
+  }
+
+  bool is_hex_type(const arrow::DataType& type) {
+    switch (type.id()) {
+      case arrow::Type::BINARY:
+      case arrow::Type::LARGE_BINARY:
+      case arrow::Type::FIXED_SIZE_BINARY:
+        return true;
+      case arrow::Type::DICTIONARY:
+        return is_hex_type(*static_cast<const arrow::DictionaryType&>(type).value_type());
+      default:
+        return false;
+    }
+  }
+
+  arrow::Status make_value_formatter(const std::shared_ptr<arrow::Array>& array,
+                                     ValueSyntax::type syntax,
+                                     const ValueFormatterOptions& options,
+                                     std::unique_ptr<ValueFormatter>* out) {
+    switch (array->type_id()) {
+      case arrow::Type::NA:
+        out->reset(new NullFormatter(syntax));
+        break;
+      case arrow::Type::BOOL:
+        out->reset(new BooleanFormatter(array, syntax));
+        break;
+      case arrow::Type::INT8:
+        out->reset(new IntegerFormatter<arrow::Int8Type>(array, syntax));
+        break;
+      case arrow::Type::INT16:
+        out->reset(new IntegerFormatter<arrow::Int16Type>(array, syntax));
+        break;
+      case arrow::Type::INT32:
+        out->reset(new IntegerFormatter<arrow::Int32Type>(array, syntax));
+        break;
+      case arrow::Type::INT64:
+        out->reset(new IntegerFormatter<arrow::Int64Type>(array, syntax));
+        break;
+      case arrow::Type::UINT8:
+        out->reset(new IntegerFormatter<arrow::UInt8Type>(array, syntax));
+        break;
+      case arrow::Type::UINT16:
+        out->reset(new IntegerFormatter<arrow::UInt16Type>(array, syntax));
+        break;
+      case arrow::Type::UINT32:
+        out->reset(new IntegerFormatter<arrow::UInt32Type>(array, syntax));
+        break;
+      case arrow::Type::UINT64:
+        out->reset(new IntegerFormatter<arrow::UInt64Type>(array, syntax));
+        break;
+      case arrow::Type::FLOAT:
+        out->reset(new FloatingFormatter<arrow::FloatType>(array, syntax));
+        break;
+      case arrow::Type::DOUBLE:
+        out->reset(new FloatingFormatter<arrow::DoubleType>(array, syntax));
+        break;
+      case arrow::Type::DECIMAL:
+        out->reset(new DecimalFormatter<arrow::Decimal128Array>(array, syntax));
+        break;
+#if ARROW_VERSION_MAJOR >= 3
+      case arrow::Type::DECIMAL256:
+        out->reset(new DecimalFormatter<arrow::Decimal256Array>(array, syntax));
+        break;
+#endif
+      case arrow::Type::DATE32:
+        out->reset(new DateFormatter<arrow::Date32Type>(array, syntax, 1));
+        break;
+      case arrow::Type::DATE64:
+        out->reset(new DateFormatter<arrow::Date64Type>(array, syntax, 86400LL * 1000));
+        break;
+      case arrow::Type::TIMESTAMP:
+        out->reset(new TimestampFormatter(array, syntax, options));
+        break;
+      case arrow::Type::TIME32:
+        out->reset(new TimeFormatter<arrow::Time32Type>(array, syntax));
+        break;
+      case arrow::Type::TIME64:
+        out->reset(new TimeFormatter<arrow::Time64Type>(array, syntax));
+        break;
+      case arrow::Type::STRING:
+        out->reset(new BinaryFormatter<arrow::StringArray>(array, syntax, options, true));
+        break;
+      case arrow::Type::LARGE_STRING:
+        out->reset(new BinaryFormatter<arrow::LargeStringArray>(array, syntax, options, true));
+        break;
+      case arrow::Type::BINARY:
+        out->reset(new BinaryFormatter<arrow::BinaryArray>(array, syntax, options, false));
+        break;
+      case arrow::Type::LARGE_BINARY:
+        out->reset(new BinaryFormatter<arrow::LargeBinaryArray>(array, syntax, options, false));
+        break;
+      case arrow::Type::FIXED_SIZE_BINARY:
+        out->reset(new BinaryFormatter<arrow::FixedSizeBinaryArray>(array, syntax, options, false));
+        break;
+      case arrow::Type::DICTIONARY:
+        {
+          std::unique_ptr<ValueFormatter> dictionary_formatter;
+          const auto& dictionary_array = static_cast<const arrow::DictionaryArray&>(*array);
+          ARROW_RETURN_NOT_OK(make_value_formatter(dictionary_array.dictionary(),
+                                                   syntax,
+                                                   options,
+                                                   &dictionary_formatter));
+          out->reset(new DictionaryFormatter(array, syntax, std::move(dictionary_formatter)));
+        }
+        break;
+      default:
+        return arrow::Status::NotImplemented("Unsupported type to insert into MySQL: ",
+                                             array->type()->ToString());
+    }
+    return arrow::Status::OK();
+  }
+
+  RowSerializer::RowSerializer(std::vector<std::shared_ptr<arrow::RecordBatch>> batches,
+                               ValueSyntax::type syntax,
+                               const ValueFormatterOptions& options)
+      : batches_(std::move(batches)),
+        syntax_(syntax),
+        options_(options),
+        batch_index_(0),
+        row_index_(0),
+        num_rows_(0) {}
+
+  arrow::Status RowSerializer::open() {
+    return batches_.empty() ? arrow::Status::OK() : make_formatters();
+  }
+
+  arrow::Status RowSerializer::append_row(std::string* out, bool* eof) {
+    while (batch_index_ < batches_.size() &&
+           row_index_ == batches_[batch_index_]->num_rows()) {
+      ++batch_index_;
+      row_index_ = 0;
+      formatters_.clear();
+      if (batch_index_ < batches_.size()) {
+        ARROW_RETURN_NOT_OK(make_formatters());
+      }
+    }
+    if (batch_index_ == batches_.size()) {
+      *eof = true;
+      return arrow::Status::OK();
+    }
+    *eof = false;
+
+    const auto& batch = *batches_[batch_index_];
+    const int n_columns = batch.num_columns();
+    const int64_t i = row_index_;
+    if (syntax_ == ValueSyntax::sql) {
+      out->push_back('(');
+    }
+    for (int j = 0; j < n_columns; ++j) {
+      if (j > 0) {
+        out->push_back(syntax_ == ValueSyntax::tsv ? '\t' : ',');
+      }
+      if (batch.column(j)->IsNull(i)) {
+        append_null(syntax_, out);
+      } else {
+        ARROW_RETURN_NOT_OK(formatters_[j]->append(i, out));
+      }
+    }
+    out->push_back(syntax_ == ValueSyntax::tsv ? '\n' : ')');
+    ++row_index_;
+    ++num_rows_;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status RowSerializer::make_formatters() {
+    const auto& batch = *batches_[batch_index_];
+    formatters_.resize(batch.num_columns());
+    for (int j = 0; j < batch.num_columns(); ++j) {
+      ARROW_RETURN_NOT_OK(make_value_formatter(batch.column(j), syntax_, options_, &formatters_[j]));
+    }
+    return arrow::Status::OK();
+  }
+}
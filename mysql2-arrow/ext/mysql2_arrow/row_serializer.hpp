@@ -0,0 +1,90 @@
+#pragma once
+
+#include <arrow/api.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mysql2_arrow {
+  // The syntax of the serialized values:
+  //
+  // tsv: the fields of LOAD DATA ... CHARACTER SET utf8mb4 FIELDS
+  //      TERMINATED BY '\t' ESCAPED BY '\\' LINES TERMINATED BY '\n',
+  //      where NULL is \N and the binary values are the hex digits to
+  //      be loaded by UNHEX(), see is_hex_type()
+  // sql: the literals of INSERT ... VALUES
+  struct ValueSyntax {
+    enum type {
+      tsv,
+      sql
+    };
+  };
+
+  struct ValueFormatterOptions {
+    ValueFormatterOptions()
+        : local_time(true),
+          no_backslash_escapes(false) {}
+
+    // Whether the timestamps with a time zone are written in the local
+    // time, or in UTC, which is the database_timezone option of mysql2
+    bool local_time;
+    // Whether the SQL mode of the connection has NO_BACKSLASH_ESCAPES,
+    // where the quotes of SQL string literals are doubled instead
+    bool no_backslash_escapes;
+  };
+
+  // ValueFormatter appends the values of an array in the syntax.
+  //
+  // A formatter is chosen once for each column from the type of the array,
+  // as ColumnWriter is for reading; NULLs are handled by RowSerializer.
+  class ValueFormatter {
+   public:
+    virtual ~ValueFormatter() = default;
+
+    // Append the i-th value, which is not NULL, into out
+    virtual arrow::Status append(int64_t i, std::string* out) = 0;
+  };
+
+  // Whether the values of the type are written as hex digits for tsv,
+  // so that the bytes which aren't UTF-8 are loaded as they are
+  bool is_hex_type(const arrow::DataType& type);
+
+  arrow::Status make_value_formatter(const std::shared_ptr<arrow::Array>& array,
+                                     ValueSyntax::type syntax,
+                                     const ValueFormatterOptions& options,
+                                     std::unique_ptr<ValueFormatter>* out);
+
+  // RowSerializer serializes the rows of record batches one by one, as the
+  // lines of LOAD DATA for tsv or as the tuples of INSERT for sql.
+  //
+  // Nothing here needs the GVL.
+  class RowSerializer {
+   public:
+    RowSerializer(std::vector<std::shared_ptr<arrow::RecordBatch>> batches,
+                  ValueSyntax::type syntax,
+                  const ValueFormatterOptions& options);
+
+    // Prepare the formatters of the first batch, which reports the
+    // unsupported types before anything is sent
+    arrow::Status open();
+
+    // Append the next row into out, or set eof to true at the end
+    arrow::Status append_row(std::string* out, bool* eof);
+
+    int64_t num_rows() const { return num_rows_; }
+
+   private:
+    arrow::Status make_formatters();
+
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches_;
+    const ValueSyntax::type syntax_;
+    const ValueFormatterOptions options_;
+    // The index of the current batch and the next row in it
+    size_t batch_index_;
+    int64_t row_index_;
+    std::vector<std::unique_ptr<ValueFormatter>> formatters_;
+    // The rows serialized so far
+    int64_t num_rows_;
+  };
+}
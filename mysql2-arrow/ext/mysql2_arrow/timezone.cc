@@ -0,0 +1,173 @@
+#include "timezone.hpp"
+#include "parser.hpp"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace mysql2_arrow {
+  namespace {
+    constexpr int64_t kMicrosecondsPerHour = 3600LL * 1000000LL;
+
+    // The directory of the IANA time zone database on most systems
+    const char kZoneinfoDirectory[] = "/usr/share/zoneinfo/";
+
+    bool to_gmtime(time_t time, struct tm* out) {
+#ifdef _WIN32
+      return gmtime_s(out, &time) == 0;
+#else
+      return gmtime_r(&time, out) != nullptr;
+#endif
+    }
+
+    bool to_localtime(time_t time, struct tm* out) {
+#ifdef _WIN32
+      return localtime_s(out, &time) == 0;
+#else
+      return localtime_r(&time, out) != nullptr;
+#endif
+    }
+
+    // Whether the IANA time zone database has the given zone,
+    // i.e. it is not a POSIX TZ string such as "JST-9"
+    bool is_known_timezone(const std::string& name) {
+#ifdef _WIN32
+      return false;
+#else
+      return !name.empty() && name[0] != '/' &&
+        access((kZoneinfoDirectory + name).c_str(), R_OK) == 0;
+#endif
+    }
+
+    // The zone name from the path /etc/localtime links to,
+    // e.g. "/usr/share/zoneinfo/Asia/Tokyo"
+    std::string localtime_link_timezone() {
+#ifdef _WIN32
+      return std::string();
+#else
+      char path[PATH_MAX];
+      const ssize_t length = readlink("/etc/localtime", path, sizeof(path) - 1);
+      if (length < 0) {
+        return std::string();
+      }
+      path[length] = '\0';
+      const char* zoneinfo = std::strstr(path, "zoneinfo/");
+      if (!zoneinfo) {
+        return std::string();
+      }
+      return std::string(zoneinfo + std::strlen("zoneinfo/"));
+#endif
+    }
+
+    std::string current_utc_offset() {
+      const time_t now = std::time(nullptr);
+      struct tm local;
+      int64_t offset = 0;
+      if (to_localtime(now, &local)) {
+        const int64_t days = parser::days_from_civil(local.tm_year + 1900,
+                                                     local.tm_mon + 1,
+                                                     local.tm_mday);
+        offset = 86400 * days + 3600 * local.tm_hour + 60 * local.tm_min + local.tm_sec - now;
+      }
+      const char sign = offset < 0 ? '-' : '+';
+      const int64_t minutes = (offset < 0 ? -offset : offset) / 60;
+      char name[16];
+      snprintf(name, sizeof(name), "%c%02d:%02d",
+               sign, static_cast<int>(minutes / 60), static_cast<int>(minutes % 60));
+      return std::string(name);
+    }
+  }
+
+  std::string local_timezone_name() {
+    const char* tz = std::getenv("TZ");
+    if (tz && tz[0]) {
+      // ":Asia/Tokyo" is the same as "Asia/Tokyo"
+      std::string name(tz[0] == ':' ? tz + 1 : tz);
+      if (is_known_timezone(name)) {
+        return name;
+      }
+    } else {
+      auto name = localtime_link_timezone();
+      if (is_known_timezone(name)) {
+        return name;
+      }
+    }
+    return current_utc_offset();
+  }
+
+  void LocalTimeOffsets::to_utc(int64_t* values, int64_t length) {
+    int64_t last_hour = INT64_MIN;
+    int64_t last_offset = 0;
+    for (int64_t i = 0; i < length; ++i) {
+      const int64_t value = values[i];
+      // floor, for the values before the epoch
+      const int64_t hour =
+        value / kMicrosecondsPerHour - (value % kMicrosecondsPerHour < 0 ? 1 : 0);
+      if (hour != last_hour) {
+        last_hour = hour;
+        last_offset = 1000000LL * offset(hour);
+      }
+      values[i] = value - last_offset;
+    }
+  }
+
+  void LocalTimeOffsets::to_local(int64_t* values, int64_t length) {
+    int64_t last_hour = INT64_MIN;
+    int64_t last_offset = 0;
+    for (int64_t i = 0; i < length; ++i) {
+      const int64_t value = values[i];
+      const int64_t hour =
+        value / kMicrosecondsPerHour - (value % kMicrosecondsPerHour < 0 ? 1 : 0);
+      if (hour != last_hour) {
+        last_hour = hour;
+        last_offset = 1000000LL * utc_offset(hour);
+      }
+      values[i] = value + last_offset;
+    }
+  }
+
+  int64_t LocalTimeOffsets::offset(int64_t hour) {
+    auto it = offsets_.find(hour);
+    if (it != offsets_.end()) {
+      return it->second;
+    }
+    // Interpret the wall clock in the local time zone by mktime,
+    // which also resolves whether DST is in effect at the time
+    const time_t wall_clock = static_cast<time_t>(hour * 3600);
+    struct tm tm;
+    int64_t offset = 0;
+    if (to_gmtime(wall_clock, &tm)) {
+      tm.tm_isdst = -1;
+      const time_t utc = std::mktime(&tm);
+      if (utc != static_cast<time_t>(-1)) {
+        offset = static_cast<int64_t>(wall_clock) - static_cast<int64_t>(utc);
+      }
+    }
+    offsets_.emplace(hour, offset);
+    return offset;
+  }
+
+  int64_t LocalTimeOffsets::utc_offset(int64_t hour) {
+    auto it = utc_offsets_.find(hour);
+    if (it != utc_offsets_.end()) {
+      return it->second;
+    }
+    const time_t utc = static_cast<time_t>(hour * 3600);
+    struct tm tm;
+    int64_t offset = 0;
+    if (to_localtime(utc, &tm)) {
+      const int64_t days = parser::days_from_civil(tm.tm_year + 1900,
+                                                   tm.tm_mon + 1,
+                                                   tm.tm_mday);
+      offset = 86400 * days + 3600 * tm.tm_hour + 60 * tm.tm_min + tm.tm_sec - utc;
+    }
+    utc_offsets_.emplace(hour, offset);
+    return offset;
+  }
+}
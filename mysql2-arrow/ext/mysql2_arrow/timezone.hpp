@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace mysql2_arrow {
+  // The name of the local time zone for the timezone of Arrow timestamp
+  // types: an IANA time zone name such as "Asia/Tokyo" if it is known,
+  // or the current UTC offset such as "+09:00" otherwise.
+  std::string local_timezone_name();
+
+  // LocalTimeOffsets converts timestamps of the local wall clock, which is
+  // how MySQL returns DATETIME values with database_timezone: :local,
+  // into timestamps since the UNIX epoch in UTC.
+  //
+  // The UTC offset changes at most once in an hour in practice, so that it
+  // is looked up once for each hour of the wall clock and cached.
+  class LocalTimeOffsets {
+   public:
+    // Convert the microseconds of the local wall clock into UTC in place
+    void to_utc(int64_t* values, int64_t length);
+
+    // Convert the microseconds since the UNIX epoch in UTC into the local
+    // wall clock in place, for writing DATETIME values
+    void to_local(int64_t* values, int64_t length);
+
+   private:
+    // The UTC offset in seconds at the given hour since the UNIX epoch
+    // of the local wall clock
+    int64_t offset(int64_t hour);
+
+    // The UTC offset in seconds at the given hour since the UNIX epoch
+    int64_t utc_offset(int64_t hour);
+
+    std::unordered_map<int64_t, int64_t> offsets_;
+    std::unordered_map<int64_t, int64_t> utc_offsets_;
+  };
+}
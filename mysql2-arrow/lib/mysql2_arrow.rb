@@ -1,4 +1,7 @@
 require "mysql2_arrow/version"
+require "mysql2_arrow/client_extension"
+require "mysql2_arrow/fetch_stats"
+require "mysql2_arrow/memory_stats"
 require "mysql2"
 require "arrow"
 
@@ -9,4 +12,8 @@ rescue LoadError
   require "mysql2_arrow.so"
 end
 
+Mysql2::Client.include Mysql2Arrow::ClientExtension
 Mysql2::Result.include Mysql2Arrow::ResultExtension
+Arrow::RecordBatch.include Mysql2Arrow::FetchStats
+Arrow::RecordBatch.include Mysql2Arrow::MemoryStats
+Arrow::RecordBatch.include Mysql2Arrow::RecordBatchExtension
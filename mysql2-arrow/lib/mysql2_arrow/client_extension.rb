@@ -0,0 +1,90 @@
+module Mysql2Arrow
+  module ClientExtension
+    # The errors of LOAD DATA LOCAL INFILE disabled by the server or by the
+    # client: ER_NOT_ALLOWED_COMMAND, ER_CLIENT_LOCAL_FILES_DISABLED and
+    # CR_LOAD_DATA_LOCAL_INFILE_REJECTED
+    LOCAL_INFILE_DISABLED_ERRORS = [1148, 3948, 2068].freeze
+
+    # The bytes left for the network overhead of an INSERT statement
+    # under max_allowed_packet
+    STATEMENT_MARGIN_BYTES = 1024
+    private_constant :STATEMENT_MARGIN_BYTES
+
+    # Insert the rows of an Arrow::Table or an Arrow::RecordBatch into
+    # the table, which can be "database.table", and return the number of
+    # the inserted rows. The columns are matched by the names of the
+    # fields.
+    #
+    # The rows with duplicate keys are skipped with ignore: true as
+    # INSERT IGNORE does, and raise Mysql2::Error otherwise.
+    #
+    # The rows are streamed as the file of LOAD DATA LOCAL INFILE,
+    # which needs local_infile: true of the client and local_infile of
+    # the server. LOAD DATA LOCAL skips the rows with duplicate keys and
+    # loads the values it can't store with warnings, so unless
+    # ignore: true, Mysql2::Error is raised after the statement when a
+    # row is not inserted or there is a warning; the other rows are
+    # inserted unless the transaction is rolled back.
+    # If it is disabled, or with local_infile: false, the rows are
+    # inserted by multi-row INSERT statements of at most
+    # max_statement_bytes, max_allowed_packet of the server by default.
+    #
+    # Timestamps with a time zone are written in the database_timezone
+    # of the query options, and the others as they are.
+    def insert_arrow(table_name, data,
+                     local_infile: true,
+                     ignore: false,
+                     max_statement_bytes: nil,
+                     **options)
+      options = query_options.merge(options)
+      quoted_table_name = table_name.to_s.split(".").collect do |name|
+        quote_arrow_identifier(name)
+      end.join(".")
+      modifier = ignore ? "IGNORE " : ""
+
+      if local_infile
+        begin
+          n_rows, n_warnings = arrow_local_infile(data, **options) do |clause|
+            query("LOAD DATA LOCAL INFILE 'arrow' #{modifier}" +
+                  "INTO TABLE #{quoted_table_name} #{clause}")
+            [affected_rows, warning_count]
+          end
+        rescue Mysql2::Error => error
+          raise unless LOCAL_INFILE_DISABLED_ERRORS.include?(error.error_number)
+        else
+          if !ignore && (n_rows != data.n_rows || n_warnings > 0)
+            raise Mysql2::Error.new("LOAD DATA LOCAL inserted #{n_rows} rows " +
+                                    "of #{data.n_rows} rows " +
+                                    "with #{n_warnings} warnings")
+          end
+          return n_rows
+        end
+      end
+
+      quoted_column_names = data.schema.fields.collect do |field|
+        quote_arrow_identifier(field.name)
+      end.join(", ")
+      max_statement_bytes ||= max_arrow_statement_bytes
+      n_rows = 0
+      prefix = "INSERT #{modifier}INTO #{quoted_table_name} (#{quoted_column_names}) VALUES "
+      each_arrow_insert_statement(prefix, data,
+                                  max_statement_bytes: max_statement_bytes,
+                                  **options) do |sql|
+        query(sql)
+        n_rows += affected_rows
+      end
+      n_rows
+    end
+
+    private
+
+    def quote_arrow_identifier(name)
+      "`#{name.gsub("`", "``")}`"
+    end
+
+    def max_arrow_statement_bytes
+      max_allowed_packet = query("SELECT @@max_allowed_packet", as: :array).first.first
+      [max_allowed_packet - STATEMENT_MARGIN_BYTES, STATEMENT_MARGIN_BYTES].max
+    end
+  end
+end
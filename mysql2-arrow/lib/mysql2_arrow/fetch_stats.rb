@@ -0,0 +1,27 @@
+module Mysql2Arrow
+  module FetchStats
+    # The statistics of the conversion by the to_arrow or
+    # each_record_batch call with stats: true which made this record
+    # batch, when it was made:
+    #
+    # * :rows - the rows converted
+    # * :bytes - the bytes of the values read from the result
+    # * :batches - the record batches made
+    # * :total_ns - the nanoseconds of the whole conversion
+    # * :fetch_ns - the nanoseconds of fetching the rows from the
+    #   connection by mysql_fetch_row or mysql_stmt_fetch
+    # * :parse_ns - the nanoseconds of parsing the values and appending
+    #   them into the builders, including their growth
+    # * :reserve_ns - the nanoseconds of reserving the builders for batches
+    # * :flush_ns - the nanoseconds of finishing the builders into arrays
+    # * :sampled_rows - the rows :fetch_ns and :parse_ns are estimated from
+    # * :columns - the array of the hashes of :name, :parse_ns and
+    #   :null_count of each column
+    #
+    # :fetch_ns and :parse_ns are estimated from every 64th row, which keeps
+    # the overhead of the statistics low.
+    #
+    # nil without stats: true.
+    attr_reader :fetch_stats
+  end
+end
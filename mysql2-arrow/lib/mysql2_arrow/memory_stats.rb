@@ -0,0 +1,14 @@
+module Mysql2Arrow
+  module MemoryStats
+    # The memory statistics of the to_arrow or each_record_batch call
+    # which made this record batch, when it was made:
+    #
+    # * :backend - the name of the memory pool
+    # * :bytes_allocated - the bytes allocated by the call and not freed yet
+    # * :peak_bytes - the maximum of :bytes_allocated
+    # * :total_bytes_allocated - the bytes allocated by the call in total
+    #
+    # nil for the record batches not made by mysql2-arrow.
+    attr_reader :memory_stats
+  end
+end
@@ -15,6 +15,72 @@
 # specific language governing permissions and limitations
 # under the License.
 
+require "stringio"
+require "tempfile"
+
 require "mysql2_arrow"
 
 require "test-unit"
+
+module Helper
+  # A minimal Fiber::Scheduler for the tests of the nonblocking
+  # conversions, which waits for the readable IOs by IO.select
+  class FiberScheduler
+    def initialize
+      @readable = {}
+      @sleeping = {}
+      @ready = []
+    end
+
+    def fiber(&block)
+      fiber = Fiber.new(blocking: false, &block)
+      fiber.resume
+      fiber
+    end
+
+    def io_wait(io, events, _timeout)
+      @readable[io] = Fiber.current
+      Fiber.yield
+      events
+    end
+
+    def kernel_sleep(duration = nil)
+      @sleeping[Fiber.current] = duration && now + duration
+      Fiber.yield
+    end
+
+    def block(_blocker, timeout = nil)
+      kernel_sleep(timeout)
+    end
+
+    def unblock(_blocker, fiber)
+      @ready << fiber
+    end
+
+    def close
+      run
+    end
+
+    private
+
+    def now
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+
+    def run
+      until @readable.empty? && @sleeping.empty? && @ready.empty?
+        timeout = @ready.empty? ? 0.01 : 0
+        readable, = IO.select(@readable.keys, nil, nil, timeout)
+        (readable || []).each { |io| @ready << @readable.delete(io) }
+        @sleeping.each do |fiber, deadline|
+          @ready << fiber if deadline && deadline <= now
+        end
+        ready, @ready = @ready, []
+        ready.each do |fiber|
+          @sleeping.delete(fiber)
+          fiber.resume if fiber.alive?
+        end
+      end
+    end
+  end
+end
@@ -0,0 +1,140 @@
+# frozen_string_literal: true
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+class InternalTest < Test::Unit::TestCase
+  def setup
+    unless Mysql2Arrow.const_defined?(:Internal)
+      omit("Mysql2Arrow::Internal needs extconf.rb --enable-internal")
+    end
+  end
+
+  sub_test_case(".parse_double") do
+    test("valid") do
+      assert_equal([1500.0, -0.0025, 100.0, 1e-5],
+                   ["1.5e3", "-2.5E-3", "+1e+2", "1e-5"].collect do |value|
+                     Mysql2Arrow::Internal.parse_double(value)
+                   end)
+    end
+
+    test("double signs in exponent") do
+      assert_equal([nil, nil, nil],
+                   ["1e--5", "1e+-3", "1e-+3"].collect do |value|
+                     Mysql2Arrow::Internal.parse_double(value)
+                   end)
+    end
+
+    test("empty exponent") do
+      assert_equal([nil, nil, nil],
+                   ["1e", "1e+", "1E-"].collect do |value|
+                     Mysql2Arrow::Internal.parse_double(value)
+                   end)
+    end
+  end
+
+  sub_test_case(".parse_float") do
+    test("double signs in exponent") do
+      assert_equal([1.5, nil, nil],
+                   ["15e-1", "15e--1", "15e"].collect do |value|
+                     Mysql2Arrow::Internal.parse_float(value)
+                   end)
+    end
+  end
+
+  sub_test_case(".split_row_packet") do
+    # Hand-written row packets of the text protocol, without the packet
+    # header, and the number of the fields
+    data("NULL",
+         [["a", nil], "01 61 fb", 2])
+    data("empty",
+         [[""], "00", 1])
+    data("0xfc",
+         [["x" * 300], "fc 2c 01" + " 78" * 300, 1])
+    data("0xfd",
+         [["x" * 70_000], "fd 70 11 01" + " 78" * 70_000, 1])
+    data("0xfe",
+         [["abc"], "fe 03 00 00 00 00 00 00 00 61 62 63", 1])
+    test("valid") do |(expected, packet, n_fields)|
+      assert_equal(expected,
+                   Mysql2Arrow::Internal.split_row_packet(decode(packet), n_fields))
+    end
+
+    data("truncated value",
+         ["05 61 62", 1])
+    data("truncated length",
+         ["fc 03", 1])
+    data("missing field",
+         ["01 61", 2])
+    data("trailing bytes",
+         ["01 61 62", 1])
+    data("0xff",
+         ["ff", 1])
+    test("malformed") do |(packet, n_fields)|
+      assert_raise(Mysql2::Error) do
+        Mysql2Arrow::Internal.split_row_packet(decode(packet), n_fields)
+      end
+    end
+
+    def decode(packet)
+      [packet.delete(" ")].pack("H*")
+    end
+  end
+
+  sub_test_case(".parse_terminator_packet") do
+    # Hand-written packets at the end of the rows: EOF packets, and
+    # OK packets if the client and the server deprecate EOF
+    data("EOF",
+         [[2, 0x0022], "fe 02 00 22 00", false])
+    data("OK",
+         [[3, 0x0022], "fe 00 00 22 00 03 00", true])
+    data("OK with session state",
+         [[1, 0x4022], "fe 00 00 22 40 01 00 00 03 01 02 03", true])
+    data("short EOF",
+         [nil, "fe 02 00", false])
+    data("short OK",
+         [nil, "fe 00 00 22", true])
+    test("parse") do |(expected, packet, deprecate_eof)|
+      assert_equal(expected,
+                   Mysql2Arrow::Internal.parse_terminator_packet(decode(packet),
+                                                                 deprecate_eof))
+    end
+
+    def decode(packet)
+      [packet.delete(" ")].pack("H*")
+    end
+  end
+
+  sub_test_case(".parse_error_packet") do
+    test("with SQL state") do
+      packet = "\xff\x15\x04#28000Access denied".b
+      assert_equal([1045, "28000", "Access denied"],
+                   Mysql2Arrow::Internal.parse_error_packet(packet))
+    end
+
+    test("without SQL state") do
+      packet = "\xff\x15\x04Access denied".b
+      assert_equal([1045, "HY000", "Access denied"],
+                   Mysql2Arrow::Internal.parse_error_packet(packet))
+    end
+
+    test("without error code") do
+      assert_equal([0, "HY000", ""],
+                   Mysql2Arrow::Internal.parse_error_packet("\xff".b))
+    end
+  end
+end
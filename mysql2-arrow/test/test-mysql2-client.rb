@@ -0,0 +1,145 @@
+# frozen_string_literal: true
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+class Mysql2ClientTest < Test::Unit::TestCase
+  def setup
+    @client = Mysql2::Client.new(
+      host: "localhost",
+      username: "root",
+      database: "test",
+      local_infile: true
+    )
+    @client.query(<<~SQL)
+      CREATE TEMPORARY TABLE insert_arrow_test (
+        id INT NOT NULL PRIMARY KEY
+        , name VARCHAR(255)
+        , data BLOB
+        , price DECIMAL(10, 2)
+        , birthday DATE
+        , created_at DATETIME(6)
+      )
+    SQL
+    @table = Arrow::Table.new(
+      "id" => Arrow::Int32Array.new([1, 2, 3]),
+      "name" => Arrow::StringArray.new(["tab\tnewline\n\\'\"", nil, "日本語"]),
+      "data" => Arrow::BinaryArray.new(["\x00\xff".b, "", nil]),
+      "price" => Arrow::Decimal128Array.new(Arrow::Decimal128DataType.new(10, 2),
+                                            ["1.25", nil, "-100.00"]),
+      "birthday" => Arrow::Date32Array.new([Date.new(2000, 1, 31), nil, Date.new(1970, 1, 1)]),
+      "created_at" => Arrow::TimestampArray.new(:micro,
+                                                [Time.utc(2020, 2, 29, 12, 34, 56, 789012),
+                                                 nil,
+                                                 Time.utc(1970, 1, 2)])
+    )
+  end
+
+  def select_rows
+    @client.query("SELECT * FROM insert_arrow_test ORDER BY id",
+                  as: :array,
+                  database_timezone: :utc,
+                  cast_booleans: false).to_a
+  end
+
+  def expected_rows
+    [
+      [
+        1,
+        "tab\tnewline\n\\'\"",
+        "\x00\xff".b,
+        BigDecimal("1.25"),
+        Date.new(2000, 1, 31),
+        Time.utc(2020, 2, 29, 12, 34, 56, 789012),
+      ],
+      [2, nil, "".b, nil, nil, nil],
+      [3, "日本語", nil, BigDecimal("-100"), Date.new(1970, 1, 1), Time.utc(1970, 1, 2)],
+    ]
+  end
+
+  data("local_infile", true)
+  data("INSERT", false)
+  test("#insert_arrow") do |local_infile|
+    assert_equal(3,
+                 @client.insert_arrow("insert_arrow_test", @table,
+                                      local_infile: local_infile,
+                                      database_timezone: :utc))
+    assert_equal(expected_rows,
+                 select_rows)
+  end
+
+  data("local_infile", true)
+  data("INSERT", false)
+  test("#insert_arrow duplicate keys") do |local_infile|
+    @client.insert_arrow("insert_arrow_test", @table, local_infile: local_infile)
+    assert_raise(Mysql2::Error) do
+      @client.insert_arrow("insert_arrow_test", @table, local_infile: local_infile)
+    end
+  end
+
+  data("local_infile", true)
+  data("INSERT", false)
+  test("#insert_arrow ignore: true") do |local_infile|
+    table = Arrow::Table.new("id" => Arrow::Int32Array.new([3, 4]))
+    @client.insert_arrow("insert_arrow_test", @table,
+                         local_infile: local_infile,
+                         database_timezone: :utc)
+    assert_equal(1,
+                 @client.insert_arrow("insert_arrow_test", table,
+                                      local_infile: local_infile,
+                                      ignore: true))
+    assert_equal(expected_rows + [[4, nil, nil, nil, nil, nil]],
+                 select_rows)
+  end
+
+  test("#insert_arrow record batch in chunks") do
+    record_batch = @table.each_record_batch.first
+    assert_equal(3,
+                 @client.insert_arrow("insert_arrow_test", record_batch,
+                                      local_infile: false,
+                                      max_statement_bytes: 1,
+                                      database_timezone: :utc))
+    assert_equal(expected_rows,
+                 select_rows)
+  end
+
+  test("#each_arrow_insert_statement floating point and time values") do
+    table = Arrow::Table.new(
+      "float" => Arrow::FloatArray.new([0.1, -2.5]),
+      "double" => Arrow::DoubleArray.new([0.1, 1.0 / 3]),
+      "time" => Arrow::Time64Array.new(:nano, [1_500, -1_500])
+    )
+    statements = []
+    @client.each_arrow_insert_statement("INSERT INTO t VALUES ", table) do |sql|
+      statements << sql
+    end
+    assert_equal([
+                   "INSERT INTO t VALUES " +
+                   "(0.1,0.1,'00:00:00.000001')," +
+                   "(-2.5,0.3333333333333333,'-00:00:00.000002')",
+                 ],
+                 statements)
+  end
+
+  test("#insert_arrow unsupported type") do
+    table = Arrow::Table.new("id" => Arrow::ListArray.new(Arrow::ListDataType.new(:int32),
+                                                          [[1]]))
+    assert_raise(ArgumentError) do
+      @client.insert_arrow("insert_arrow_test", table)
+    end
+  end
+end
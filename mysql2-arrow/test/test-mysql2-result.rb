@@ -54,4 +54,474 @@ class Mysql2ResultTest < Test::Unit::TestCase
     assert_equal(14,
                  record_batch.n_columns)
   end
+
+  test("#to_arrow numeric values") do
+    sql = <<~SQL
+      SELECT
+        tiny_int_test
+        , small_int_test
+        , medium_int_test
+        , int_test
+        , big_int_test
+        , double_test
+      FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.transpose
+    record_batch = @client.query(sql).to_arrow
+    expected.each_with_index do |values, i|
+      assert_equal(values,
+                   record_batch[i].to_a)
+    end
+  end
+
+  test("#to_arrow decimal values") do
+    sql = <<~SQL
+      SELECT
+        decimal_test
+        , CAST(decimal_test AS DECIMAL(65, 10)) AS wide_decimal_test
+      FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.transpose
+    record_batch = @client.query(sql).to_arrow
+    wide_type = record_batch.schema.fields[1].data_type
+    assert_equal([Arrow::Decimal256DataType, 65, 10],
+                 [wide_type.class, wide_type.precision, wide_type.scale])
+    assert_equal(expected,
+                 [record_batch[0].to_a, record_batch[1].to_a])
+  end
+
+  test("#to_arrow with decimal_as") do
+    sql = "SELECT CAST(decimal_test AS DECIMAL(18, 2)) FROM mysql2_test LIMIT 1000"
+    expected = @client.query(sql, as: :array).to_a.flatten
+    scaled = @client.query(sql).to_arrow(decimal_as: :int64_scaled)[0]
+    assert_equal(expected.map { |value| value && (value * 100).to_i },
+                 scaled.to_a)
+    float = @client.query(sql).to_arrow(decimal_as: :float64)[0]
+    assert_equal(expected.map { |value| value&.to_f },
+                 float.to_a)
+  end
+
+  test("#to_arrow timestamp values with timezones") do
+    sql = <<~SQL
+      SELECT date_time_test, timestamp_test FROM mysql2_test LIMIT 1000
+    SQL
+    [:utc, :local].each do |timezone|
+      options = {
+        database_timezone: timezone,
+        application_timezone: timezone,
+      }
+      expected = @client.query(sql, **options, as: :array).to_a.transpose
+      record_batch = @client.query(sql, **options).to_arrow
+      assert_equal(expected,
+                   [record_batch[0].to_a, record_batch[1].to_a])
+    end
+  end
+
+  test("#to_arrow NULL and NOT NULL values") do
+    sql = <<~SQL
+      SELECT
+        id
+        , IF(id % 3 = 0, int_test, NULL) AS nullable_int_test
+        , IF(id % 5 = 0, NULL, double_test) AS nullable_double_test
+        , IF(id % 7 = 0, NULL, date_time_test) AS nullable_date_time_test
+      FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.transpose
+    record_batch = @client.query(sql).to_arrow
+    assert_equal(expected,
+                 record_batch.columns.collect(&:to_a))
+    assert_equal([0] + expected.drop(1).collect {|values| values.count(nil)},
+                 record_batch.columns.collect(&:n_nulls))
+  end
+
+  test("#to_arrow ENUM and SET values") do
+    sql = <<~SQL
+      SELECT enum_test, set_test FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.transpose
+    record_batch = @client.query(sql).to_arrow
+    assert_equal([Arrow::DictionaryDataType, Arrow::ListDataType],
+                 record_batch.schema.fields.collect {|field| field.data_type.class})
+    assert_equal(expected[0],
+                 record_batch[0].to_a)
+    assert_equal(expected[1],
+                 record_batch[1].to_a.collect {|members| members&.join(",")})
+  end
+
+  test("#to_arrow with dictionary_columns") do
+    sql = <<~SQL
+      SELECT int_test, varchar_test FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.transpose
+    record_batch = @client.query(sql, dictionary_columns: [:varchar_test]).to_arrow
+    assert_equal(Arrow::DictionaryDataType,
+                 record_batch.schema[:varchar_test].data_type.class)
+    assert_equal(expected[1],
+                 record_batch[1].to_a)
+  end
+
+  test("#to_arrow with binary dictionary_columns") do
+    sql = <<~SQL
+      SELECT binary_test FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.flatten
+    record_batch = @client.query(sql, dictionary_columns: [:binary_test]).to_arrow
+    assert_equal(Arrow::BinaryDataType,
+                 record_batch.schema[:binary_test].data_type.value_data_type.class)
+    assert_equal(expected,
+                 record_batch[0].to_a)
+  end
+
+  test("#to_arrow LONGTEXT values") do
+    sql = <<~SQL
+      SELECT text_test, long_text_test FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a.transpose
+    record_batch = @client.query(sql).to_arrow
+    assert_equal([
+                   Arrow::StringDataType,
+                   Arrow::LargeStringDataType,
+                 ],
+                 record_batch.schema.fields.collect {|field| field.data_type.class})
+    expected.each_with_index do |values, i|
+      assert_equal(values,
+                   record_batch[i].to_a)
+    end
+  end
+
+  test("#to_arrow with cast: false") do
+    sql = <<~SQL
+      SELECT int_test, varchar_test, binary_test FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, cast: false, as: :array).to_a.transpose
+    record_batch = @client.query(sql, cast: false).to_arrow
+    assert_equal([
+                   Arrow::StringDataType,
+                   Arrow::StringDataType,
+                   Arrow::BinaryDataType,
+                 ],
+                 record_batch.schema.fields.collect {|field| field.data_type.class})
+    expected.each_with_index do |values, i|
+      assert_equal(values,
+                   record_batch[i].to_a)
+    end
+  end
+
+  test("#to_arrow with memory_pool") do
+    record_batch = @result.to_arrow(memory_pool: :arena)
+    assert_equal([30_000, "arena"],
+                 [record_batch.n_rows, record_batch.memory_stats[:backend]])
+    assert_operator(record_batch.memory_stats[:bytes_allocated],
+                    :<=,
+                    record_batch.memory_stats[:peak_bytes])
+  end
+
+  test("#to_arrow with memory_limit") do
+    assert_raise(RuntimeError) do
+      @result.to_arrow(memory_limit: 1024)
+    end
+  end
+
+  test("#to_arrow with memory_limit of arena") do
+    assert_raise(RuntimeError) do
+      @result.to_arrow(memory_pool: :arena, memory_limit: 64 * 1024)
+    end
+  end
+
+  test("#to_arrow with stats") do
+    record_batch = @result.to_arrow(stats: true)
+    stats = record_batch.fetch_stats
+    assert_equal([30_000, 1, record_batch.schema.fields.collect(&:name)],
+                 [stats[:rows], stats[:batches], stats[:columns].collect {|column| column[:name]}])
+    assert_operator(stats[:sampled_rows], :>, 0)
+    assert_operator(stats[:bytes], :>, 0)
+    assert_operator(stats[:parse_ns], :<=, stats[:total_ns])
+    assert_equal(record_batch.columns.collect(&:n_nulls),
+                 stats[:columns].collect {|column| column[:null_count]})
+  end
+
+  test("#to_arrow without stats") do
+    assert_nil(@result.to_arrow.fetch_stats)
+  end
+
+  test("RecordBatch#to_rows") do
+    sql = <<~SQL
+      SELECT
+        int_test
+        , double_test
+        , decimal_test
+        , varchar_test
+        , date_test
+        , date_time_test
+      FROM mysql2_test LIMIT 1000
+    SQL
+    expected = @client.query(sql, as: :array).to_a
+    record_batch = @client.query(sql).to_arrow
+    assert_equal(expected,
+                 record_batch.to_rows)
+    assert_equal(@client.query(sql).to_a,
+                 record_batch.to_rows(as: :hash))
+  end
+
+  test("RecordBatch#to_rows dates before the Gregorian reform") do
+    sql = <<~SQL
+      SELECT
+        CAST('1000-01-01' AS DATE) AS old_date
+        , CAST('1582-10-04' AS DATE) AS julian_date
+        , CAST('1582-10-15' AS DATE) AS gregorian_date
+    SQL
+    expected = @client.query(sql, as: :array).to_a
+    assert_equal(expected,
+                 @client.query(sql).to_arrow.to_rows)
+  end
+
+  test("RecordBatch#to_rows with decimal_as: :int64_scaled") do
+    sql = "SELECT CAST(decimal_test AS DECIMAL(18, 2)) FROM mysql2_test LIMIT 1000"
+    expected = @client.query(sql, as: :array).to_a
+    record_batch = @client.query(sql).to_arrow(decimal_as: :int64_scaled)
+    assert_equal(expected,
+                 record_batch.to_rows)
+  end
+
+  test("#to_arrow_table with workers") do
+    expected = @result.to_arrow
+    table = @result.to_arrow_table(rows: 7_000, workers: 4)
+    assert_kind_of(Arrow::Table,
+                   table)
+    assert_equal([30_000, 5],
+                 [table.n_rows, table[0].data.n_chunks])
+    assert_equal([expected[4].to_a, expected[8].to_a],
+                 [table[4].data.to_a, table[8].data.to_a])
+  end
+
+  test("#to_arrow_table with workers and stream: true") do
+    result = @client.query(<<~SQL, stream: true, cache_rows: false)
+      SELECT int_test, varchar_test FROM mysql2_test LIMIT 30000
+    SQL
+    table = result.to_arrow_table(rows: 10_000, workers: 2)
+    expected = @client.query(<<~SQL, as: :array).to_a.transpose
+      SELECT int_test, varchar_test FROM mysql2_test LIMIT 30000
+    SQL
+    assert_equal(expected,
+                 [table[0].data.to_a, table[1].data.to_a])
+  end
+
+  test("#write_arrow") do
+    expected = @result.to_arrow
+    Tempfile.create(["mysql2-arrow", ".arrows"]) do |file|
+      n_rows = @result.write_arrow(file.path,
+                                   format: :ipc_stream,
+                                   batch_size: 12_000,
+                                   compression: :zstd)
+      assert_equal(30_000,
+                   n_rows)
+      record_batches = Arrow::MemoryMappedInputStream.open(file.path) do |input|
+        Arrow::RecordBatchStreamReader.new(input).to_a
+      end
+      assert_equal([[12_000, 12_000, 6_000], expected[4].to_a],
+                   [record_batches.map(&:n_rows),
+                    record_batches.flat_map { |record_batch| record_batch[4].to_a }])
+    end
+  end
+
+  test("#write_arrow with invalid compression") do
+    Tempfile.create(["mysql2-arrow", ".arrows"]) do |file|
+      file.write("existing")
+      file.close
+      assert_raise(ArgumentError) do
+        @result.write_arrow(file.path, compression: :snappy)
+      end
+      assert_equal("existing",
+                   File.read(file.path))
+    end
+  end
+
+  test("#write_arrow to IO") do
+    io = StringIO.new(+"")
+    @result.write_arrow(io, format: :feather)
+    record_batches = Arrow::BufferInputStream.open(Arrow::Buffer.new(io.string)) do |input|
+      Arrow::RecordBatchFileReader.new(input).to_a
+    end
+    assert_equal(30_000,
+                 record_batches.sum(&:n_rows))
+  end
+
+  test("#each_record_batch") do
+    n_rows = []
+    @result.each_record_batch(rows: 12_000) do |record_batch|
+      assert_equal(14,
+                   record_batch.n_columns)
+      n_rows << record_batch.n_rows
+    end
+    assert_equal([12_000, 12_000, 6_000],
+                 n_rows)
+  end
+
+  test("#each_record_batch with stream: true") do
+    result = @client.query(<<~SQL, stream: true, cache_rows: false)
+      SELECT int_test, varchar_test FROM mysql2_test LIMIT 30000
+    SQL
+    assert_equal([10_000, 10_000, 10_000],
+                 result.each_record_batch(rows: 10_000).map(&:n_rows))
+    assert_raise(Mysql2::Error) do
+      result.each_record_batch(rows: 10_000) {}
+    end
+  end
+
+  test("#each_record_batch with an exception in the block and stream: true") do
+    result = @client.query(<<~SQL, stream: true, cache_rows: false)
+      SELECT int_test, varchar_test FROM mysql2_test LIMIT 30000
+    SQL
+    n_rows = 0
+    assert_raise(RuntimeError.new("stop")) do
+      result.each_record_batch(rows: 10_000) do |record_batch|
+        n_rows += record_batch.n_rows
+        raise "stop"
+      end
+    end
+    assert_equal([10_000, [1]],
+                 [n_rows, @client.query("SELECT 1", as: :array).first])
+  end
+
+  test("#each_record_batch interrupted by Thread#raise with stream: true") do
+    result = @client.query(<<~SQL, stream: true, cache_rows: false)
+      SELECT int_test, varchar_test FROM mysql2_test LIMIT 30000
+    SQL
+    thread = Thread.current
+    raiser = nil
+    n_rows = 0
+    assert_raise(Interrupt) do
+      result.each_record_batch(rows: 1) do |record_batch|
+        n_rows += record_batch.n_rows
+        # Raised while the next rows are fetched without the GVL
+        raiser ||= Thread.new { thread.raise(Interrupt) }
+      end
+    end
+    raiser.join
+    assert_operator(n_rows, :<, 30_000)
+    assert_equal([1],
+                 @client.query("SELECT 1", as: :array).first)
+  end
+
+  test("#each_record_batch with nonblocking: true") do
+    omit("mysql_fetch_row_nonblocking is not available") unless Mysql2Arrow::NONBLOCKING_FETCH_AVAILABLE
+    sql = "SELECT int_test, varchar_test FROM mysql2_test LIMIT 30000"
+    expected = @client.query(sql, as: :array).to_a.transpose
+    result = @client.query(sql, stream: true, cache_rows: false)
+    record_batches = result.each_record_batch(rows: 10_000, nonblocking: true).to_a
+    assert_equal(expected,
+                 [record_batches.flat_map { |record_batch| record_batch[0].to_a },
+                  record_batches.flat_map { |record_batch| record_batch[1].to_a }])
+  end
+
+  test("#each_record_batch with packet_reader: true") do
+    omit("my_net_read is not available") unless Mysql2Arrow::PACKET_READER_AVAILABLE
+    sql = <<~SQL
+      SELECT
+        int_test
+        , double_test
+        , decimal_test
+        , varchar_test
+        , long_text_test
+        , date_time_test
+        , IF(int_test % 3 = 0, NULL, int_test) AS nullable_int_test
+      FROM mysql2_test LIMIT 30000
+    SQL
+    expected = @client.query(sql, stream: true, cache_rows: false).to_arrow
+    result = @client.query(sql, stream: true, cache_rows: false)
+    record_batches = result.each_record_batch(rows: 10_000, packet_reader: true).to_a
+    assert_equal([10_000, 10_000, 10_000],
+                 record_batches.collect(&:n_rows))
+    expected.columns.each_with_index do |column, i|
+      assert_equal(column.to_a,
+                   record_batches.flat_map { |record_batch| record_batch[i].to_a })
+    end
+    assert_equal([1],
+                 @client.query("SELECT 1", as: :array).first)
+  end
+
+  test("#to_arrow with packet_reader: true and an error in the rows") do
+    omit("my_net_read is not available") unless Mysql2Arrow::PACKET_READER_AVAILABLE
+    # The subquery fails at the third row, after the rows before it are sent
+    result = @client.query(<<~SQL, stream: true, cache_rows: false)
+      SELECT n, IF(n = 3, (SELECT 1 UNION ALL SELECT 2), n) AS value
+      FROM (SELECT 1 AS n UNION ALL SELECT 2 UNION ALL SELECT 3) AS numbers
+    SQL
+    error = assert_raise(Mysql2::Error) do
+      result.to_arrow(packet_reader: true)
+    end
+    assert_equal(["Subquery returns more than 1 row", [1]],
+                 [error.message, @client.query("SELECT 1", as: :array).first])
+  end
+
+  test("#to_arrow with packet_reader: true and warnings") do
+    omit("my_net_read is not available") unless Mysql2Arrow::PACKET_READER_AVAILABLE
+    sql = "SELECT CAST(CONCAT('x', int_test) AS SIGNED) FROM mysql2_test LIMIT 3"
+    @client.query(sql, stream: true, cache_rows: false).to_arrow
+    expected = @client.warning_count
+    @client.query(sql, stream: true, cache_rows: false).to_arrow(packet_reader: true)
+    assert_equal([expected, [1]],
+                 [@client.warning_count, @client.query("SELECT 1", as: :array).first])
+  end
+
+  test("#cancel_arrow") do
+    omit("mysql_fetch_row_nonblocking is not available") unless Mysql2Arrow::NONBLOCKING_FETCH_AVAILABLE
+    result = @client.query(<<~SQL, stream: true, cache_rows: false)
+      SELECT int_test FROM mysql2_test LIMIT 30000
+    SQL
+    n_rows = 0
+    assert_raise(Mysql2Arrow::Canceled) do
+      result.each_record_batch(rows: 10_000, nonblocking: true) do |record_batch|
+        n_rows += record_batch.n_rows
+        result.cancel_arrow
+      end
+    end
+    assert_equal([10_000, [1]],
+                 [n_rows, @client.query("SELECT 1", as: :array).first])
+  end
+
+  test("#each_record_batch with nonblocking: true under Fiber scheduler") do
+    omit("mysql_fetch_row_nonblocking is not available") unless Mysql2Arrow::NONBLOCKING_FETCH_AVAILABLE
+    omit("Fiber scheduler is not available") unless Fiber.respond_to?(:set_scheduler)
+    # Each row fills a packet and is sent after a sleep,
+    # so that the rows of the other result are converted meanwhile
+    sql = "SELECT SLEEP(0.05), REPEAT('x', 20000) FROM mysql2_test LIMIT 5"
+    clients = 2.times.collect do
+      Mysql2::Client.new(host: "localhost", username: "root", database: "test")
+    end
+    results = clients.collect do |client|
+      client.query(sql, stream: true, cache_rows: false)
+    end
+    order = []
+    thread = Thread.new do
+      Fiber.set_scheduler(Helper::FiberScheduler.new)
+      results.each_with_index do |result, i|
+        Fiber.schedule do
+          result.each_record_batch(rows: 1, nonblocking: true) do
+            order << i
+          end
+        end
+      end
+      Fiber.set_scheduler(nil)
+    end
+    thread.join
+    assert_equal([[0, 0, 0, 0, 0], [1, 1, 1, 1, 1]],
+                 order.partition(&:zero?))
+    assert_operator(order.chunk_while { |a, b| a == b }.count, :>, 2)
+  ensure
+    clients&.each(&:close)
+  end
+
+  test("#to_arrow for prepared statement") do
+    statement = @client.prepare(<<~SQL)
+      SELECT int_test, double_test, decimal_test, varchar_test
+      FROM mysql2_test LIMIT ?
+    SQL
+    expected = statement.execute(100, as: :array).to_a
+    record_batch = statement.execute(100).to_arrow
+    assert_equal(expected.transpose[0],
+                 record_batch[0].to_a)
+    assert_equal(expected.transpose[3],
+                 record_batch[3].to_a)
+  end
 end